@@ -0,0 +1,78 @@
+// Measures how long it takes to walk a drawableCollection with many
+// members, and to find members by name.
+//
+// The members are empty collections, so nothing reaches OpenGL and no
+// graphics window is needed.  What is left is the cost of the
+// traversal itself.
+// Usage: collectionBench [members] [repetitions]
+
+#include "bsg.h"
+#include <chrono>
+#include <sstream>
+
+typedef std::chrono::steady_clock benchClock;
+
+// Returns the average time per repetition, in microseconds.
+double perRep(const benchClock::time_point &start, const int &repetitions) {
+  std::chrono::duration<double, std::micro> elapsed = benchClock::now() - start;
+  return elapsed.count() / repetitions;
+}
+
+int main(int argc, char** argv) {
+
+  int members = (argc > 1) ? std::max(1, atoi(argv[1])) : 5000;
+  int repetitions = (argc > 2) ? std::max(1, atoi(argv[2])) : 200;
+
+  bsg::bsgPtr<bsg::drawableCollection> coll =
+    new bsg::drawableCollection("bench");
+
+  std::vector<std::string> names;
+  for (int i = 0; i < members; i++) {
+    std::stringstream name;
+    name << "member" << i;
+    names.push_back(name.str());
+    coll->addObject(name.str(), new bsg::drawableCollection(name.str()));
+  }
+
+  glm::mat4 identity = glm::mat4(1.0f);
+  coll->load();  // Warm up.
+
+  benchClock::time_point start = benchClock::now();
+  for (int i = 0; i < repetitions; i++) coll->load();
+  double loadTime = perRep(start, repetitions);
+
+  start = benchClock::now();
+  for (int i = 0; i < repetitions; i++) coll->draw(identity, identity);
+  double drawTime = perRep(start, repetitions);
+
+  // Look up every member by name, in a scrambled order.
+  int found = 0;
+  start = benchClock::now();
+  for (int i = 0; i < repetitions; i++) {
+    for (int j = 0; j < members; j++) {
+      if (coll->getObject(names[(j * 7919) % members])) found++;
+    }
+  }
+  double lookupTime = perRep(start, repetitions);
+
+  // Take out a tenth of the members and put them back.
+  start = benchClock::now();
+  for (int i = 0; i < repetitions; i++) {
+    for (int j = i % 10; j < members; j += 10) {
+      coll->addObject(names[j], coll->delObject(names[j]));
+    }
+  }
+  double churnTime = perRep(start, repetitions);
+
+  std::cout << members << " members, " << repetitions << " repetitions"
+            << std::endl;
+  std::cout << "  load:    " << loadTime << " us, "
+            << loadTime * 1000.0 / members << " ns per member" << std::endl;
+  std::cout << "  draw:    " << drawTime << " us, "
+            << drawTime * 1000.0 / members << " ns per member" << std::endl;
+  std::cout << "  lookup:  " << lookupTime << " us for all, "
+            << lookupTime * 1000.0 / members << " ns per name" << std::endl;
+  std::cout << "  del+add: " << churnTime << " us for a tenth" << std::endl;
+
+  return (found == members * repetitions) ? 0 : 1;
+}
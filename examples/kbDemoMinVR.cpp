@@ -19,6 +19,7 @@ private:
 	// shader files we're going to need
 	std::string _vertexFile;
 	std::string _fragmentFile;
+	std::string _instancedVertexFile;
 
 	// These are other global variables
 	float _oscillator;
@@ -85,6 +86,7 @@ private:
 		// Shaders basically color and give texture to objects
 		// Lights are what they sound like
 		bsg::bsgPtr<bsg::shaderMgr> _boardShader = new bsg::shaderMgr();
+		bsg::bsgPtr<bsg::shaderMgr> _wallShader = new bsg::shaderMgr();
 		bsg::bsgPtr<bsg::shaderMgr> _holeShader = new bsg::shaderMgr();
 		bsg::bsgPtr<bsg::shaderMgr> _winShader = new bsg::shaderMgr();
 		bsg::bsgPtr<bsg::shaderMgr> _ballShader = new bsg::shaderMgr();
@@ -100,6 +102,7 @@ private:
 
 		// Add the lights to the shaders
 		_boardShader->addLights(_lights);
+		_wallShader->addLights(_lights);
 		_holeShader->addLights(_lights);
 		_winShader->addLights(_lights);
 		_ballShader->addLights(_lights);
@@ -109,6 +112,10 @@ private:
 		// objects display correctly
 		_boardShader->addShader(bsg::GLSHADER_VERTEX, _vertexFile);
 		_boardShader->addShader(bsg::GLSHADER_FRAGMENT, _fragmentFile);
+		// The walls inside the board are all the same cube, so they are drawn
+		// with instancing, which needs a vertex shader that knows about it
+		_wallShader->addShader(bsg::GLSHADER_VERTEX, _instancedVertexFile);
+		_wallShader->addShader(bsg::GLSHADER_FRAGMENT, _fragmentFile);
 		_holeShader->addShader(bsg::GLSHADER_VERTEX, _vertexFile);
 		_holeShader->addShader(bsg::GLSHADER_FRAGMENT, _fragmentFile);
 		_winShader->addShader(bsg::GLSHADER_VERTEX, _vertexFile);
@@ -118,14 +125,17 @@ private:
 
 		// The shaders are loaded, now compile them.
 		_boardShader->compileShaders();
+		_wallShader->compileShaders();
 		_holeShader->compileShaders();
 		_winShader->compileShaders();
 		_ballShader->compileShaders();
 
 		// Add a texture (just color for now) to the board objects
 		bsg::bsgPtr<bsg::textureMgr> boardTexture = new bsg::textureMgr();
-		boardTexture->readFile(bsg::texturePNG, "../data/board.png");
+		boardTexture->setMipmaps(true);
+		boardTexture->readFileAsync(bsg::texturePNG, "../data/board.png");
 		_boardShader->addTexture(boardTexture);
+		_wallShader->addTexture(boardTexture);
 		// This is the same color as the png. Probably unecessary, but it works
 		glm::vec4 boardColor = glm::vec4(0.549f, 0.408f, 0.263f, 1);
 
@@ -135,19 +145,22 @@ private:
 		// x and z offsets will be random but I only initialize these variables once
 		// to save space. It's not actually an issue on modern machines but might as well.
 		int x_offset, z_offset;
-		// This loop creates and places (randomly) all the walls inside the board
+		// This loop places (randomly) all the walls inside the board. They
+		// are copies of one cube, drawn all at once with instancing
+		bsg::drawableInstanced* walls = new bsg::drawableInstanced("walls", _wallShader);
+		bsg::drawableCube wall(_wallShader, 25, boardColor);
+		walls->addObjects(wall);
 		for (int i = 0; i < _NUM_WALLS; i++) {
-			bsg::drawableCube* x = new bsg::drawableCube(_boardShader, 25, boardColor);
-			x->setScale(glm::vec3(1, 2, 1));
 			x_offset = rand() % 28;
 			z_offset = rand() % 28;
-			x->setPosition(-14.0f + x_offset, 1, -14.0f + z_offset);
-			_board->addObject(x);
+			walls->addInstance(glm::vec3(-14.0f + x_offset, 1, -14.0f + z_offset),
+							   glm::vec3(1, 2, 1));
 		}
+		_board->addObject(walls);
 
 		// Add a texture to the holes
 		bsg::bsgPtr<bsg::textureMgr> holeTexture = new bsg::textureMgr();
-		holeTexture->readFile(bsg::texturePNG, "../data/hole.png");
+		holeTexture->readFileAsync(bsg::texturePNG, "../data/hole.png");
 		_holeShader->addTexture(holeTexture);
 
 		// y offset for 2D objects so they don't flicker (it happens when they're at exactly the same 
@@ -166,7 +179,7 @@ private:
 		// Add a texture to the winner's square and place it randomly. This is what
 		// people roll onto to win the game
 		bsg::bsgPtr<bsg::textureMgr> winTexture = new bsg::textureMgr();
-		winTexture->readFile(bsg::texturePNG, "../data/win.png");
+		winTexture->readFileAsync(bsg::texturePNG, "../data/win.png");
 		_winShader->addTexture(winTexture);
 		x_offset = rand() % 25;
 		y_offset = 0.2f;
@@ -208,11 +221,17 @@ private:
 		// Set the actual board collection. It has to be at the offset to be in front of the viewer at startup
 		_board->setPosition(BOARD_X_OFFSET, BOARD_Y_OFFSET, BOARD_Z_OFFSET);
 		_board->setRotation(0, 0, 0);
+
+		// None of the pieces move relative to the board, so merge them
+		// into a few big objects to save draw calls.  The instanced walls
+		// are left as they are, since merging would copy the cube 80 times.
+		_board->freeze();
 		_scene.addObject(_board);
 
 		// make the shader for the ball
 		bsg::bsgPtr<bsg::textureMgr> ballTexture = new bsg::textureMgr();
-		ballTexture->readFile(bsg::texturePNG, "../data/ball.png");
+		ballTexture->setMipmaps(true);
+		ballTexture->readFileAsync(bsg::texturePNG, "../data/ball.png");
 		_ballShader->addTexture(ballTexture);
 
 		// place the ball randomly, but 10 pixels above the board so it falls (as a fun graphic/proof of gravity)
@@ -277,6 +296,7 @@ public:
 
 		_vertexFile = "../shaders/textureShader.vp";
 		_fragmentFile = "../shaders/textureShader.fp";
+		_instancedVertexFile = "../shaders/instancedTextureShader.vp";
 
 		_oscillator = 0.0f;
 		_yVelocity = 0.0f;
@@ -402,32 +422,45 @@ public:
 				for (bsg::drawableCollection::iterator comp = _board->begin(); comp != _board->end(); comp++) {
 					bsg::bsgPtr<bsg::drawableMulti> multi = comp->second;
 					bsg::DrawableObjList lst = multi->getDrawableObjList();
+					// The walls are one object with many copies, each with its
+					// own model matrix
+					std::vector<glm::mat4> modelMatrices;
+					bsg::drawableInstanced* instanced = bPtr(bsg::drawableInstanced, multi);
+					if (instanced) {
+						for (int i = 0; i < instanced->getNumInstances(); i++) {
+							modelMatrices.push_back(instanced->getInstanceModelMatrix(i));
+						}
+					} else {
+						modelMatrices.push_back(multi->getModelMatrix());
+					}
 					bool isWin = multi->printObj("").find("square") != -1;
 					bool isHole = multi->printObj("").find("circle") != -1;
 					bool isPlane = multi->printObj("").find("plane") != -1;
 					bool is2d =  isWin || isHole || isPlane;
 					for (bsg::DrawableObjList::iterator it = lst.begin(); it != lst.end(); it++) {
 						bsg::drawableObj* obj = it->ptr();
-						if (insideCustomBoundingBox(loc4, multi->getModelMatrix(), obj, is2d)) {
-							// If it's on the plane, we should add to the sideways velocities based on tilt
-							if (isPlane) {
-								_yVelocity = 0;
-								glm::vec3 boardRot = _board->getPitchYawRoll();
-								float sinX = sin(boardRot.x), sinZ = sin(boardRot.z);
-								if (sinX != 0) {
-									_xVelocity += (sinX - GRAVITY)*0.1;
-								} else if (sinZ != 0) {
-									_zVelocity += (sinZ - GRAVITY)*0.1;
+						for (size_t m = 0; m < modelMatrices.size(); m++) {
+							if (insideCustomBoundingBox(loc4, modelMatrices[m], obj, is2d)) {
+								// If it's on the plane, we should add to the sideways velocities based on tilt
+								if (isPlane) {
+									_yVelocity = 0;
+									glm::vec3 boardRot = _board->getPitchYawRoll();
+									float sinX = sin(boardRot.x), sinZ = sin(boardRot.z);
+									if (sinX != 0) {
+										_xVelocity += (sinX - GRAVITY)*0.1;
+									} else if (sinZ != 0) {
+										_zVelocity += (sinZ - GRAVITY)*0.1;
+									}
+								} else {
+									// otherwise we're falling straight down or hit something, so stop
+									_xVelocity = 0, _zVelocity = 0;
+								}
+								// if the thing we just hit is a win square or hole, take the appropriate actions
+								if (isWin) {
+									winner();
+								} else if (isHole) {
+									loser();
 								}
-							} else {
-								// otherwise we're falling straight down or hit something, so stop
-								_xVelocity = 0, _zVelocity = 0;
-							}
-							// if the thing we just hit is a win square or hole, take the appropriate actions
-							if (isWin) {
-								winner();
-							} else if (isHole) {
-								loser();
 							}
 						}
 					}
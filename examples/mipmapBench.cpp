@@ -0,0 +1,65 @@
+// Measures how fast mipmapChain makes mipmaps, with and without SSE2.
+//
+// No graphics window is needed; the mipmaps are made on the CPU.
+// Usage: mipmapBench [size] [repetitions]
+
+#include "bsg.h"
+#include <chrono>
+
+// Makes the chain for the image some number of times, and returns
+// the rate in megapixels (of the original image) per second.
+double timeBuild(const std::vector<unsigned char> &image,
+                 const int &size, const int &repetitions,
+                 const bool &useSIMD) {
+
+  bsg::mipmapChain::setUseSIMD(useSIMD);
+
+  bsg::mipmapChain chain;
+  chain.build(&image[0], size, size, 4);  // Warm up.
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; i++) {
+    chain.build(&image[0], size, size, 4);
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  return (double)size * size * repetitions / elapsed.count() / 1.0e6;
+}
+
+int main(int argc, char** argv) {
+
+  int size = (argc > 1) ? atoi(argv[1]) : 2048;
+  int repetitions = (argc > 2) ? atoi(argv[2]) : 20;
+
+  // Random texels, so nothing can be optimized away.
+  std::vector<unsigned char> image(size * size * 4);
+  for (size_t i = 0; i < image.size(); i++) image[i] = rand() & 0xff;
+
+  // Make sure the two versions agree before timing them.
+  bsg::mipmapChain simd, scalar;
+  bsg::mipmapChain::setUseSIMD(true);
+  simd.build(&image[0], size, size, 4);
+  bsg::mipmapChain::setUseSIMD(false);
+  scalar.build(&image[0], size, size, 4);
+  for (int level = 0; level < simd.getNumLevels(); level++) {
+    size_t bytes = simd.getWidth(level) * simd.getHeight(level) * 4;
+    if (memcmp(simd.getData(level), scalar.getData(level), bytes) != 0) {
+      std::cerr << "SIMD and scalar mipmaps differ at level " << level << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << size << "x" << size << " RGBA, "
+            << simd.getNumLevels() << " levels, "
+            << repetitions << " repetitions" << std::endl;
+
+  double scalarRate = timeBuild(image, size, repetitions, false);
+  double simdRate = timeBuild(image, size, repetitions, true);
+
+  std::cout << "scalar: " << scalarRate << " Mpixel/s" << std::endl;
+  std::cout << "SIMD:   " << simdRate << " Mpixel/s ("
+            << simdRate / scalarRate << "x)" << std::endl;
+
+  return 0;
+}
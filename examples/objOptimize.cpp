@@ -0,0 +1,113 @@
+// Reorders the triangles of an OBJ file for the vertex cache, ahead
+// of time, and reports the cache miss ratio before and after.
+//
+// Usage: objOptimize [-cache n] file.obj [out.obj]
+//
+// Without an output file, it just reports.  The output has one
+// v/vt/vn triple per vertex, in the order the triangles use them, so
+// drawableObjModel loads it in that order, with no work at load time.
+// (Reordering at load time is off unless
+// drawableObjModel::setOptimize(true) is used.)
+//
+// No graphics window is needed; nothing is drawn.
+
+#include "bsg.h"
+#include "bsgObjModel.h"
+#include <chrono>
+
+int main(int argc, char** argv) {
+
+  int cacheSize = 16;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "-cache") && (i + 1 < argc)) {
+      cacheSize = std::max(3, atoi(argv[++i]));
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (files.empty() || (files.size() > 2)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [-cache n] file.obj [out.obj]" << std::endl;
+    return 1;
+  }
+
+  // The shader is never compiled; the model just needs one to exist.
+  bsg::bsgPtr<bsg::shaderMgr> shader = new bsg::shaderMgr();
+
+  bsg::drawableObjModel::setOptimize(false);
+  bsg::bsgPtr<bsg::drawableObjModel> model =
+    new bsg::drawableObjModel(shader, files[0], false);
+
+  if (model->begin() == model->end()) {
+    std::cerr << "Nothing read from " << files[0] << std::endl;
+    return 1;
+  }
+  bsg::bsgPtr<bsg::drawableObj> obj = *(model->begin());
+
+  std::vector<glm::vec4> vertices = obj->getData(bsg::GLDATA_VERTICES);
+  std::vector<glm::vec4> normals = obj->getData(bsg::GLDATA_NORMALS);
+  std::vector<glm::vec2> uvs = obj->getTexCoords();
+  std::vector<GLuint> indices = obj->getIndices();
+  int nVertices = vertices.size();
+
+  float before = bsg::meshOptimizer::getACMR(indices, nVertices, cacheSize);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  bsg::meshOptimizer::optimizeVertexCache(indices, nVertices);
+  std::vector<GLuint> remap =
+    bsg::meshOptimizer::optimizeVertexFetch(indices, nVertices);
+
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::cout << files[0] << ": " << indices.size() / 3 << " triangles, "
+            << nVertices << " vertices, ACMR (" << cacheSize
+            << "-entry cache) " << before << " -> "
+            << bsg::meshOptimizer::getACMR(indices, nVertices, cacheSize)
+            << ", " << elapsed.count() << " ms" << std::endl;
+
+  if (files.size() < 2) return 0;
+
+  vertices = bsg::meshOptimizer::reorder(vertices, remap);
+  normals = bsg::meshOptimizer::reorder(normals, remap);
+  uvs = bsg::meshOptimizer::reorder(uvs, remap);
+
+  std::ofstream out(files[1].c_str());
+  if (!out) {
+    std::cerr << "Can't write " << files[1] << std::endl;
+    return 1;
+  }
+
+  // Enough digits to read back the same floats.
+  out.precision(9);
+
+  out << "# " << files[0] << ", reordered by objOptimize" << std::endl;
+  for (int i = 0; i < nVertices; i++) {
+    out << "v " << vertices[i].x << " " << vertices[i].y << " "
+        << vertices[i].z << std::endl;
+  }
+  for (int i = 0; i < nVertices; i++) {
+    out << "vt " << uvs[i].x << " " << uvs[i].y << std::endl;
+  }
+  for (int i = 0; i < nVertices; i++) {
+    out << "vn " << normals[i].x << " " << normals[i].y << " "
+        << normals[i].z << std::endl;
+  }
+
+  // OBJ indices count from one.
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    out << "f";
+    for (int k = 0; k < 3; k++) {
+      GLuint v = indices[i + k] + 1;
+      out << " " << v << "/" << v << "/" << v;
+    }
+    out << std::endl;
+  }
+
+  return 0;
+}
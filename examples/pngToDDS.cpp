@@ -0,0 +1,110 @@
+// Converts PNG files to compressed DDS files, with mipmaps, for
+// reading with textureMgr::readFile(bsg::textureDDS, ...).
+//
+// Usage: pngToDDS [-bc1 | -bc3] [-threads n] file.png ...
+//
+// Each file.png becomes file.dds.  Images with any transparency are
+// compressed with BC3 (DXT5), and the rest with BC1 (DXT1), unless
+// you say otherwise.  The compression is split among as many threads
+// as the machine has, unless you say otherwise.
+
+#include "bsg.h"
+#include "stb_image.h"
+#include <chrono>
+#include <thread>
+
+int main(int argc, char** argv) {
+
+  int format = 0;  // 0 to choose, 1 for BC1, 3 for BC3.
+  int nThreads = std::max(1, (int)std::thread::hardware_concurrency());
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-bc1") {
+      format = 1;
+    } else if (arg == "-bc3") {
+      format = 3;
+    } else if ((arg == "-threads") && (i + 1 < argc)) {
+      nThreads = std::max(1, atoi(argv[++i]));
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (files.empty()) {
+    std::cerr << "Usage: " << argv[0]
+              << " [-bc1 | -bc3] [-threads n] file.png ..." << std::endl;
+    return 1;
+  }
+
+  // DDS files have their top row first, as the PNG files do, so the
+  // image is not flipped here.  textureMgr turns it over when it
+  // reads the file.
+  int nFailed = 0;
+  for (size_t f = 0; f < files.size(); f++) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int width, height, components;
+    unsigned char* data = stbi_load(files[f].c_str(), &width, &height,
+                                    &components, STBI_rgb_alpha);
+    if (!data) {
+      std::cerr << files[f] << ": " << stbi_failure_reason() << std::endl;
+      nFailed++;
+      continue;
+    }
+
+    bool alpha = (format == 3);
+    if (format == 0) {
+      for (int i = 0; i < width * height; i++) {
+        if (data[4 * i + 3] != 255) {
+          alpha = true;
+          break;
+        }
+      }
+    }
+
+    bsg::mipmapChain mipmaps;
+    mipmaps.build(data, width, height, 4);
+    stbi_image_free(data);
+
+    std::string outName = files[f];
+    size_t dot = outName.rfind('.');
+    if (dot != std::string::npos) outName.erase(dot);
+    outName += ".dds";
+
+    try {
+      bsg::textureCompressor::writeDDS(outName, mipmaps, alpha, nThreads);
+    } catch (std::runtime_error &e) {
+      std::cerr << e.what() << std::endl;
+      nFailed++;
+      continue;
+    }
+
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+    size_t bytes = 0;
+    for (int i = 0; i < mipmaps.getNumLevels(); i++) {
+      bytes += ((mipmaps.getWidth(i) + 3) / 4) * ((mipmaps.getHeight(i) + 3) / 4) *
+        (alpha ? 16 : 8);
+    }
+
+    std::cout << files[f] << " -> " << outName << ": "
+              << width << "x" << height << ", "
+              << mipmaps.getNumLevels() << " levels, "
+              << (alpha ? "BC3" : "BC1") << ", "
+              << bytes << " bytes, down from "
+              << mipmaps.getBytes() << " as RGBA, "
+              << elapsed.count() << " ms" << std::endl;
+
+    if (height % 4 != 0) {
+      std::cout << "  " << outName << " is not a multiple of four texels "
+                << "high, so it will be compressed again as it is read."
+                << std::endl;
+    }
+  }
+
+  return nFailed ? 1 : 0;
+}
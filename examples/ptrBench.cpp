@@ -0,0 +1,189 @@
+// Compares bsgPtr, which keeps its reference count in the object,
+// with the way it used to work, with the count in a separate
+// allocation for every pointer, even a null one.  Also times bsgPtr
+// with a class that doesn't keep its own count, and the atomic
+// increment and decrement that every copy of a bsgPtr costs.
+//
+// No graphics window is needed; nothing is drawn.
+// Usage: ptrBench [operations]
+
+#include "bsg.h"
+#include <chrono>
+#include <thread>
+
+typedef std::chrono::steady_clock benchClock;
+
+#ifdef _MSC_VER
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+// The old bsgPtr, with its reference counter.
+class oldPtrRC {
+ private:
+  int count;
+
+ public:
+  oldPtrRC(int start) : count(start) {};
+  void addRef() { count++; }
+  int release() { return --count; }
+};
+
+template <class T>
+class oldPtr {
+ private:
+  T* _pData;
+  oldPtrRC* _reference;
+
+ public:
+  oldPtr() : _pData(0) { _reference = new oldPtrRC(1); };
+  oldPtr(T* pValue) : _pData(pValue) { _reference = new oldPtrRC(1); };
+  oldPtr(const oldPtr &sp) : _pData(sp._pData), _reference(sp._reference) {
+    _reference->addRef();
+  }
+  ~oldPtr() {
+    if (_reference->release() == 0) {
+      delete _pData;
+      delete _reference;
+    }
+  }
+
+  operator bool() const { return _pData != 0; };
+  T* operator->() const { return _pData; };
+
+  oldPtr<T>& operator=(const oldPtr<T> &sp) {
+    if (this != &sp) {
+      if (_reference->release() == 0) {
+        delete _pData;
+        delete _reference;
+      }
+      _pData = sp._pData;
+      _reference = sp._reference;
+      _reference->addRef();
+    }
+    return *this;
+  }
+};
+
+// Something to point at.  It works with either kind of pointer.
+class benchObj : public bsg::bsgRefCounted {
+ public:
+  int value;
+  benchObj() : value(1) {};
+};
+
+// The same, without a count of its own.
+class plainObj {
+ public:
+  int value;
+  plainObj() : value(1) {};
+};
+
+// Like getObject() when there's no match.  BENCH_NOINLINE keeps the
+// compiler from seeing through it.
+template <class P, class O>
+BENCH_NOINLINE P findNothing(const int &i) {
+  if (i < 0) return P(new O());
+  return NULL;
+}
+
+template <class P, class O>
+BENCH_NOINLINE P makeObj() {
+  return P(new O());
+}
+
+template <class P>
+BENCH_NOINLINE int useCopy(P p) {
+  return p ? p->value : 0;
+}
+
+// Returns nanoseconds per operation.
+double perOp(const benchClock::time_point &start, const int &operations) {
+  std::chrono::duration<double, std::nano> elapsed = benchClock::now() - start;
+  return elapsed.count() / operations;
+}
+
+template <class P, class O>
+void timePtr(const std::string &label, const int &operations) {
+
+  long sum = 0;
+
+  benchClock::time_point start = benchClock::now();
+  for (int i = 0; i < operations; i++) {
+    if (findNothing<P, O>(i)) sum++;
+  }
+  double nullTime = perOp(start, operations);
+
+  start = benchClock::now();
+  for (int i = 0; i < operations; i++) {
+    P p = makeObj<P, O>();
+    sum += p->value;
+  }
+  double newTime = perOp(start, operations);
+
+  P shared = new O();
+  start = benchClock::now();
+  for (int i = 0; i < operations; i++) {
+    sum += useCopy<P>(shared);
+  }
+  double copyTime = perOp(start, operations);
+
+  // Growing a vector moves the pointers, where moving is possible.
+  start = benchClock::now();
+  for (int rep = 0; rep < 10; rep++) {
+    std::vector<P> list;
+    for (int i = 0; i < operations / 10; i++) list.push_back(shared);
+    sum += list.size();
+  }
+  double vectorTime = perOp(start, operations);
+
+  std::cout << label << ":  null " << nullTime << " ns,  new "
+            << newTime << " ns,  copy " << copyTime << " ns,  vector "
+            << vectorTime << " ns  (" << sum << ")" << std::endl;
+}
+
+int main(int argc, char** argv) {
+
+  int operations = (argc > 1) ? std::max(10, atoi(argv[1])) : 10000000;
+
+  std::cout << operations << " operations of each kind, time per operation"
+            << std::endl;
+  timePtr<oldPtr<benchObj>, benchObj>("old bsgPtr", operations);
+  timePtr<bsg::bsgPtr<benchObj>, benchObj>("bsgPtr    ", operations);
+  timePtr<bsg::bsgPtr<plainObj>, plainObj>("bsgPtr, no bsgRefCounted",
+                                           operations);
+
+  // A copy and a drop of the new pointer are an atomic increment and
+  // an atomic decrement.  This is what those cost by themselves, so
+  // most of the difference from the old pointer's copy is the price
+  // of being safe to share among threads.
+  std::atomic<int> count(1);
+  benchClock::time_point atomicStart = benchClock::now();
+  for (int i = 0; i < operations; i++) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    count.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  std::cout << "atomic increment + decrement: "
+            << perOp(atomicStart, operations) << " ns" << std::endl;
+
+  // The new count can be shared among threads.  When they are done,
+  // only the original pointer should be left.
+  bsg::bsgPtr<benchObj> shared = new benchObj();
+  std::vector<std::thread> threads;
+  benchClock::time_point start = benchClock::now();
+  for (int t = 0; t < 4; t++) {
+    threads.push_back(std::thread([&shared, operations]() {
+          for (int i = 0; i < operations / 4; i++) {
+            bsg::bsgPtr<benchObj> copy = shared;
+          }
+        }));
+  }
+  for (int t = 0; t < 4; t++) threads[t].join();
+
+  std::cout << "4 threads copying one pointer: " << perOp(start, operations)
+            << " ns per copy, count afterward " << shared.getCount()
+            << std::endl;
+
+  return (shared.getCount() == 1) ? 0 : 1;
+}
@@ -84,12 +84,16 @@ void renderScene() {
     it->second->setPosition(pos + *jt);
   }
 
-  bsg::bsgNameList inside = rectGroup->insideBoundingBox(glm::vec4(0.0, 0.0, 0.0, 0.0));
+  // Paths are cheaper than names for this, since they are just
+  // numbers.  They turn into readable names when printed.  (There is
+  // also an insideBoundingBox() method that returns names.)
+  std::vector<bsg::bsgPath> inside =
+    rectGroup->insidePaths(glm::vec4(0.0, 0.0, 0.0, 0.0));
 
   if (!inside.empty())
     // This is how you print out a name list.  For this example, the names
     // will only have a single element.  But you might want to change that.
-    for (bsg::bsgNameList::iterator it = inside.begin();
+    for (std::vector<bsg::bsgPath>::iterator it = inside.begin();
          it != inside.end(); it++) {
       std::cout << "test point is inside rectangle " << *it;
       glm::vec3 pos = rectGroup->getObject(*it)->getPosition();
@@ -0,0 +1,119 @@
+// Measures how long it takes to move every node of a big hierarchy
+// and work out all the world matrices, with a transformStore (with
+// and without SSE2) and with scene graph objects.
+//
+// No graphics window is needed; nothing is drawn.
+// Usage: transformBench [nodes] [repetitions]
+
+#include "bsg.h"
+#include <chrono>
+#include <sstream>
+
+typedef std::chrono::steady_clock benchClock;
+
+// Returns the average time per repetition, in microseconds.
+double perRep(const benchClock::time_point &start, const int &repetitions) {
+  std::chrono::duration<double, std::micro> elapsed = benchClock::now() - start;
+  return elapsed.count() / repetitions;
+}
+
+// Every node turns a little, so every matrix has to be redone.
+glm::vec3 spin(const int &node, const int &frame) {
+  return glm::vec3(0.001f * frame, 0.01f * (node % 17), 0.002f * frame);
+}
+
+// Returns the time for update() alone, and for moving the nodes too.
+void timeStore(bsg::transformStore &store, const int &repetitions,
+               const bool &useSIMD, double &updateTime, double &frameTime) {
+
+  bsg::transformStore::setUseSIMD(useSIMD);
+
+  benchClock::time_point start = benchClock::now();
+  for (int f = 0; f < repetitions; f++) store.update();
+  updateTime = perRep(start, repetitions);
+
+  start = benchClock::now();
+  for (int f = 0; f < repetitions; f++) {
+    for (int i = 0; i < store.getNumNodes(); i++) {
+      store.setRotation(i, spin(i, f));
+    }
+    store.update();
+  }
+  frameTime = perRep(start, repetitions);
+}
+
+int main(int argc, char** argv) {
+
+  int nodes = (argc > 1) ? std::max(1, atoi(argv[1])) : 10000;
+  int repetitions = (argc > 2) ? std::max(1, atoi(argv[2])) : 100;
+
+  // A tree with ten children under each node.
+  bsg::transformStore store;
+  // The collections under the root are owned by their parents.
+  bsg::bsgPtr<bsg::drawableCollection> root;
+  std::vector<bsg::drawableCollection*> objects;
+
+  for (int i = 0; i < nodes; i++) {
+
+    int parent = (i == 0) ? -1 : (i - 1) / 10;
+    store.addNode(parent);
+    store.setPosition(i, glm::vec3(1.0f + i % 3, 0.5f, -0.25f * (i % 5)));
+    store.setScale(i, glm::vec3(0.9f, 1.0f, 1.1f));
+
+    std::stringstream name;
+    name << "node" << i;
+    bsg::drawableCollection* obj = new bsg::drawableCollection(name.str());
+    obj->setPosition(store.getPosition(i));
+    obj->setScale(store.getScale(i));
+    if (parent >= 0) {
+      objects[parent]->addObject(obj);
+    } else {
+      root = obj;
+    }
+    objects.push_back(obj);
+  }
+
+  double storeUpdate, storeTime, scalarUpdate, scalarTime;
+  timeStore(store, repetitions, true, storeUpdate, storeTime);
+  timeStore(store, repetitions, false, scalarUpdate, scalarTime);
+
+  benchClock::time_point start = benchClock::now();
+  glm::mat4 sum(0.0f);
+  for (int f = 0; f < repetitions; f++) {
+    for (int i = 0; i < nodes; i++) {
+      objects[i]->setRotation(spin(i, f));
+    }
+    for (int i = 0; i < nodes; i++) {
+      sum += objects[i]->getModelMatrix();
+    }
+  }
+  double objectTime = perRep(start, repetitions);
+
+  // Check that they all agree, as of the last repetition.
+  float maxDiff = 0.0f;
+  for (int pass = 0; pass < 2; pass++) {
+    bsg::transformStore::setUseSIMD(pass == 0);
+    store.update();
+    for (int i = 0; i < nodes; i++) {
+      glm::mat4 a = store.getWorldMatrix(i);
+      glm::mat4 b = objects[i]->getModelMatrix();
+      for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+          maxDiff = std::max(maxDiff, fabsf(a[c][r] - b[c][r]));
+        }
+      }
+    }
+  }
+
+  std::cout << nodes << " nodes, " << repetitions << " repetitions"
+            << std::endl;
+  std::cout << "  update() alone, SSE2:     " << storeUpdate << " us" << std::endl;
+  std::cout << "  update() alone, scalar:   " << scalarUpdate << " us" << std::endl;
+  std::cout << "  with rotations, SSE2:     " << storeTime << " us" << std::endl;
+  std::cout << "  with rotations, scalar:   " << scalarTime << " us" << std::endl;
+  std::cout << "  drawableMulti objects:    " << objectTime << " us" << std::endl;
+  std::cout << "  largest difference:       " << maxDiff
+            << " (" << sum[0][0] << ")" << std::endl;
+
+  return 0;
+}
@@ -1,7 +1,19 @@
 #version 120
 
-// The number of lights is filled in before the shader is compiled.
-const int NUM_LIGHTS = XX;
+// NUM_LIGHTS is defined before the shader is compiled, as the number
+// of lights in the light list.  These other features can be compiled
+// in or out with shaderMgr::addDefine():
+//
+//   HAS_TEXTURE   Color with the texture (the default), or with the
+//                 vertex colors if it's 0.
+//   HAS_SPECULAR  Add specular highlights if it's 1.  Off by default.
+#ifndef HAS_TEXTURE
+#define HAS_TEXTURE 1
+#endif
+#ifndef HAS_SPECULAR
+#define HAS_SPECULAR 0
+#endif
+
 const float MAX_DIST = 50.0;
 const float MAX_DIST_SQUARED = MAX_DIST * MAX_DIST;
 
@@ -10,26 +22,35 @@ varying vec4 colorFrag;
 varying vec2 uvFrag;
 varying vec4 positionWS;
 varying vec4 eyeDirectionCS;
+#if NUM_LIGHTS > 0
 varying vec4 lightDirectionCS[NUM_LIGHTS];
+#endif
 varying vec4 normalCS;
 varying vec4 lightPositionCS;
 
 // Values that stay constant for the whole mesh.
+#if HAS_TEXTURE
 uniform sampler2D textureImage;
+#endif
+#if NUM_LIGHTS > 0
 uniform vec4 lightPositionWS[NUM_LIGHTS];
 uniform vec4 lightColor[NUM_LIGHTS];
+#endif
 
 void main() {
 
+#if HAS_TEXTURE
   vec4 materialColor = texture2D(textureImage, uvFrag);
-  //vec4 materialColor = colorFrag;
+#else
+  vec4 materialColor = colorFrag;
+#endif
   //0.6 * vec4(1.0, 1.0, 1.0, 1.0);
   float ambientCoefficient = 0.3;
-  vec4 materialSpecularColor = 0.5 * vec4(1.0, 1.0, 1.0, 0.0);
 
   vec4 color = 0.05 * colorFrag;
   //vec4 color = vec4(0,0,0,0);
   
+#if NUM_LIGHTS > 0
   // The lighting effects are additive, so we run through the lights,
   // and add their effects.
   for (int i = 0; i < NUM_LIGHTS; i++) {
@@ -50,6 +71,7 @@ void main() {
     // Diffuse : "color" of the object
     vec4 diffuse = materialColor * lightColor[i] * cosAngleFromNormal;
     
+#if HAS_SPECULAR
     // Direction in which the triangle reflects the light
     vec4 reflectDir = reflect(-lightDirectionCS[i], normalCS);
 
@@ -59,14 +81,18 @@ void main() {
 
     // Specular : reflective highlight, like a mirror. Adjust the
     // exponent to adjust the size of the highlight.
+    vec4 materialSpecularColor = 0.5 * vec4(1.0, 1.0, 1.0, 0.0);
     vec4 specular = materialSpecularColor * lightColor[i] * pow(cosAlpha, 5);
     //specular = materialSpecularColor * pow(cosAlpha, 9);
+    diffuse += specular;
+#endif
     
     float attenuation = 1.0 / (1.0 + 0.01 * pow(distanceToLight, 2));
     //attenuation = 1.0;
     
-    color += ambient + attenuation * (diffuse + 0.0 * specular);
+    color += ambient + attenuation * diffuse;
   }
+#endif
   
   gl_FragColor = color; // normalize(normalCS) ;//+ materialColor;
 
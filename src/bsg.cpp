@@ -6,6 +6,28 @@
 
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <chrono>
+
+// For mkstemp() and fchmod(), used to write the program binary cache.
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glm/gtc/packing.hpp>
+
+// stb_image keeps its flip setting and its last error in globals, so
+// only one thread at a time may use it.
+static std::mutex stbMutex;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define BSG_SSE2
+#endif
+
 namespace bsg {
 
 void bsgUtils::printMat(const std::string& name, const glm::mat4& mat) {
@@ -19,6 +41,50 @@ void bsgUtils::printMat(const std::string& name, const glm::mat4& mat) {
   }
 }
 
+bool uniformCache::_changed(const GLint &location, const GLfloat *values,
+                            const size_t &nValues) {
+
+  std::vector<GLfloat> &recorded = _values[location];
+
+  if ((recorded.size() == nValues) &&
+      (memcmp(&recorded[0], values, nValues * sizeof(GLfloat)) == 0)) {
+    _nSkipped++;
+    return false;
+  }
+
+  recorded.assign(values, values + nValues);
+  _nUploaded++;
+  return true;
+}
+
+void uniformCache::uniform1i(const GLint &location, const GLint &value) {
+
+  if (location < 0) return;
+
+  // We store everything as floats.  The bits are what matter.
+  GLfloat bits;
+  memcpy(&bits, &value, sizeof(GLfloat));
+  if (_changed(location, &bits, 1)) glUniform1i(location, value);
+}
+
+void uniformCache::uniform4fv(const GLint &location, const GLsizei &count,
+                              const GLfloat *values) {
+
+  if (location < 0) return;
+
+  if (_changed(location, values, 4 * count))
+    glUniform4fv(location, count, values);
+}
+
+void uniformCache::uniformMatrix4fv(const GLint &location,
+                                    const glm::mat4 &matrix) {
+
+  if (location < 0) return;
+
+  if (_changed(location, &matrix[0][0], 16))
+    glUniformMatrix4fv(location, 1, false, &matrix[0][0]);
+}
+
 // Get a handle for our lighting uniforms.  We are not binding the
 // attribute to a known location, just asking politely for it.  Note
 // that what is going on here is that OpenGL is actually matching
@@ -52,11 +118,765 @@ void lightList::draw() {
   }
 }
 
+void lightList::draw(uniformCache &uniforms) {
+
+  if (_lightPositions.size() > 0) {
+    uniforms.uniform4fv(_lightPositions.ID, _lightPositions.size(),
+                        &_lightPositions.beginAddress()->x);
+    uniforms.uniform4fv(_lightColors.ID, _lightColors.size(),
+                        &_lightColors.beginAddress()->x);
+  }
+}
+
+std::map<std::string, bsgPtr<sharedTexture> > *sharedTexture::_cache = NULL;
+bool sharedTexture::_enabled = true;
+int sharedTexture::_nHits = 0;
+int sharedTexture::_nMisses = 0;
+size_t sharedTexture::_bytesLoaded = 0;
+size_t sharedTexture::_bytesSaved = 0;
+
+std::string sharedTexture::makeKey(const textureType &type,
+                                   const std::string &fileName,
+                                   const std::string &options) {
+
+  std::ostringstream key;
+  key << type << ":" << options << ":" << fileName;
+  return key.str();
+}
+
+bsgPtr<sharedTexture> sharedTexture::find(const std::string &key) {
+
+  if (!_enabled || !_cache) return bsgPtr<sharedTexture>();
+
+  std::map<std::string, bsgPtr<sharedTexture> >::iterator it = _cache->find(key);
+  if (it == _cache->end()) return bsgPtr<sharedTexture>();
+
+  _nHits++;
+  _bytesSaved += it->second->getBytes();
+  return it->second;
+}
+
+void sharedTexture::add(const std::string &key,
+                        const bsgPtr<sharedTexture> &texture) {
+
+  _nMisses++;
+  _bytesLoaded += texture->getBytes();
+
+  if (!_enabled) return;
+
+  if (!_cache) _cache = new std::map<std::string, bsgPtr<sharedTexture> >;
+
+  (*_cache)[key] = texture;
+}
+
+bool sharedTexture::purge(const std::string &key) {
+
+  if (!_cache) return false;
+
+  std::map<std::string, bsgPtr<sharedTexture> >::iterator it = _cache->find(key);
+  if ((it == _cache->end()) || (it->second.getCount() > 1)) return false;
+
+  _cache->erase(it);
+  return true;
+}
+
+int sharedTexture::purge() {
+
+  if (!_cache) return 0;
+
+  int nDropped = 0;
+  std::map<std::string, bsgPtr<sharedTexture> >::iterator it = _cache->begin();
+  while (it != _cache->end()) {
+
+    // If the cache holds the only pointer, no textureMgr is using it.
+    if (it->second.getCount() > 1) {
+      it++;
+    } else {
+      _cache->erase(it++);
+      nDropped++;
+    }
+  }
+
+  return nDropped;
+}
+
+bool mipmapChain::_useSIMD = true;
+
+void mipmapChain::downsample(const unsigned char* in,
+                             const int &width, const int &height,
+                             const int &components, unsigned char* out) {
+
+  int outWidth = (width > 1) ? width / 2 : 1;
+  int outHeight = (height > 1) ? height / 2 : 1;
+  int c = components;
+
+  for (int y = 0; y < outHeight; y++) {
+
+    // A one-texel-high image averages a row with itself, and likewise
+    // for the columns below.  Otherwise an odd last row or column is
+    // left out.
+    const unsigned char* row0 = in + (2 * y) * width * c;
+    const unsigned char* row1 = (height > 1) ? row0 + width * c : row0;
+    unsigned char* outRow = out + y * outWidth * c;
+
+    int x = 0;
+
+#ifdef BSG_SSE2
+    if (_useSIMD && (c == 4) && (width > 1)) {
+
+      // Four output texels at a time, from eight texels in each row.
+      // The sums are done in 16 bits, so they can't overflow.
+      __m128i zero = _mm_setzero_si128();
+      __m128i two = _mm_set1_epi16(2);
+      for (; x + 4 <= outWidth; x += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 8 * x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(row0 + 8 * x + 16));
+        __m128i d = _mm_loadu_si128((const __m128i*)(row1 + 8 * x));
+        __m128i e = _mm_loadu_si128((const __m128i*)(row1 + 8 * x + 16));
+
+        // Add the rows: each register holds two texel pairs.
+        __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(d, zero));
+        __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(d, zero));
+        __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(e, zero));
+        __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(e, zero));
+
+        // Then add the two texels of each pair, round, and divide by four.
+        __m128i t0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+        __m128i t1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+        t0 = _mm_srli_epi16(_mm_add_epi16(t0, two), 2);
+        t1 = _mm_srli_epi16(_mm_add_epi16(t1, two), 2);
+
+        _mm_storeu_si128((__m128i*)(outRow + 4 * x), _mm_packus_epi16(t0, t1));
+      }
+    }
+#endif
+
+    for (; x < outWidth; x++) {
+      int x0 = 2 * x;
+      int x1 = (width > 1) ? x0 + 1 : x0;
+      for (int i = 0; i < c; i++) {
+        outRow[x * c + i] = (row0[x0 * c + i] + row0[x1 * c + i] +
+                             row1[x0 * c + i] + row1[x1 * c + i] + 2) >> 2;
+      }
+    }
+  }
+}
+
+void mipmapChain::build(const unsigned char* data,
+                        const int &width, const int &height,
+                        const int &components, const size_t &maxBytes) {
+
+  _levels.clear();
+  _widths.clear();
+  _heights.clear();
+  _components = components;
+
+  _levels.push_back(std::vector<unsigned char>(data, data + width * height * components));
+  _widths.push_back(width);
+  _heights.push_back(height);
+
+  while ((_widths.back() > 1) || (_heights.back() > 1)) {
+
+    int w = _widths.back();
+    int h = _heights.back();
+    int outWidth = (w > 1) ? w / 2 : 1;
+    int outHeight = (h > 1) ? h / 2 : 1;
+
+    _levels.push_back(std::vector<unsigned char>(outWidth * outHeight * components));
+    downsample(&_levels[_levels.size() - 2][0], w, h, components, &_levels.back()[0]);
+    _widths.push_back(outWidth);
+    _heights.push_back(outHeight);
+  }
+
+  if (maxBytes > 0) {
+    size_t bytes = getBytes();
+    while ((bytes > maxBytes) && (_levels.size() > 1)) {
+      bytes -= _levels.front().size();
+      _levels.erase(_levels.begin());
+      _widths.erase(_widths.begin());
+      _heights.erase(_heights.begin());
+    }
+  }
+}
+
+size_t mipmapChain::getBytes() const {
+
+  size_t bytes = 0;
+  for (size_t i = 0; i < _levels.size(); i++) bytes += _levels[i].size();
+  return bytes;
+}
+
+// Colors in a compressed block are stored in 5:6:5 bits.
+static unsigned short packRGB565(const int* c) {
+  return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+}
+
+static void unpackRGB565(const unsigned short &p, int* c) {
+  c[0] = (p >> 11) & 31;
+  c[1] = (p >> 5) & 63;
+  c[2] = p & 31;
+  c[0] = (c[0] << 3) | (c[0] >> 2);
+  c[1] = (c[1] << 2) | (c[1] >> 4);
+  c[2] = (c[2] << 3) | (c[2] >> 2);
+}
+
+void textureCompressor::compressBlock(const unsigned char* rgba,
+                                      const bool &alpha,
+                                      unsigned char* out) {
+
+  if (alpha) {
+
+    // The alpha block: two end values and eight steps between them,
+    // with three bits per texel to choose one.
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+      lo = std::min(lo, (int)rgba[4 * i + 3]);
+      hi = std::max(hi, (int)rgba[4 * i + 3]);
+    }
+
+    int palette[8];
+    palette[0] = hi;
+    palette[1] = lo;
+    for (int i = 1; i < 7; i++) palette[i + 1] = ((7 - i) * hi + i * lo) / 7;
+
+    unsigned long long bits = 0;
+    if (hi != lo) {
+      for (int i = 0; i < 16; i++) {
+        int a = rgba[4 * i + 3];
+        int best = 0;
+        for (int j = 1; j < 8; j++) {
+          if (abs(palette[j] - a) < abs(palette[best] - a)) best = j;
+        }
+        bits |= (unsigned long long)best << (3 * i);
+      }
+    }
+
+    out[0] = hi;
+    out[1] = lo;
+    for (int i = 0; i < 6; i++) out[2 + i] = (bits >> (8 * i)) & 0xff;
+    out += 8;
+  }
+
+  // The color block: two end colors and two between them, with two
+  // bits per texel to choose one.  The ends are the corners of the
+  // colors' bounding box, pulled in a little, since the extreme
+  // colors are usually rare.
+  int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+  int mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], (int)rgba[4 * i + c]);
+      hi[c] = std::max(hi[c], (int)rgba[4 * i + c]);
+      mean[c] += rgba[4 * i + c];
+    }
+  }
+  for (int c = 0; c < 3; c++) {
+    int inset = (hi[c] - lo[c]) / 16;
+    lo[c] += inset;
+    hi[c] -= inset;
+    mean[c] /= 16;
+  }
+
+  // There are four diagonals of the box to choose from.  Use the one
+  // that matches how red and blue vary with green.
+  int rg = 0, bg = 0;
+  for (int i = 0; i < 16; i++) {
+    int g = rgba[4 * i + 1] - mean[1];
+    rg += (rgba[4 * i] - mean[0]) * g;
+    bg += (rgba[4 * i + 2] - mean[2]) * g;
+  }
+  if (rg < 0) std::swap(lo[0], hi[0]);
+  if (bg < 0) std::swap(lo[2], hi[2]);
+
+  unsigned short c0 = packRGB565(hi);
+  unsigned short c1 = packRGB565(lo);
+
+  // The first color has to be the bigger number, or the decoder will
+  // think we want transparency.
+  if (c0 < c1) std::swap(c0, c1);
+
+  unsigned int bits = 0;
+  if (c0 != c1) {
+    int palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (int i = 0; i < 16; i++) {
+      int best = 0, bestDist = 1 << 30;
+      for (int j = 0; j < 4; j++) {
+        int dist = 0;
+        for (int c = 0; c < 3; c++) {
+          int d = palette[j][c] - rgba[4 * i + c];
+          dist += d * d;
+        }
+        if (dist < bestDist) {
+          best = j;
+          bestDist = dist;
+        }
+      }
+      bits |= best << (2 * i);
+    }
+  }
+
+  out[0] = c0 & 0xff;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xff;
+  out[3] = c1 >> 8;
+  for (int i = 0; i < 4; i++) out[4 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+// Compresses every nThreads-th row of blocks, starting with firstRow.
+static void compressRows(const unsigned char* rgba,
+                         const int &width, const int &height,
+                         const bool &alpha, unsigned char* out,
+                         const int &firstRow, const int &nThreads) {
+
+  int blockBytes = alpha ? 16 : 8;
+  int blocksWide = (width + 3) / 4;
+  int blocksHigh = (height + 3) / 4;
+
+  unsigned char block[64];
+  for (int by = firstRow; by < blocksHigh; by += nThreads) {
+    for (int bx = 0; bx < blocksWide; bx++) {
+
+      // Copy the block, repeating the last row and column if the
+      // image doesn't fill it.
+      for (int y = 0; y < 4; y++) {
+        int iy = std::min(4 * by + y, height - 1);
+        for (int x = 0; x < 4; x++) {
+          int ix = std::min(4 * bx + x, width - 1);
+          memcpy(block + 4 * (4 * y + x), rgba + 4 * (iy * width + ix), 4);
+        }
+      }
+
+      textureCompressor::compressBlock(block, alpha,
+                                       out + (by * blocksWide + bx) * blockBytes);
+    }
+  }
+}
+
+std::vector<unsigned char> textureCompressor::compress(const unsigned char* rgba,
+                                                       const int &width,
+                                                       const int &height,
+                                                       const bool &alpha,
+                                                       const int &nThreads) {
+
+  int blocksHigh = (height + 3) / 4;
+  std::vector<unsigned char> out(((width + 3) / 4) * blocksHigh * (alpha ? 16 : 8));
+
+  int n = std::max(1, std::min(nThreads, blocksHigh));
+  std::vector<std::thread> threads;
+  for (int i = 1; i < n; i++) {
+    threads.push_back(std::thread(compressRows, rgba, width, height, alpha,
+                                  &out[0], i, n));
+  }
+  compressRows(rgba, width, height, alpha, &out[0], 0, n);
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+  return out;
+}
+
+// The DDS file header, after the "DDS " at the start of the file.
+// Everything is a 32-bit little-endian word, whatever this machine
+// uses, so the words are taken apart and put together byte by byte.
+static const int ddsHeaderWords = 31;
+static const unsigned int ddsMagic = 0x20534444;  // "DDS "
+static const unsigned int ddsFourCCDXT1 = 0x31545844;  // "DXT1"
+static const unsigned int ddsFourCCDXT5 = 0x35545844;  // "DXT5"
+
+static void putLittleEndian(const unsigned int* words, const int &nWords,
+                            unsigned char* out) {
+  for (int i = 0; i < nWords; i++) {
+    for (int j = 0; j < 4; j++) out[4 * i + j] = (words[i] >> (8 * j)) & 0xff;
+  }
+}
+
+static void getLittleEndian(const unsigned char* in, const int &nWords,
+                            unsigned int* words) {
+  for (int i = 0; i < nWords; i++) {
+    words[i] = in[4 * i] | (in[4 * i + 1] << 8) |
+      (in[4 * i + 2] << 16) | ((unsigned int)in[4 * i + 3] << 24);
+  }
+}
+
+// Decodes one compressed block into 4x4 RGBA texels.
+static void decodeBlock(const unsigned char* in, const bool &alpha,
+                        unsigned char* rgba) {
+
+  int alphas[16];
+  for (int i = 0; i < 16; i++) alphas[i] = 255;
+
+  if (alpha) {
+    int palette[8];
+    palette[0] = in[0];
+    palette[1] = in[1];
+    if (palette[0] > palette[1]) {
+      for (int i = 1; i < 7; i++)
+        palette[i + 1] = ((7 - i) * palette[0] + i * palette[1]) / 7;
+    } else {
+      for (int i = 1; i < 5; i++)
+        palette[i + 1] = ((5 - i) * palette[0] + i * palette[1]) / 5;
+      palette[6] = 0;
+      palette[7] = 255;
+    }
+
+    unsigned long long bits = 0;
+    for (int i = 0; i < 6; i++) bits |= (unsigned long long)in[2 + i] << (8 * i);
+    for (int i = 0; i < 16; i++) alphas[i] = palette[(bits >> (3 * i)) & 7];
+    in += 8;
+  }
+
+  unsigned short c0 = in[0] | (in[1] << 8);
+  unsigned short c1 = in[2] | (in[3] << 8);
+  int palette[4][4];
+  unpackRGB565(c0, palette[0]);
+  unpackRGB565(c1, palette[1]);
+  palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+
+  // BC1 blocks with the smaller color first have a transparent black.
+  // BC3 blocks always use four colors.
+  for (int c = 0; c < 3; c++) {
+    if (alpha || (c0 > c1)) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  if (!alpha && (c0 <= c1)) palette[3][3] = 0;
+
+  unsigned int bits = in[4] | (in[5] << 8) | (in[6] << 16) |
+    ((unsigned int)in[7] << 24);
+  for (int i = 0; i < 16; i++) {
+    int *color = palette[(bits >> (2 * i)) & 3];
+    rgba[4 * i] = color[0];
+    rgba[4 * i + 1] = color[1];
+    rgba[4 * i + 2] = color[2];
+    rgba[4 * i + 3] = alpha ? alphas[i] : color[3];
+  }
+}
+
+// Turns the first nRows rows of texels in a compressed block upside
+// down.  The color block has a byte of indices per row, and the alpha
+// block (BC3 only) twelve bits.
+static void flipBlock(unsigned char* block, const bool &alpha,
+                      const int &nRows) {
+
+  if (alpha) {
+    unsigned long long bits = 0;
+    for (int i = 0; i < 6; i++) bits |= (unsigned long long)block[2 + i] << (8 * i);
+
+    unsigned long long flipped = 0;
+    for (int y = 0; y < nRows; y++) {
+      flipped |= ((bits >> (12 * y)) & 0xfff) << (12 * (nRows - 1 - y));
+    }
+    for (int i = 0; i < 6; i++) block[2 + i] = (flipped >> (8 * i)) & 0xff;
+    block += 8;
+  }
+
+  std::reverse(block + 4, block + 4 + nRows);
+}
+
+// Turns a compressed mipmap level upside down.  If the rows of blocks
+// are full, or there is only one, that just means reversing the rows
+// of blocks and the rows in each block.  Otherwise the blocks don't
+// line up with the image's rows any more, and the level has to be
+// decoded, turned over, and compressed again, which is slower, and
+// loses a little quality.
+static void flipCompressedLevel(std::vector<char> &level,
+                                const int &width, const int &height,
+                                const bool &alpha) {
+
+  int blockBytes = alpha ? 16 : 8;
+  int blocksWide = (width + 3) / 4;
+  int blocksHigh = (height + 3) / 4;
+  int rowBytes = blocksWide * blockBytes;
+
+  if ((height <= 4) || (height % 4 == 0)) {
+    for (int y = 0; y < blocksHigh / 2; y++) {
+      std::swap_ranges(level.begin() + y * rowBytes,
+                       level.begin() + (y + 1) * rowBytes,
+                       level.begin() + (blocksHigh - 1 - y) * rowBytes);
+    }
+
+    for (size_t i = 0; i < level.size(); i += blockBytes) {
+      flipBlock((unsigned char*)&level[i], alpha, std::min(height, 4));
+    }
+    return;
+  }
+
+  std::vector<unsigned char> rgba(width * height * 4);
+  unsigned char block[64];
+  for (int by = 0; by < blocksHigh; by++) {
+    for (int bx = 0; bx < blocksWide; bx++) {
+      decodeBlock((unsigned char*)&level[by * rowBytes + bx * blockBytes],
+                  alpha, block);
+
+      // Copy the texels that are in the image, upside down.
+      for (int y = 0; y < 4; y++) {
+        int iy = 4 * by + y;
+        if (iy >= height) break;
+        int nx = std::min(4, width - 4 * bx);
+        memcpy(&rgba[4 * ((height - 1 - iy) * width + 4 * bx)],
+               block + 16 * y, 4 * nx);
+      }
+    }
+  }
+
+  std::vector<unsigned char> flipped =
+    textureCompressor::compress(&rgba[0], width, height, alpha);
+  memcpy(&level[0], &flipped[0], level.size());
+}
+
+void textureCompressor::writeDDS(const std::string &fileName,
+                                 const mipmapChain &mipmaps,
+                                 const bool &alpha, const int &nThreads) {
+
+  if (mipmaps.getComponents() != 4)
+    throw std::runtime_error("Can only compress RGBA images.");
+
+  std::vector<std::vector<unsigned char> > levels;
+  for (int i = 0; i < mipmaps.getNumLevels(); i++) {
+    levels.push_back(compress(mipmaps.getData(i), mipmaps.getWidth(i),
+                              mipmaps.getHeight(i), alpha, nThreads));
+  }
+
+  unsigned int header[ddsHeaderWords];
+  memset(header, 0, sizeof(header));
+  header[0] = 124;                    // Header size.
+  header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000 | 0x20000;  // Fields used.
+  header[2] = mipmaps.getHeight(0);
+  header[3] = mipmaps.getWidth(0);
+  header[4] = levels[0].size();       // Size of the first level.
+  header[6] = levels.size();          // Number of mipmap levels.
+  header[18] = 32;                    // Pixel format size.
+  header[19] = 0x4;                   // Pixel format is a four-letter code.
+  header[20] = alpha ? ddsFourCCDXT5 : ddsFourCCDXT1;
+  header[26] = 0x1000 | ((levels.size() > 1) ? (0x400000 | 0x8) : 0);
+
+  unsigned char bytes[4 * (1 + ddsHeaderWords)];
+  putLittleEndian(&ddsMagic, 1, bytes);
+  putLittleEndian(header, ddsHeaderWords, bytes + 4);
+
+  std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary);
+  if (!out.is_open()) throw std::runtime_error("Cannot write: " + fileName);
+
+  out.write((const char*)bytes, sizeof(bytes));
+  for (size_t i = 0; i < levels.size(); i++) {
+    out.write((const char*)&levels[i][0], levels[i].size());
+  }
+
+  if (!out) throw std::runtime_error("Cannot write: " + fileName);
+}
+
+// An image file being decoded by one of the worker threads.
+class textureDecodeJob {
+ public:
+  std::string fileName;
+  unsigned char* data;
+  int width, height, components;
+  std::string error;
+
+  // If mipmaps are wanted, the worker makes them, too.
+  bool mipmaps;
+  size_t maxBytes;
+  mipmapChain chain;
+
+  // Set by the worker when it is finished with the rest of this.
+  std::atomic<bool> done;
+
+  textureDecodeJob(const std::string &name, const bool &wantMipmaps,
+                   const size_t &maxMipmapBytes) :
+    fileName(name), data(NULL), width(0), height(0), components(0),
+    mipmaps(wantMipmaps), maxBytes(maxMipmapBytes), done(false) {};
+  ~textureDecodeJob() { if (data) stbi_image_free(data); };
+};
+
+// A pool of threads that decode images.  There is only one, made
+// the first time it's needed, and it is never destroyed, because the
+// threads might still be running at exit.
+class textureDecoder {
+ private:
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::deque<std::shared_ptr<textureDecodeJob> > _jobs;
+
+  // Jobs that have been submitted, so two textures reading the same
+  // file can share one.
+  std::map<std::string, std::weak_ptr<textureDecodeJob> > _submitted;
+
+  static textureDecoder* _decoder;
+
+  textureDecoder() {
+
+    int nThreads = std::thread::hardware_concurrency();
+    if (nThreads < 1) nThreads = 1;
+    for (int i = 0; i < nThreads; i++) {
+      std::thread(&textureDecoder::_work, this).detach();
+    }
+  };
+
+  void _work() {
+
+    while (true) {
+
+      std::shared_ptr<textureDecodeJob> job;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_jobs.empty()) _wake.wait(lock);
+        job = _jobs.front();
+        _jobs.pop_front();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(stbMutex);
+        stbi_set_flip_vertically_on_load(true);
+        job->data = stbi_load(job->fileName.c_str(), &job->width,
+                              &job->height, &job->components, STBI_rgb_alpha);
+        if (!job->data) job->error = stbi_failure_reason();
+      }
+
+      // The mipmaps don't need stb_image, so they can be made in parallel.
+      if (job->data && job->mipmaps) {
+        job->chain.build(job->data, job->width, job->height, 4, job->maxBytes);
+      }
+
+      job->done = true;
+    }
+  };
+
+ public:
+  static textureDecoder &get() {
+    if (!_decoder) _decoder = new textureDecoder();
+    return *_decoder;
+  };
+
+  std::shared_ptr<textureDecodeJob> submit(const std::string &key,
+                                           const std::string &fileName,
+                                           const bool &mipmaps,
+                                           const size_t &maxBytes) {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Forget the jobs every textureMgr is finished with.
+    std::map<std::string, std::weak_ptr<textureDecodeJob> >::iterator it =
+      _submitted.begin();
+    while (it != _submitted.end()) {
+      if (it->second.expired()) {
+        _submitted.erase(it++);
+      } else {
+        it++;
+      }
+    }
+
+    std::shared_ptr<textureDecodeJob> job = _submitted[key].lock();
+    if (job) return job;
+
+    job = std::make_shared<textureDecodeJob>(fileName, mipmaps, maxBytes);
+    _submitted[key] = job;
+    _jobs.push_back(job);
+    _wake.notify_one();
+    return job;
+  };
+};
+
+textureDecoder* textureDecoder::_decoder = NULL;
+
+std::string textureMgr::_makeKey(const textureType &type,
+                                 const std::string &fileName) {
+
+  std::ostringstream options;
+  options << _minFilter << "," << _magFilter << "," << _mipmaps << "," << _maxBytes;
+  return sharedTexture::makeKey(type, fileName, options.str());
+}
+
+void textureMgr::readFileAsync(const textureType& type,
+                               const std::string& fileName) {
+
+  _pending.reset();
+
+  if (type != texturePNG) {
+    readFile(type, fileName);
+    return;
+  }
+
+  std::string key = _makeKey(type, fileName);
+
+  _shared = sharedTexture::find(key);
+  if (_shared) {
+    _sharedKey = key;
+    _textureBufferID = _shared->getTextureID();
+    _width = _shared->getWidth();
+    _height = _shared->getHeight();
+    return;
+  }
+
+  // Use a checkerboard until the real thing comes along.
+  readFile(textureCHK, "");
+
+  _pendingKey = key;
+  _pending = textureDecoder::get().submit(key, fileName, _mipmaps, _maxBytes);
+}
+
+void textureMgr::_finishPending() {
+
+  // Maybe another textureMgr waiting for the same file got here first.
+  bsgPtr<sharedTexture> texture = sharedTexture::find(_pendingKey);
+
+  if (!texture) {
+    if (!_pending->error.empty()) {
+      std::cerr << "** Cannot read texture " << _pending->fileName << ": "
+                << _pending->error << std::endl;
+      _pending.reset();
+      return;
+    }
+
+    GLuint textureID;
+    if (_pending->mipmaps) {
+      textureID = _uploadMipmaps(_pending->chain);
+    } else {
+      textureID = _uploadImage(_pending->data, _pending->width,
+                               _pending->height, _pending->components);
+    }
+    texture = new sharedTexture(textureID, _width, _height, _bytes);
+    sharedTexture::add(_pendingKey, texture);
+  }
+
+  std::string checkerKey = _sharedKey;
+  _shared = texture;
+  _sharedKey = _pendingKey;
+  _textureBufferID = _shared->getTextureID();
+  _width = _shared->getWidth();
+  _height = _shared->getHeight();
+  _pending.reset();
+
+  // Drop the checkerboard, if no one else is using it.
+  sharedTexture::purge(checkerKey);
+}
+
 void textureMgr::readFile(const textureType& type, const std::string& fileName) {
 
+  _pending.reset();
+
+  std::string key = _makeKey(type, fileName);
+
+  _shared = sharedTexture::find(key);
+  if (_shared) {
+    _sharedKey = key;
+    _textureBufferID = _shared->getTextureID();
+    _width = _shared->getWidth();
+    _height = _shared->getHeight();
+    return;
+  }
+
   switch(type) {
   case textureDDS:
-    throw std::runtime_error("still working on DDS, try PNG");
+    _textureBufferID = _loadDDS(fileName);
     break;
 
   case textureBMP:
@@ -77,6 +897,10 @@ void textureMgr::readFile(const textureType& type, const std::string& fileName)
   default:
     throw std::runtime_error("What texture type is this?");
   }
+
+  _shared = new sharedTexture(_textureBufferID, _width, _height, _bytes);
+  _sharedKey = key;
+  sharedTexture::add(key, _shared);
 }
 
 GLuint textureMgr::_loadTTF(const std::string ttfPath) { // MKE
@@ -109,8 +933,10 @@ GLuint textureMgr::_loadCheckerBoard (const int size, int numFields) {
   glBindTexture(GL_TEXTURE_2D, texture);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _width, _height,
                0, GL_RGB, GL_UNSIGNED_BYTE, image);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, _minFilter);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, _magFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  _bytes = _width * _height * 3;
 
   return texture;
 }
@@ -254,71 +1080,445 @@ GLuint textureMgr::_loadPNG(const std::string imagePath) {
   png_read_image(png_ptr, row_pointers);
   */
 
-  // Neccessary as stb loads images upside down (as OpenGL sees it)
-  stbi_set_flip_vertically_on_load(true);
-
   int width, height, components;
-  unsigned char* data = stbi_load(imagePath.c_str(), &width, &height, &components, STBI_rgb_alpha);//STBI_default);
+  unsigned char* data;
+  const char* failure = NULL;
+  {
+    // The background decoder might be using stb_image, too.
+    std::lock_guard<std::mutex> lock(stbMutex);
+
+    // Neccessary as stb loads images upside down (as OpenGL sees it)
+    stbi_set_flip_vertically_on_load(true);
+
+    data = stbi_load(imagePath.c_str(), &width, &height, &components, STBI_rgb_alpha);//STBI_default);
+    if (!data) failure = stbi_failure_reason();
+  }
   if (!data) {
-	  throw(stbi_failure_reason());
+	  throw(failure);
   }
-  // Generate the OpenGL texture object
+
   GLuint texture;
-  glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
-  if (components == 3) {
-	  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-		  0, GL_RGB, GL_UNSIGNED_BYTE, data);
-  } else if (components == 4) {
-	  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
-		  0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+  if (_mipmaps) {
+    mipmapChain chain;
+    chain.build(data, width, height, 4, _maxBytes);
+    texture = _uploadMipmaps(chain);
+  } else {
+    texture = _uploadImage(data, width, height, components);
   }
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  stbi_image_free(data);
 
   return texture;
 }
 
-void textureMgr::load(const GLuint programID) {
+GLuint textureMgr::_loadDDS(const std::string imagePath) {
 
-  // Get a handle for the texture uniform.
-  _textureAttribID = glGetUniformLocation(programID,
-                                          _textureAttribName.c_str());
-}
+  std::ifstream in(imagePath.c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open()) throw std::runtime_error("Cannot open: " + imagePath);
 
-void textureMgr::draw() {
+  in.seekg(0, std::ios::end);
+  size_t fileBytes = in.tellg();
+  in.seekg(0, std::ios::beg);
 
-  // Bind the texture in Texture Unit 0
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, _textureBufferID);
+  unsigned char headerBytes[4 * (1 + ddsHeaderWords)];
+  unsigned int magic, header[ddsHeaderWords];
+  if ((fileBytes < sizeof(headerBytes)) ||
+      !in.read((char*)headerBytes, sizeof(headerBytes))) {
+    throw std::runtime_error("Not a DDS file: " + imagePath);
+  }
+  getLittleEndian(headerBytes, 1, &magic);
+  getLittleEndian(headerBytes + 4, ddsHeaderWords, header);
+  if ((magic != ddsMagic) || (header[0] != 124) || (header[18] != 32)) {
+    throw std::runtime_error("Not a DDS file: " + imagePath);
+  }
 
-  // Set our "myTextureSampler" sampler to user Texture Unit 0
-  glUniform1i(_textureAttribID, 0);
+  GLenum format;
+  int blockBytes;
+  bool alpha;
+  if (header[20] == ddsFourCCDXT1) {
+    format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    blockBytes = 8;
+    alpha = false;
+  } else if (header[20] == ddsFourCCDXT5) {
+    format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    blockBytes = 16;
+    alpha = true;
+  } else {
+    throw std::runtime_error("Only DXT1 and DXT5 DDS files work: " + imagePath);
+  }
 
-  // The data is actually loaded into the buffer in the loadXX() method.
-}
+  if (!GLEW_EXT_texture_compression_s3tc)
+    throw std::runtime_error("This OpenGL can't do DXT compressed textures.");
 
-std::string shaderMgr::_getShaderInfoLog(GLuint obj) {
-  int infoLogLength = 0;
-  int charsWritten  = 0;
-  char *infoLog;
-  GLint result = GL_FALSE;
-  glGetShaderiv(obj, GL_COMPILE_STATUS, &result);
-  glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &infoLogLength);
+  // Check the sizes against the file before believing them enough to
+  // allocate anything.
+  if ((header[3] < 1) || (header[3] > 65536) ||
+      (header[2] < 1) || (header[2] > 65536)) {
+    throw std::runtime_error("DDS file has a bad size: " + imagePath);
+  }
+  int width = header[3];
+  int height = header[2];
 
-  if (infoLogLength > 1) {
-    infoLog = (char *)malloc(infoLogLength);
-    glGetShaderInfoLog(obj, infoLogLength, &charsWritten, infoLog);
-    return std::string(infoLog);
-  } else {
-    return std::string("");
+  int maxLevels = 1;
+  while ((std::max(width, height) >> maxLevels) > 0) maxLevels++;
+
+  int nLevels = 1;
+  if (header[1] & 0x20000) {
+    if ((header[6] < 1) || (header[6] > (unsigned int)maxLevels))
+      throw std::runtime_error("DDS file has a bad mipmap count: " + imagePath);
+    nLevels = header[6];
   }
-}
 
-std::string shaderMgr::_getProgramInfoLog(GLuint obj) {
+  std::vector<int> widths, heights;
+  std::vector<size_t> sizes;
+  size_t bytes = 0;
+  for (int i = 0; i < nLevels; i++) {
+    widths.push_back(width);
+    heights.push_back(height);
+    sizes.push_back((size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes);
+    bytes += sizes.back();
+
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
 
-  int infologLength = 0;
-  int charsWritten  = 0;
+  if (bytes > fileBytes - sizeof(headerBytes))
+    throw std::runtime_error("DDS file is too short: " + imagePath);
+
+  // Read all the levels.  DDS files have the top row first, and
+  // OpenGL wants the bottom row first, so turn each one over.
+  std::vector<std::vector<char> > levels;
+  for (int i = 0; i < nLevels; i++) {
+    levels.push_back(std::vector<char>(sizes[i]));
+    if (!in.read(&levels.back()[0], sizes[i]))
+      throw std::runtime_error("DDS file is too short: " + imagePath);
+
+    flipCompressedLevel(levels.back(), widths[i], heights[i], alpha);
+  }
+
+  // Leave out the biggest levels if they don't fit the budget.
+  int first = 0;
+  if (_mipmaps && (_maxBytes > 0)) {
+    while ((bytes > _maxBytes) && (first < nLevels - 1)) {
+      bytes -= levels[first].size();
+      first++;
+    }
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  for (int i = first; i < nLevels; i++) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, i - first, format,
+                           widths[i], heights[i], 0,
+                           levels[i].size(), &levels[i][0]);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, nLevels - first - 1);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, _minFilter);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, _magFilter);
+
+  _width = widths[first];
+  _height = heights[first];
+  _bytes = bytes;
+
+  return texture;
+}
+
+GLuint textureMgr::_uploadImage(const unsigned char* data,
+                                const int &width, const int &height,
+                                const int &components) {
+
+  // Generate the OpenGL texture object.  The data is always RGBA,
+  // since that's what we ask stb_image for, but the file might not
+  // have had an alpha channel, in which case we don't need to keep
+  // one.
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, (components == 3) ? GL_RGB : GL_RGBA,
+               width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, _minFilter);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, _magFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  _width = width;
+  _height = height;
+  _bytes = width * height * ((components == 3) ? 3 : 4);
+
+  return texture;
+}
+
+GLuint textureMgr::_uploadMipmaps(const mipmapChain &mipmaps) {
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  // The rows of the small levels are not a multiple of four bytes.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  GLenum format = (mipmaps.getComponents() == 3) ? GL_RGB : GL_RGBA;
+  for (int i = 0; i < mipmaps.getNumLevels(); i++) {
+    glTexImage2D(GL_TEXTURE_2D, i, format,
+                 mipmaps.getWidth(i), mipmaps.getHeight(i), 0,
+                 format, GL_UNSIGNED_BYTE, mipmaps.getData(i));
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipmaps.getNumLevels() - 1);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, _minFilter);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, _magFilter);
+
+  _width = mipmaps.getWidth(0);
+  _height = mipmaps.getHeight(0);
+  _bytes = mipmaps.getBytes();
+
+  return texture;
+}
+
+void textureMgr::load(const GLuint programID) {
+
+  if (_pending && _pending->done) _finishPending();
+
+  // Get a handle for the texture uniform.
+  _textureAttribID = glGetUniformLocation(programID,
+                                          _textureAttribName.c_str());
+}
+
+void textureMgr::draw() {
+
+  // Bind the texture in Texture Unit 0
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, _textureBufferID);
+
+  // Set our "myTextureSampler" sampler to user Texture Unit 0
+  glUniform1i(_textureAttribID, 0);
+
+  // The data is actually loaded into the buffer in the loadXX() method.
+}
+
+void textureMgr::draw(uniformCache &uniforms) {
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, _textureBufferID);
+
+  uniforms.uniform1i(_textureAttribID, 0);
+}
+
+std::map<std::string, bsgPtr<shaderProgram> > *shaderProgram::_registry = NULL;
+bool shaderProgram::_enabled = true;
+int shaderProgram::_nLinked = 0;
+int shaderProgram::_nShared = 0;
+
+bsgPtr<shaderProgram> shaderProgram::find(const std::string &key) {
+
+  if (!_enabled || !_registry) return bsgPtr<shaderProgram>();
+
+  std::map<std::string, bsgPtr<shaderProgram> >::iterator it =
+    _registry->find(key);
+  if (it == _registry->end()) return bsgPtr<shaderProgram>();
+
+  _nShared++;
+  return it->second;
+}
+
+void shaderProgram::add(const std::string &key,
+                        const bsgPtr<shaderProgram> &program) {
+
+  _nLinked++;
+
+  if (!_enabled) return;
+
+  if (!_registry) _registry = new std::map<std::string, bsgPtr<shaderProgram> >;
+
+  (*_registry)[key] = program;
+}
+
+int shaderProgram::purge() {
+
+  if (!_registry) return 0;
+
+  int nDropped = 0;
+  std::map<std::string, bsgPtr<shaderProgram> >::iterator it = _registry->begin();
+  while (it != _registry->end()) {
+
+    // If the registry holds the only pointer, no shader is using it.
+    if (it->second.getCount() > 1) {
+      it++;
+    } else {
+      _registry->erase(it++);
+      nDropped++;
+    }
+  }
+
+  return nDropped;
+}
+
+std::string shaderProgram::_binaryCacheDir = "";
+int shaderProgram::_nBinaryHits = 0;
+int shaderProgram::_nBinaryMisses = 0;
+double shaderProgram::_binaryTimeSaved = 0.0;
+
+bool shaderProgram::usingBinaryCache() {
+
+  // Check the extension late, because GLEW has to be initialized first.
+  return !_binaryCacheDir.empty() &&
+    (GLEW_ARB_get_program_binary || GLEW_VERSION_4_1);
+}
+
+std::string shaderProgram::makeBinaryKey(const std::string &source,
+                                         const int &nLights) {
+
+  std::ostringstream text;
+  text << source << "\n//--\n" << nLights << "\n"
+       << (const char*)glGetString(GL_RENDERER) << "\n"
+       << (const char*)glGetString(GL_VERSION);
+
+  // A 64-bit FNV-1a hash, good enough for a file name.
+  std::string in = text.str();
+  unsigned long long hash = 14695981039346656037ULL;
+  for (std::string::iterator it = in.begin(); it != in.end(); it++) {
+    hash ^= (unsigned char)(*it);
+    hash *= 1099511628211ULL;
+  }
+
+  std::ostringstream key;
+  key << std::hex;
+  key.width(16);
+  key.fill('0');
+  key << hash;
+  return key.str();
+}
+
+std::string shaderProgram::_binaryFileName(const std::string &binaryKey) {
+  return _binaryCacheDir + "/bsg-" + binaryKey + ".bin";
+}
+
+// The cache files hold this, followed by the binary itself.
+struct programBinaryHeader {
+  char magic[8];
+  GLenum format;
+  GLint length;
+  double compileTime;
+};
+
+static const char programBinaryMagic[8] = "bsgPB01";
+
+bool shaderProgram::loadBinary(const GLuint &programID,
+                               const std::string &binaryKey) {
+
+  if (!usingBinaryCache()) return false;
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  std::ifstream in(_binaryFileName(binaryKey).c_str(),
+                   std::ios::in | std::ios::binary);
+
+  programBinaryHeader header;
+  std::vector<char> binary;
+  bool ok = in.is_open() &&
+    in.read((char*)&header, sizeof(header)) &&
+    (memcmp(header.magic, programBinaryMagic, 8) == 0) &&
+    (header.length > 0);
+
+  if (ok) {
+    binary.resize(header.length);
+    ok = (bool)in.read(&binary[0], header.length);
+  }
+
+  if (ok) {
+    glProgramBinary(programID, header.format, &binary[0], header.length);
+
+    // The driver can reject a binary, even one it made itself.
+    GLint linked = GL_FALSE;
+    glGetProgramiv(programID, GL_LINK_STATUS, &linked);
+    ok = (linked == GL_TRUE);
+  }
+
+  if (ok) {
+    double loadTime = std::chrono::duration<double, std::milli>
+      (std::chrono::steady_clock::now() - start).count();
+    _nBinaryHits++;
+    _binaryTimeSaved += header.compileTime - loadTime;
+  } else {
+    _nBinaryMisses++;
+  }
+
+  return ok;
+}
+
+void shaderProgram::saveBinary(const GLuint &programID,
+                               const std::string &binaryKey,
+                               const double &compileTime) {
+
+  if (!usingBinaryCache()) return;
+
+  GLint linked = GL_FALSE;
+  glGetProgramiv(programID, GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE) return;
+
+  programBinaryHeader header;
+  memcpy(header.magic, programBinaryMagic, 8);
+  header.compileTime = compileTime;
+  header.length = 0;
+  glGetProgramiv(programID, GL_PROGRAM_BINARY_LENGTH, &header.length);
+  if (header.length <= 0) return;
+
+  std::vector<char> binary(header.length);
+  glGetProgramBinary(programID, header.length, &header.length,
+                     &header.format, &binary[0]);
+
+  // Several machines might be writing the same file at once, so each
+  // writes its own, and then renames it into place.  mkstemp() picks a
+  // name nobody else has, even on a directory shared across a cluster.
+  std::string fileName = _binaryFileName(binaryKey);
+  std::string tmpName = fileName + ".XXXXXX";
+
+  int fd = mkstemp(&tmpName[0]);
+  if (fd < 0) return;
+
+  // mkstemp() makes the file private, but the cache is for everyone.
+  fchmod(fd, 0644);
+
+  FILE* out = fdopen(fd, "wb");
+  if (!out) {
+    close(fd);
+    remove(tmpName.c_str());
+    return;
+  }
+
+  bool ok = (fwrite(&header, sizeof(header), 1, out) == 1) &&
+    (fwrite(&binary[0], header.length, 1, out) == 1);
+  ok = (fclose(out) == 0) && ok;
+
+  if (!ok || (rename(tmpName.c_str(), fileName.c_str()) != 0)) {
+    remove(tmpName.c_str());
+  }
+}
+
+std::string shaderMgr::_getShaderInfoLog(GLuint obj) {
+  int infoLogLength = 0;
+  int charsWritten  = 0;
+  char *infoLog;
+  GLint result = GL_FALSE;
+  glGetShaderiv(obj, GL_COMPILE_STATUS, &result);
+  glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &infoLogLength);
+
+  if (infoLogLength > 1) {
+    infoLog = (char *)malloc(infoLogLength);
+    glGetShaderInfoLog(obj, infoLogLength, &charsWritten, infoLog);
+    return std::string(infoLog);
+  } else {
+    return std::string("");
+  }
+}
+
+std::string shaderMgr::_getProgramInfoLog(GLuint obj) {
+
+  int infologLength = 0;
+  int charsWritten  = 0;
   char *infoLog;
   glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &infologLength);
 
@@ -350,35 +1550,191 @@ void shaderMgr::addShader(const GLSHADERTYPE type,
   }
 
   _shaderFiles[type] = shaderFile;
+}
 
-  if (_lightList->getNumLights() > 0) {
-    // Edit the shader source to reflect the input number of lights.  If
-    // there is no 'XX' in the shader code, this will cause an ugly
-    // error we have to catch.
-    char numLightsAsString[5];
-    sprintf(numLightsAsString, "%d", _lightList->getNumLights());
-    try {
-      _shaderText[type].replace(_shaderText[type].find("XX"), 2,
-                                numLightsAsString);
-    } catch (...) {
-      std::cerr << "Caution: Shader ("
-                << shaderFile
-                << ") does not care about number of lights." << std::endl;
-    }
-  } else {
-    if (_shaderText[type].find("XX") != std::string::npos) {
-      std::cerr << "Caution: Shader ("
-                << shaderFile
-                << ") is meant to use lights, and you have added no lights."
-                << std::endl;
+// The attribute names used by the bsgMenagerie shapes, in the order
+// of the locations they are given.
+static const char* standardAttribs[] = { "position", "color", "normal", "texture" };
+static const int nStandardAttribs = 4;
+
+GLint shaderMgr::getStandardAttribLocation(const std::string &name) {
+
+  for (int i = 0; i < nStandardAttribs; i++) {
+    if (name == standardAttribs[i]) return i;
+  }
+  return -1;
+}
+
+void shaderMgr::addDefine(const std::string &name, const std::string &value) {
+
+  if (_compiled)
+    throw std::runtime_error("Must add definitions before compiling shader.");
+
+  _defines[name] = value;
+}
+
+void shaderMgr::addDefine(const std::string &name, const int &value) {
+
+  std::ostringstream text;
+  text << value;
+  addDefine(name, text.str());
+}
+
+void shaderMgr::declareVariant(const shaderDefines &defines) {
+
+  if (_compiled)
+    throw std::runtime_error("Must declare variants before compiling shader.");
+
+  _declaredVariants.push_back(defines);
+}
+
+shaderDefines shaderMgr::_allDefines(const shaderDefines &defines) {
+
+  std::ostringstream numLights;
+  numLights << _lightList->getNumLights();
+
+  shaderDefines out = _defines;
+  out["NUM_LIGHTS"] = numLights.str();
+  for (shaderDefines::const_iterator it = defines.begin();
+       it != defines.end(); it++) {
+    out[it->first] = it->second;
+  }
+  return out;
+}
+
+std::string shaderMgr::_addDefines(const std::string &text,
+                                   const shaderDefines &defines) {
+
+  if (text.empty()) return text;
+
+  // Older shaders have 'XX' where the number of lights goes, as in
+  // "const int NUM_LIGHTS = XX;".  Those can't have NUM_LIGHTS as a
+  // macro, too, or that line would come out "const int 3 = 3;".
+  std::string out = text;
+  bool haveXX = false;
+  size_t xx = out.find("XX");
+  if (xx != std::string::npos) {
+    std::ostringstream numLights;
+    numLights << _lightList->getNumLights();
+    out.replace(xx, 2, numLights.str());
+    haveXX = true;
+  }
+
+  std::string preamble;
+  for (shaderDefines::const_iterator it = defines.begin();
+       it != defines.end(); it++) {
+    if (haveXX && (it->first == "NUM_LIGHTS")) continue;
+    preamble += "#define " + it->first + " " + it->second + "\n";
+  }
+
+  // The definitions go right after the #version line, which has to
+  // come first.  Without one, the version is 1.10, and they go at the
+  // top.  The text from addShader() starts with an extra newline.
+  size_t start = (out[0] == '\n') ? 1 : 0;
+  size_t insertAt = start;
+  int lineNumber = 0;
+  int versionNumber = 110;
+  size_t version = out.find("#version");
+  if (version != std::string::npos) {
+    std::istringstream(out.substr(version + 8, 8)) >> versionNumber;
+    insertAt = out.find('\n', version);
+    if (insertAt == std::string::npos) {
+      out += "\n";
+      insertAt = out.size();
+    } else {
+      insertAt++;
     }
+    lineNumber = std::count(out.begin() + start, out.begin() + insertAt, '\n');
   }
+
+  // The #line directive puts the line numbers in error messages back
+  // the way they are in the file.  Up to GLSL 1.50 (and ES 1.00),
+  // "#line n" makes the next line n + 1.  From 3.30 (and ES 3.00)
+  // on, it makes it n.
+  if (versionNumber >= 300) lineNumber++;
+
+  std::ostringstream lines;
+  lines << preamble << "#line " << lineNumber << "\n";
+  out.insert(insertAt, lines.str());
+  return out;
 }
 
 void shaderMgr::compileShaders() {
 
+  _program = _compileVariant(shaderDefines());
+  _programID = _program->getProgram();
+  _compiled = true;
+
+  for (size_t i = 0; i < _declaredVariants.size(); i++) {
+    _compileVariant(_declaredVariants[i]);
+  }
+}
+
+void shaderMgr::useVariant(const shaderDefines &defines) {
+
+  if (!_compiled) throw std::runtime_error("Shader is not compiled yet.");
+
+  _program = _compileVariant(defines);
+  _programID = _program->getProgram();
+
+  // The uniform IDs of the lights and texture belong to the old
+  // program, so look them up again.  The drawableCompound objects
+  // using this shader notice the change and do the same for theirs.
+  useProgram();
+  load();
+}
+
+bsgPtr<shaderProgram> shaderMgr::_compileVariant(const shaderDefines &defines) {
+
+  shaderDefines all = _allDefines(defines);
+  std::string preamble;
+  for (shaderDefines::iterator it = all.begin(); it != all.end(); it++) {
+    preamble += "#define " + it->first + " " + it->second + "\n";
+  }
+
+  // Maybe we've made this one already.
+  std::map<std::string, bsgPtr<shaderProgram> >::iterator vt =
+    _variants.find(preamble);
+  if (vt != _variants.end()) return vt->second;
+
+  std::vector<std::string> text(3);
+  text[GLSHADER_VERTEX] = _addDefines(_shaderText[GLSHADER_VERTEX], all);
+  text[GLSHADER_FRAGMENT] = _addDefines(_shaderText[GLSHADER_FRAGMENT], all);
+  text[GLSHADER_GEOMETRY] = _addDefines(_shaderText[GLSHADER_GEOMETRY], all);
+
   // geom is true if there *is* a geometry shader in place.
-  bool geom = (!_shaderText[GLSHADER_GEOMETRY].empty());
+  bool geom = (!text[GLSHADER_GEOMETRY].empty());
+
+  // If some other shaderMgr has compiled exactly this text, just use
+  // its program.  The separators keep a vertex shader from matching
+  // the start of some other fragment shader.  The definitions are
+  // part of the text, so each variant gets its own program.
+  std::string key = text[GLSHADER_VERTEX] + "\n//--\n" +
+    text[GLSHADER_FRAGMENT] + "\n//--\n" +
+    text[GLSHADER_GEOMETRY];
+
+  bsgPtr<shaderProgram> program = shaderProgram::find(key);
+  if (program) {
+    _variants[preamble] = program;
+    return program;
+  }
+
+  GLuint programID = glCreateProgram();
+  program = new shaderProgram(programID);
+
+  // Maybe a previous run left the linked program on disk.
+  std::string binaryKey;
+  if (shaderProgram::usingBinaryCache()) {
+    binaryKey = shaderProgram::makeBinaryKey(key, _lightList->getNumLights());
+    if (shaderProgram::loadBinary(programID, binaryKey)) {
+      shaderProgram::add(key, program);
+      _variants[preamble] = program;
+      return program;
+    }
+  }
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
 
   _shaderIDs[GLSHADER_VERTEX] = glCreateShader(GL_VERTEX_SHADER);
   _shaderIDs[GLSHADER_FRAGMENT] = glCreateShader(GL_FRAGMENT_SHADER);
@@ -386,10 +1742,10 @@ void shaderMgr::compileShaders() {
 
   // The OpenGL calls don't really like the modern C++ types, so we
   // convert back to old-fashioned char*.
-  const char* vs = _shaderText[GLSHADER_VERTEX].c_str();
-  const char* fs = _shaderText[GLSHADER_FRAGMENT].c_str();
+  const char* vs = text[GLSHADER_VERTEX].c_str();
+  const char* fs = text[GLSHADER_FRAGMENT].c_str();
   const char* gs;
-  if (geom) gs = _shaderText[GLSHADER_GEOMETRY].c_str();
+  if (geom) gs = text[GLSHADER_GEOMETRY].c_str();
 
   // Feed the shader source to OpenGL.
   glShaderSource(_shaderIDs[GLSHADER_VERTEX], 1, &vs, NULL);
@@ -404,7 +1760,7 @@ void shaderMgr::compileShaders() {
     std::cerr << "** Vertex compile error in "
               << _shaderFiles[GLSHADER_VERTEX]
               << std::endl << errorLog << std::endl;
-    //std::cerr << _shaderText[GLSHADER_VERTEX] << std::endl;
+    //std::cerr << text[GLSHADER_VERTEX] << std::endl;
   }
 
 
@@ -424,18 +1780,30 @@ void shaderMgr::compileShaders() {
                 << std::endl << errorLog << std::endl;
   }
 
-  // Now create a program to contain our two (or three) shaders, and
-  // attach the shaders to it.
-  _programID = glCreateProgram();
-  glAttachShader(_programID, _shaderIDs[GLSHADER_VERTEX]);
-  glAttachShader(_programID, _shaderIDs[GLSHADER_FRAGMENT]);
-  if (geom) glAttachShader(_programID, _shaderIDs[GLSHADER_GEOMETRY]);
+  // Now attach the shaders to the program, to make a program of two
+  // (or three) shaders.
+  glAttachShader(programID, _shaderIDs[GLSHADER_VERTEX]);
+  glAttachShader(programID, _shaderIDs[GLSHADER_FRAGMENT]);
+  if (geom) glAttachShader(programID, _shaderIDs[GLSHADER_GEOMETRY]);
+
+  // Give the attribute names used by the bsgMenagerie shapes the same
+  // locations in every program.  That way a shape's buffers and vertex
+  // array work with any shader, and shapes can be shared among
+  // objects with different shaders.  Shaders that don't use these
+  // names are not affected.
+  for (int i = 0; i < nStandardAttribs; i++) {
+    glBindAttribLocation(programID, i, standardAttribs[i]);
+  }
+
+  // Tell the driver we'll want the binary back.
+  if (!binaryKey.empty())
+    glProgramParameteri(programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
   // Assemble the shaders into a single program with 'link', which
   // will make sure that the inputs to the fragment shader correspond
   // with outputs from the vertex shader, and so on.
-  glLinkProgram(_programID);
-  errorLog = _getProgramInfoLog(_programID);
+  glLinkProgram(programID);
+  errorLog = _getProgramInfoLog(programID);
   if (errorLog.size() > 1) {
     std::cerr << "** Shader link error in"
               << _shaderFiles[GLSHADER_VERTEX] << ", "
@@ -450,7 +1818,23 @@ void shaderMgr::compileShaders() {
   glDeleteShader(_shaderIDs[GLSHADER_FRAGMENT]);
   if (geom) glDeleteShader(_shaderIDs[GLSHADER_GEOMETRY]);
 
-  _compiled = true;
+  // Only a program that linked is worth sharing or remembering.  One
+  // that failed is handed back once, so the caller can carry on, and
+  // asking for it again tries again.
+  GLint linked = GL_FALSE;
+  glGetProgramiv(programID, GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE) return program;
+
+  shaderProgram::add(key, program);
+  _variants[preamble] = program;
+
+  if (!binaryKey.empty()) {
+    shaderProgram::saveBinary(programID, binaryKey,
+                              std::chrono::duration<double, std::milli>
+                              (std::chrono::steady_clock::now() - start).count());
+  }
+
+  return program;
 }
 
 GLuint shaderMgr::getAttribID(const std::string& attribName) {
@@ -463,7 +1847,7 @@ GLuint shaderMgr::getUniformID(const std::string& unifName) {
   return glGetUniformLocation(_programID, unifName.c_str());
 }
 
-void shaderMgr::addLights(const bsgPtr<lightList> lightList) {
+void shaderMgr::addLights(const bsgPtr<lightList> &lightList) {
   if (_compiled) {
     throw std::runtime_error("Must load lights before compiling shader.");
   } else {
@@ -477,66 +1861,491 @@ void shaderMgr::load() {
 }
 
 void shaderMgr::draw() {
-  _lightList->draw();
-  if (_textureLoaded) _texture->draw();
+  _lightList->draw(_program->getUniforms());
+  if (_textureLoaded) _texture->draw(_program->getUniforms());
 }
 
-void drawableObj::addData(const GLDATATYPE type,
-                          const std::string& name,
-                          const std::vector<glm::vec4>& data) {
+size_t streamBuffer::_defaultRegionSize = 1 << 20;
+streamBuffer* streamBuffer::_streamBuffer = NULL;
+unsigned int streamBuffer::_nextFrame = 0;
 
-  switch(type) {
-  case(GLDATA_VERTICES):
-    _vertices = drawableObjData<glm::vec4>(name, data);
-    break;
-  case(GLDATA_COLORS):
-    _colors = drawableObjData<glm::vec4>(name, data);
-    break;
-  case(GLDATA_NORMALS):
-    _normals = drawableObjData<glm::vec4>(name, data);
-    break;
-  case(GLDATA_TEXCOORDS):
-    throw std::runtime_error("Do not use vec4 for texture coordinates.");
-    break;
-  }
-  _loadedIntoBuffer = false;
+streamBuffer::streamBuffer(const size_t &regionSize) :
+  _regionSize(regionSize), _region(0), _used(0), _regionsThisFrame(1),
+  _frame(_nextFrame), _mapped(NULL), _mappedFrom(0), _nStalls(0),
+  _bytesStreamed(0) {
+
+  for (int i = 0; i < _nRegions; i++) _fences[i] = NULL;
+
+  glGenBuffers(1, &_bufferID);
+  glBindBuffer(GL_ARRAY_BUFFER, _bufferID);
+  glBufferData(GL_ARRAY_BUFFER, _nRegions * _regionSize, NULL, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void drawableObj::addData(const GLDATATYPE type,
-             const std::string& name,
-             const std::vector<glm::vec2>& data) {
+streamBuffer::~streamBuffer() {
 
-  switch(type) {
-  case(GLDATA_TEXCOORDS):
-    _uvs = drawableObjData<glm::vec2>(name, data);
-    break;
-  case(GLDATA_COLORS):
-  case(GLDATA_NORMALS):
-  case(GLDATA_VERTICES):
-    throw std::runtime_error("Vec2 is only for texture coordinates.");
-    break;
+  flush();
+  for (int i = 0; i < _nRegions; i++) {
+    if (_fences[i]) glDeleteSync(_fences[i]);
   }
-  _loadedIntoBuffer = false;
+  glDeleteBuffers(1, &_bufferID);
+
+  // Whatever was written to this buffer is no good any more.
+  _nextFrame = _frame + _nRegions;
 }
 
-void drawableObj::setData(const GLDATATYPE type,
-                          const std::vector<glm::vec4>& data) {
+streamBuffer* streamBuffer::get() {
 
-  switch(type) {
-  case(GLDATA_VERTICES):
-    _vertices.setData(data);
-    break;
-  case(GLDATA_COLORS):
-    _colors.setData(data);
-    break;
-  case(GLDATA_NORMALS):
-    _normals.setData(data);
-    break;
+  // Like the program and texture registries, this lives as long as
+  // the GL context does, unless destroy() is called.
+  if (!_streamBuffer) _streamBuffer = new streamBuffer(_defaultRegionSize);
+  return _streamBuffer;
+}
+
+void streamBuffer::destroy() {
+
+  delete _streamBuffer;
+  _streamBuffer = NULL;
+}
+
+bool streamBuffer::_usingFences() {
+
+  return GLEW_ARB_sync || GLEW_VERSION_3_2;
+}
+
+void streamBuffer::nextFrame() {
+
+  // If nothing was written, there's no need to move on, and whatever
+  // was written before stays good for longer.
+  if (_used == 0) return;
+
+  flush();
+
+  if (_usingFences()) {
+
+    // Mark the end of the commands that read the regions this frame
+    // used.  This can't be done when a frame moves on early, since
+    // its draws from the region it left haven't been issued yet.
+    for (int i = 0; i < _regionsThisFrame; i++) {
+      int region = (_region - i + _nRegions) % _nRegions;
+      _fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    _nextRegion();
+
+  } else {
+
+    // No fences, so we can't tell when the GPU is done with any of
+    // the buffer.  Orphan it: the driver gives us new storage and
+    // lets go of the old when the draws using it are done.  Skip the
+    // frame count past everything in the old storage, so it is all
+    // written again.
+    glBindBuffer(GL_ARRAY_BUFFER, _bufferID);
+    glBufferData(GL_ARRAY_BUFFER, _nRegions * _regionSize, NULL,
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    _region = 0;
+    _used = 0;
+    _frame += _nRegions;
+  }
+
+  _regionsThisFrame = 1;
+}
+
+void streamBuffer::_nextRegion() {
+
+  _region = (_region + 1) % _nRegions;
+  _used = 0;
+  _frame++;
+
+  // The region we're about to fill was last drawn from a couple of
+  // frames ago, so this should be long finished.
+  if (_fences[_region]) {
+    GLenum result = glClientWaitSync(_fences[_region], 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+      _nStalls++;
+      while (result == GL_TIMEOUT_EXPIRED) {
+        result = glClientWaitSync(_fences[_region],
+                                  GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+      }
+    }
+    glDeleteSync(_fences[_region]);
+    _fences[_region] = NULL;
+  }
+}
+
+bool streamBuffer::write(const void *data, const size_t &bytes,
+                         GLintptr &offset) {
+
+  if (bytes > _regionSize) return false;
+
+  // Keep everything aligned, so any vertex format is happy.
+  size_t start = (_used + 15) & ~(size_t)15;
+  if (start + bytes > _regionSize) {
+
+    // The next region might still be waiting for this frame's draws.
+    if (_regionsThisFrame == _nRegions) return false;
+
+    // No fence yet for the region we're leaving: it's set at the end
+    // of the frame, after the draws from it.
+    flush();
+    _nextRegion();
+    _regionsThisFrame++;
+    start = 0;
+  }
+  offset = _region * _regionSize + start;
+
+  // Map the rest of the region for this and the following writes.
+  // Nobody can be reading it, so there's no need for the driver to
+  // check.
+  if (!_mapped && (GLEW_ARB_map_buffer_range || GLEW_VERSION_3_0)) {
+    glBindBuffer(GL_ARRAY_BUFFER, _bufferID);
+    _mapped = (unsigned char *)
+      glMapBufferRange(GL_ARRAY_BUFFER, offset, _regionSize - start,
+                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                       GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    _mappedFrom = offset;
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  if (_mapped) {
+    memcpy(_mapped + (offset - _mappedFrom), data, bytes);
+  } else {
+    glBindBuffer(GL_ARRAY_BUFFER, _bufferID);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  _used = start + bytes;
+  _bytesStreamed += bytes;
+  return true;
+}
+
+void streamBuffer::flush() {
+
+  if (!_mapped) return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, _bufferID);
+  glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0,
+                           _region * _regionSize + _used - _mappedFrom);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  _mapped = NULL;
+}
+
+float meshOptimizer::getACMR(const std::vector<GLuint> &indices,
+                              const int &nVertices, const int &cacheSize) {
+
+  if (indices.size() < 3) return 0.0f;
+
+  // A vertex is in the cache if fewer than cacheSize others have been
+  // loaded since it was.  Each miss loads one vertex, so the number of
+  // misses so far serves as the clock.
+  std::vector<int> loadedAt(nVertices, -1);
+  int misses = 0;
+  for (size_t i = 0; i < indices.size(); i++) {
+    int &t = loadedAt[indices[i]];
+    if ((t < 0) || (misses - t >= cacheSize)) {
+      t = misses;
+      misses++;
+    }
+  }
+
+  return (float)misses / (indices.size() / 3);
+}
+
+// The vertex scoring from Forsyth's paper.  The tuning constants are
+// his: a vertex used by the triangle just added scores 0.75, a vertex
+// further back in the cache scores less, dropping to zero as it is
+// about to fall out, and vertices with only a few triangles left to
+// draw get a boost, so they are finished off rather than left alone
+// to be loaded again later.
+static const int forsythCacheSize = 32;
+static const int forsythMaxValence = 32;
+
+static float forsythScore(const int &cachePosition, const int &remaining) {
+
+  if (remaining == 0) return -1.0f;
+
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      score = 0.75f;
+    } else {
+      score = pow(1.0f - (float)(cachePosition - 3) /
+                  (forsythCacheSize - 3), 1.5f);
+    }
+  }
+
+  return score + 2.0f * pow((float)remaining, -0.5f);
+}
+
+// The scores only depend on two small numbers, so we look them up
+// rather than call pow() all the time.
+static float forsythTableScore(const int &cachePosition, const int &remaining) {
+
+  static std::vector<float> table;
+  if (table.empty()) {
+    table.resize((forsythCacheSize + 1) * (forsythMaxValence + 1));
+    for (int c = -1; c < forsythCacheSize; c++) {
+      for (int r = 0; r <= forsythMaxValence; r++) {
+        table[(c + 1) * (forsythMaxValence + 1) + r] = forsythScore(c, r);
+      }
+    }
+  }
+
+  if (remaining > forsythMaxValence) return forsythScore(cachePosition, remaining);
+  return table[(cachePosition + 1) * (forsythMaxValence + 1) + remaining];
+}
+
+void meshOptimizer::optimizeVertexCache(std::vector<GLuint> &indices,
+                                        const int &nVertices) {
+
+  int nTriangles = indices.size() / 3;
+  if (nTriangles < 2) return;
+
+  // The triangles using each vertex.  The ones not yet drawn are kept
+  // at the front of each vertex's list, remaining[v] of them.
+  std::vector<int> remaining(nVertices, 0);
+  for (int i = 0; i < 3 * nTriangles; i++) remaining[indices[i]]++;
+
+  std::vector<int> first(nVertices + 1, 0);
+  for (int v = 0; v < nVertices; v++) first[v + 1] = first[v] + remaining[v];
+
+  std::vector<int> triangles(3 * nTriangles);
+  std::vector<int> filled(first.begin(), first.end() - 1);
+  for (int i = 0; i < 3 * nTriangles; i++) {
+    triangles[filled[indices[i]]++] = i / 3;
+  }
+
+  std::vector<int> cachePosition(nVertices, -1);
+  std::vector<float> vertexScore(nVertices);
+  for (int v = 0; v < nVertices; v++) {
+    vertexScore[v] = forsythTableScore(-1, remaining[v]);
+  }
+
+  std::vector<float> triangleScore(nTriangles);
+  int best = 0;
+  for (int t = 0; t < nTriangles; t++) {
+    triangleScore[t] = vertexScore[indices[3 * t]] +
+      vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+    if (triangleScore[t] > triangleScore[best]) best = t;
+  }
+
+  std::vector<bool> added(nTriangles, false);
+  std::vector<GLuint> out;
+  out.reserve(3 * nTriangles);
+
+  std::vector<int> cache, newCache;
+  int nextUnadded = 0;
+
+  for (int n = 0; n < nTriangles; n++) {
+
+    // Nothing in the cache is any use, so start over with the first
+    // triangle not yet drawn.  Forsyth suggests this shortcut over
+    // searching all of them for the best score; it costs little.
+    if (best < 0) {
+      while (added[nextUnadded]) nextUnadded++;
+      best = nextUnadded;
+    }
+
+    added[best] = true;
+    newCache.clear();
+    for (int k = 0; k < 3; k++) {
+      int v = indices[3 * best + k];
+      out.push_back(v);
+
+      // Take this triangle off the vertex's list of remaining ones.
+      int *list = &triangles[first[v]];
+      for (int i = 0; i < remaining[v]; i++) {
+        if (list[i] == best) {
+          std::swap(list[i], list[remaining[v] - 1]);
+          break;
+        }
+      }
+      remaining[v]--;
+
+      if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+        newCache.push_back(v);
+    }
+
+    // The triangle's vertices go to the front of the cache, pushing
+    // the rest back, and maybe out.
+    const int corners[3] = { (int)indices[3 * best],
+                             (int)indices[3 * best + 1],
+                             (int)indices[3 * best + 2] };
+    for (size_t i = 0; i < cache.size(); i++) {
+      if ((cache[i] != corners[0]) && (cache[i] != corners[1]) &&
+          (cache[i] != corners[2]))
+        newCache.push_back(cache[i]);
+    }
+
+    for (size_t i = 0; i < newCache.size(); i++) {
+      int v = newCache[i];
+      cachePosition[v] = (i < forsythCacheSize) ? (int)i : -1;
+      vertexScore[v] = forsythTableScore(cachePosition[v], remaining[v]);
+    }
+    if (newCache.size() > forsythCacheSize) newCache.resize(forsythCacheSize);
+    cache.swap(newCache);
+
+    // Only the triangles of cached vertices have changed score, and the
+    // best of those is the next one to draw.
+    best = -1;
+    float bestScore = -1.0f;
+    for (size_t i = 0; i < cache.size(); i++) {
+      int v = cache[i];
+      for (int j = 0; j < remaining[v]; j++) {
+        int t = triangles[first[v] + j];
+        triangleScore[t] = vertexScore[indices[3 * t]] +
+          vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+        if (triangleScore[t] > bestScore) {
+          bestScore = triangleScore[t];
+          best = t;
+        }
+      }
+    }
+  }
+
+  // Anything left over that isn't a whole triangle stays at the end.
+  out.insert(out.end(), indices.begin() + 3 * nTriangles, indices.end());
+  indices.swap(out);
+}
+
+std::vector<GLuint> meshOptimizer::optimizeVertexFetch(std::vector<GLuint> &indices,
+                                                       const int &nVertices) {
+
+  const GLuint unused = (GLuint)-1;
+  std::vector<GLuint> remap(nVertices, unused);
+
+  GLuint next = 0;
+  for (size_t i = 0; i < indices.size(); i++) {
+    if (remap[indices[i]] == unused) remap[indices[i]] = next++;
+    indices[i] = remap[indices[i]];
+  }
+
+  for (int v = 0; v < nVertices; v++) {
+    if (remap[v] == unused) remap[v] = next++;
+  }
+
+  return remap;
+}
+
+bool drawableObj::_useVertexArrays = true;
+size_t drawableObj::_bytesLoaded = 0;
+
+bool drawableObj::usingVertexArrays() {
+
+  // GLEW has to be initialized before we can ask this, so wait until
+  // someone actually needs to know.
+  return _useVertexArrays &&
+    (GLEW_ARB_vertex_array_object || GLEW_VERSION_3_0);
+}
+
+drawableObj::~drawableObj() {
+
+  if (_vertexArrayID) glDeleteVertexArrays(1, &_vertexArrayID);
+
+  // Release the buffers, too.  Objects are often shared, so this is
+  // where the GPU memory goes back when the last user lets go.
+  if (_vertices.bufferID) glDeleteBuffers(1, &_vertices.bufferID);
+  if (_colors.bufferID) glDeleteBuffers(1, &_colors.bufferID);
+  if (_normals.bufferID) glDeleteBuffers(1, &_normals.bufferID);
+  if (_uvs.bufferID) glDeleteBuffers(1, &_uvs.bufferID);
+  if (_indices.bufferID) glDeleteBuffers(1, &_indices.bufferID);
+  if (_interleavedData.bufferID) glDeleteBuffers(1, &_interleavedData.bufferID);
+}
+
+void drawableObj::addData(const GLDATATYPE type,
+                          const std::string& name,
+                          const std::vector<glm::vec4>& data) {
+
+  switch(type) {
+  case(GLDATA_VERTICES):
+    _vertices = drawableObjData<glm::vec4>(name, data);
+    break;
+  case(GLDATA_COLORS):
+    _colors = drawableObjData<glm::vec4>(name, data);
+    break;
+  case(GLDATA_NORMALS):
+    _normals = drawableObjData<glm::vec4>(name, data);
+    break;
+  case(GLDATA_TEXCOORDS):
+    throw std::runtime_error("Do not use vec4 for texture coordinates.");
+    break;
+  }
+  _constantData &= ~(1 << type);
+  _loadedIntoBuffer = false;
+  _changed();
+}
+
+void drawableObj::addData(const GLDATATYPE type,
+             const std::string& name,
+             const std::vector<glm::vec2>& data) {
+
+  switch(type) {
+  case(GLDATA_TEXCOORDS):
+    _uvs = drawableObjData<glm::vec2>(name, data);
+    break;
+  case(GLDATA_COLORS):
+  case(GLDATA_NORMALS):
+  case(GLDATA_VERTICES):
+    throw std::runtime_error("Vec2 is only for texture coordinates.");
+    break;
+  }
+  _constantData &= ~(1 << type);
+  _loadedIntoBuffer = false;
+  _changed();
+}
+
+void drawableObj::addConstantData(const GLDATATYPE type,
+                                  const std::string& name,
+                                  const glm::vec4& value) {
+
+  // The data itself is left empty, so nothing downstream makes a
+  // buffer or enables an array for it.  Only the name is needed, to
+  // find the attribute location.
+  switch(type) {
+  case(GLDATA_VERTICES):
+    throw std::runtime_error("Vertices can't be constant.");
+    break;
+  case(GLDATA_COLORS):
+    _colors = drawableObjData<glm::vec4>(name, std::vector<glm::vec4>());
+    break;
+  case(GLDATA_NORMALS):
+    _normals = drawableObjData<glm::vec4>(name, std::vector<glm::vec4>());
+    break;
+  case(GLDATA_TEXCOORDS):
+    _uvs = drawableObjData<glm::vec2>(name, std::vector<glm::vec2>());
+    break;
+  }
+  _constantData |= (1 << type);
+  _constants[type] = value;
+  _loadedIntoBuffer = false;
+  _changed();
+}
+
+void drawableObj::setData(const GLDATATYPE type,
+                          const std::vector<glm::vec4>& data) {
+
+  switch(type) {
+  case(GLDATA_VERTICES):
+    _vertices.setData(data);
+    _haveBoundingBox = false;
+    break;
+  case(GLDATA_COLORS):
+    _colors.setData(data);
+    break;
+  case(GLDATA_NORMALS):
+    _normals.setData(data);
+    break;
   case(GLDATA_TEXCOORDS):
     throw std::runtime_error("Do not use vec4 for texture coordinates.");
     break;
   }
+  _constantData &= ~(1 << type);
   _loadedIntoBuffer = false;
+  _changed();
 }
 
 void drawableObj::setData(const GLDATATYPE type,
@@ -552,7 +2361,163 @@ void drawableObj::setData(const GLDATATYPE type,
     throw std::runtime_error("Vec2 is only for texture coordinates.");
     break;
   }
+  _constantData &= ~(1 << type);
+  _loadedIntoBuffer = false;
+  _changed();
+}
+
+void drawableObj::updateData(const GLDATATYPE type, const size_t &first,
+                             const std::vector<glm::vec4>& data) {
+
+  drawableObjData<glm::vec4> *target = NULL;
+  switch(type) {
+  case(GLDATA_VERTICES):
+    target = &_vertices;
+    break;
+  case(GLDATA_COLORS):
+    target = &_colors;
+    break;
+  case(GLDATA_NORMALS):
+    target = &_normals;
+    break;
+  case(GLDATA_TEXCOORDS):
+    throw std::runtime_error("Do not use vec4 for texture coordinates.");
+    break;
+  default:
+    throw std::runtime_error("What data type is this?");
+  }
+
+  if (first + data.size() > target->size())
+    throw std::runtime_error("Can't update past the end of " + target->name +
+                             "; use setData to change its size.");
+  if (data.empty()) return;
+
+  target->updateRange(first, data.size(), &data[0]);
+  if (_interleaved) _interleave(first, data.size());
+  _changed();
+
+  // Rescanning all the vertices would cost more than the update, so
+  // just stretch the bounding box to fit the new ones.  It may end up
+  // bigger than it needs to be, which only makes culling and
+  // selection a little more generous.  Dynamic objects are small and
+  // move a lot, so they get a fresh box.
+  if ((type == GLDATA_VERTICES) && _dynamic) {
+    _haveBoundingBox = false;
+  } else if ((type == GLDATA_VERTICES) && _haveBoundingBox) {
+    for (std::vector<glm::vec4>::const_iterator it = data.begin();
+         it != data.end(); it++) {
+      _vertexBoundingBoxUpper =
+        glm::max(_vertexBoundingBoxUpper, glm::vec4(glm::vec3(*it), 1.0f));
+      _vertexBoundingBoxLower =
+        glm::min(_vertexBoundingBoxLower, glm::vec4(glm::vec3(*it), 1.0f));
+    }
+  }
+}
+
+void drawableObj::updateData(const GLDATATYPE type, const size_t &first,
+                             const std::vector<glm::vec2>& data) {
+
+  switch(type) {
+  case(GLDATA_TEXCOORDS):
+    break;
+  case(GLDATA_COLORS):
+  case(GLDATA_NORMALS):
+  case(GLDATA_VERTICES):
+    throw std::runtime_error("Vec2 is only for texture coordinates.");
+    break;
+  default:
+    throw std::runtime_error("What data type is this?");
+  }
+
+  if (first + data.size() > _uvs.size())
+    throw std::runtime_error("Can't update past the end of " + _uvs.name +
+                             "; use setData to change its size.");
+  if (data.empty()) return;
+
+  _uvs.updateRange(first, data.size(), &data[0]);
+  if (_interleaved) _interleave(first, data.size());
+  _changed();
+}
+
+void drawableObj::setIndices(const std::vector<GLuint>& indices) {
+
+  _indices.setData(indices);
+  _count = _indices.size();
   _loadedIntoBuffer = false;
+  _changed();
+}
+
+void drawableObj::_thaw() {
+
+  // Unfreezing takes the collection off our list, so go through a
+  // copy of it.
+  std::vector<drawableCollection*> frozenIn = _frozenIn;
+  for (std::vector<drawableCollection*>::iterator it = frozenIn.begin();
+       it != frozenIn.end(); it++) {
+    (*it)->unfreeze();
+  }
+}
+
+void drawableObj::optimizeVertexCache() {
+
+  if ((_drawType != GL_TRIANGLES) || _indices.empty()) return;
+
+  std::vector<GLuint> indices = _indices.getData();
+  int nVertices = _vertices.size();
+
+  meshOptimizer::optimizeVertexCache(indices, nVertices);
+  std::vector<GLuint> remap =
+    meshOptimizer::optimizeVertexFetch(indices, nVertices);
+
+  _vertices.setData(meshOptimizer::reorder(_vertices.getData(), remap));
+  if (!_colors.empty())
+    _colors.setData(meshOptimizer::reorder(_colors.getData(), remap));
+  if (!_normals.empty())
+    _normals.setData(meshOptimizer::reorder(_normals.getData(), remap));
+  if (!_uvs.empty())
+    _uvs.setData(meshOptimizer::reorder(_uvs.getData(), remap));
+
+  setIndices(indices);
+}
+
+std::vector<glm::vec4> drawableObj::getData(const GLDATATYPE type) {
+
+  if (isConstantData(type))
+    return std::vector<glm::vec4>(_vertices.size(), _constants[type]);
+
+  switch(type) {
+  case(GLDATA_VERTICES):
+    return _vertices.getData();
+  case(GLDATA_COLORS):
+    return _colors.getData();
+  case(GLDATA_NORMALS):
+    return _normals.getData();
+  default:
+    throw std::runtime_error("Use getTexCoords() for texture coordinates.");
+  }
+}
+
+std::vector<glm::vec2> drawableObj::getTexCoords() {
+
+  if (isConstantData(GLDATA_TEXCOORDS))
+    return std::vector<glm::vec2>(_vertices.size(),
+                                  glm::vec2(_constants[GLDATA_TEXCOORDS]));
+
+  return _uvs.getData();
+}
+
+std::string drawableObj::getDataName(const GLDATATYPE type) {
+
+  switch(type) {
+  case(GLDATA_VERTICES):
+    return _vertices.name;
+  case(GLDATA_COLORS):
+    return _colors.name;
+  case(GLDATA_NORMALS):
+    return _normals.name;
+  default:
+    return _uvs.name;
+  }
 }
 
 bool drawableObj::insideBoundingBox(const glm::vec4 &testPoint,
@@ -572,11 +2537,22 @@ bool drawableObj::insideBoundingBox(const glm::vec4 &testPoint,
     (testPoint.z >= lower.z);
 }
 
+GLint drawableObj::_getAttribLocation(GLuint programID, const std::string &name) {
+
+  // A shader variant may compile out the use of an attribute, but the
+  // standard ones have the same location whether they're used or not.
+  // Setting them up anyway keeps the vertex array object good for all
+  // the variants.
+  GLint location = glGetAttribLocation(programID, name.c_str());
+  if (location < 0) location = shaderMgr::getStandardAttribLocation(name);
+  return location;
+}
+
 void drawableObj::_getAttribLocations(GLuint programID) {
 
   bool badID = false;
 
-  _vertices.ID = glGetAttribLocation(programID, _vertices.name.c_str());
+  _vertices.ID = _getAttribLocation(programID, _vertices.name);
 
   // Check to make sure the ID awarded is sane.  If not, probably the
   // name does not match the name in the shader.
@@ -585,24 +2561,24 @@ void drawableObj::_getAttribLocations(GLuint programID) {
     badID = true;
   }
 
-  if (!_colors.empty()) {
-    _colors.ID = glGetAttribLocation(programID, _colors.name.c_str());
+  if (!_colors.empty() || isConstantData(GLDATA_COLORS)) {
+    _colors.ID = _getAttribLocation(programID, _colors.name);
 
     if (_colors.ID < 0) {
       std::cerr << "** Caution: Bad ID for colors attribute '" << _colors.name << "'" << std::endl;
       badID = true;
     }
   }
-  if (!_normals.empty()) {
-    _normals.ID = glGetAttribLocation(programID, _normals.name.c_str());
+  if (!_normals.empty() || isConstantData(GLDATA_NORMALS)) {
+    _normals.ID = _getAttribLocation(programID, _normals.name);
 
     if (_normals.ID < 0) {
       std::cerr << "** Caution: Bad ID for normals attribute '" << _normals.name << "'" << std::endl;
       badID = true;
     }
   }
-  if (!_uvs.empty()) {
-    _uvs.ID = glGetAttribLocation(programID, _uvs.name.c_str());
+  if (!_uvs.empty() || isConstantData(GLDATA_TEXCOORDS)) {
+    _uvs.ID = _getAttribLocation(programID, _uvs.name);
 
     if (_uvs.ID < 0) {
       std::cerr << "** Caution: Bad ID for texture attribute '" << _uvs.name << "'" << std::endl;
@@ -622,10 +2598,12 @@ void drawableObj::findBoundingBox() {
   _vertexBoundingBoxUpper = glm::vec4(-1.0e35, -1.0e35, -1.0e35, 1.0f);
 
   // Don't use a templated accessor to test the for loop (very slow).
-  std::vector<glm::vec4> data = _vertices.getData();
+  // Don't copy the data, either; updateData() may have changed only a
+  // few vertices of a big object.
+  glm::vec4 *begin = _vertices.empty() ? NULL : _vertices.beginAddress();
+  glm::vec4 *end = begin + _vertices.size();
 
-  for (std::vector<glm::vec4>::iterator it = data.begin();
-       it != data.end(); it++) {
+  for (glm::vec4 *it = begin; it != end; it++) {
 
     _vertexBoundingBoxUpper.x = fmax((*it).x, _vertexBoundingBoxUpper.x);
     _vertexBoundingBoxUpper.y = fmax((*it).y, _vertexBoundingBoxUpper.y);
@@ -653,9 +2631,42 @@ void drawableObj::findBoundingBox() {
   _haveBoundingBox = true;
 }
 
+bool drawableObj::_sameAttribLocations(GLuint programID) {
+
+  if (_getAttribLocation(programID, _vertices.name) != _vertices.ID)
+    return false;
+  if ((!_colors.empty() || isConstantData(GLDATA_COLORS)) &&
+      (_getAttribLocation(programID, _colors.name) != _colors.ID))
+    return false;
+  if ((!_normals.empty() || isConstantData(GLDATA_NORMALS)) &&
+      (_getAttribLocation(programID, _normals.name) != _normals.ID))
+    return false;
+  if ((!_uvs.empty() || isConstantData(GLDATA_TEXCOORDS)) &&
+      (_getAttribLocation(programID, _uvs.name) != _uvs.ID))
+    return false;
+
+  return true;
+}
+
 void drawableObj::prepare(GLuint programID) {
 
-  if (!_haveBoundingBox) findBoundingBox();
+  // If we've been here before, the buffers are already made and
+  // loaded.  The attribute locations are wired into them, so they had
+  // better be the same for this program.  The shaderMgr makes sure of
+  // that for the usual attribute names.
+  if (_programID) {
+    if ((programID != _programID) && !_sameAttribLocations(programID)) {
+      std::cerr << "** Caution: A shared drawableObj is used with shaders "
+                << "that disagree on its attribute locations." << std::endl;
+    }
+    return;
+  }
+  _programID = programID;
+
+  if (!_haveBoundingBox) findBoundingBox();
+
+  // Streamed vertices can't be interleaved with anything.
+  if (_dynamic) _interleaved = false;
 
   if (_interleaved) {
     _prepareInterleaved(programID);
@@ -666,76 +2677,201 @@ void drawableObj::prepare(GLuint programID) {
 
 void drawableObj::_prepareInterleaved(GLuint programID) {
 
-  // Calculate the stride and offset for each vertex value.
-  _stride = 3 * sizeof(float); // We're cheating here, assuming only x,y,z.
+  // Prepare a data buffer for the interleaved data.
+  glGenBuffers(1, &_interleavedData.bufferID);
+  if (!_indices.empty()) glGenBuffers(1, &_indices.bufferID);
+
+  _getAttribLocations(programID);
+
+  // This works out the layout and interleaves the data, too.
+  _loadInterleaved();
+
+  _prepareVertexArray();
+}
+
+void drawableObj::_layoutInterleaved() {
+
+  // Calculate the stride and offset for each vertex value, along with
+  // the type in which each is stored.  We're cheating here, storing
+  // only x,y,z for the positions and normals, and r,g,b for float
+  // colors.  OpenGL fills in the rest with default values.
+  if (_packing & GLPACK_POSITIONS) {
+    _positionType = GL_UNSIGNED_SHORT;
+    _stride = 4 * sizeof(GLushort);  // One is padding.
+
+    // The positions are stored as fractions of the bounding box, or
+    // of a box we've been given, if it's big enough.
+    if (!_haveBoundingBox) findBoundingBox();
+    glm::vec4 lower = _vertexBoundingBoxLower;
+    glm::vec4 upper = _vertexBoundingBoxUpper;
+    if (_havePackingBox) {
+      lower = glm::min(lower, _packingBoxLower);
+      upper = glm::max(upper, _packingBoxUpper);
+    }
+    _packLower = lower;
+    _packSize = upper - lower;
+  } else {
+    _positionType = GL_FLOAT;
+    _stride = 3 * sizeof(float);
+  }
 
   if (!_colors.empty()) {
     _colorPos = _stride;  // The colors appear after the vertices.
-    _stride += 3 * sizeof(float);  // The next value appears after that.
+    if (_packing & GLPACK_COLORS) {
+      _colorType = GL_UNSIGNED_BYTE;
+      _stride += 4;  // The next value appears after that.
+    } else {
+      _colorType = GL_FLOAT;
+      _stride += 3 * sizeof(float);
+    }
   }
 
   if (!_normals.empty()) {
     _normalPos = _stride;
-    _stride += 3 * sizeof(float);
+    if (_packing & GLPACK_NORMALS) {
+      if (GLEW_ARB_vertex_type_2_10_10_10_rev || GLEW_VERSION_3_3) {
+        _normalType = GL_INT_2_10_10_10_REV;
+      } else {
+        _normalType = GL_BYTE;
+      }
+      _stride += 4;
+    } else {
+      _normalType = GL_FLOAT;
+      _stride += 3 * sizeof(float);
+    }
   }
 
   if (!_uvs.empty()) {
     _uvPos = _stride;
-    _stride += 2 * sizeof(float);
+    if ((_packing & GLPACK_UVS_HALF) &&
+        (GLEW_ARB_half_float_vertex || GLEW_VERSION_3_0)) {
+      _uvType = GL_HALF_FLOAT;
+      _stride += 2 * sizeof(GLushort);
+    } else if (_packing & GLPACK_UVS_SHORT) {
+      _uvType = GL_UNSIGNED_SHORT;
+      _stride += 2 * sizeof(GLushort);
+    } else {
+      _uvType = GL_FLOAT;
+      _stride += 2 * sizeof(float);
+    }
   }
-  // End of calculating all the stride values.
+}
 
-  // Prepare a data buffer for the interleaved data.
-  glGenBuffers(1, &_interleavedData.bufferID);
+void drawableObj::_interleave(const size_t &first, const size_t &count) {
 
-  // Now interleave the data.
-  for (int i = 0; i < _vertices.size(); i++) {
+  // Until the object is prepared, there's nothing to do.  The whole
+  // thing will be interleaved then.
+  if (_interleavedData.empty()) return;
+
+  for (size_t i = first; i < first + count; i++) {
+
+    unsigned char* out = _interleavedData.beginAddress() + i * _stride;
 
     // Load the x,y,z vertices.
-    _interleavedData.addData(_vertices[i].x);
-    _interleavedData.addData(_vertices[i].y);
-    _interleavedData.addData(_vertices[i].z);
+    if (_positionType == GL_FLOAT) {
+      float p[3] = { _vertices[i].x, _vertices[i].y, _vertices[i].z };
+      memcpy(out, p, sizeof(p));
+    } else {
+      glm::vec3 f = glm::vec3(_vertices[i] - _packLower) / glm::vec3(_packSize);
+
+      // If an update moves a vertex out of the box, the box is out of
+      // date, and everything has to be packed again.
+      if (_loadedIntoBuffer &&
+          (glm::any(glm::lessThan(f, glm::vec3(0.0f))) ||
+           glm::any(glm::greaterThan(f, glm::vec3(1.0f))))) {
+        _loadedIntoBuffer = false;
+        return;
+      }
+      f = glm::clamp(f, 0.0f, 1.0f);
+
+      GLushort p[4] = { (GLushort)glm::round(f.x * 65535.0f),
+                        (GLushort)glm::round(f.y * 65535.0f),
+                        (GLushort)glm::round(f.z * 65535.0f), 0 };
+      memcpy(out, p, sizeof(p));
+    }
 
     // Now interleave the other vertex attributes, if any.
     if (!_colors.empty()) {
-      _interleavedData.addData(_colors[i].r);
-      _interleavedData.addData(_colors[i].g);
-      _interleavedData.addData(_colors[i].b);
+      if (_colorType == GL_FLOAT) {
+        float c[3] = { _colors[i].r, _colors[i].g, _colors[i].b };
+        memcpy(out + _colorPos, c, sizeof(c));
+      } else {
+        // Alpha is left at one, as in the float layout.
+        GLuint c = glm::packUnorm4x8(glm::vec4(glm::vec3(_colors[i]), 1.0f));
+        memcpy(out + _colorPos, &c, sizeof(c));
+      }
     }
     if (!_normals.empty()) {
-      _interleavedData.addData(_normals[i].x);
-      _interleavedData.addData(_normals[i].y);
-      _interleavedData.addData(_normals[i].z);
+      // The w is one, as OpenGL would fill in for the float layout.
+      glm::vec4 n = glm::vec4(glm::vec3(_normals[i]), 1.0f);
+      if (_normalType == GL_FLOAT) {
+        memcpy(out + _normalPos, &n[0], 3 * sizeof(float));
+      } else if (_normalType == GL_INT_2_10_10_10_REV) {
+        GLuint p = glm::packSnorm3x10_1x2(n);
+        memcpy(out + _normalPos, &p, sizeof(p));
+      } else {
+        GLuint p = glm::packSnorm4x8(n);
+        memcpy(out + _normalPos, &p, sizeof(p));
+      }
     }
     if (!_uvs.empty()) {
-      _interleavedData.addData(_uvs[i].s);
-      _interleavedData.addData(_uvs[i].t);
+      if (_uvType == GL_FLOAT) {
+        memcpy(out + _uvPos, &_uvs[i][0], 2 * sizeof(float));
+      } else {
+        GLuint p = (_uvType == GL_HALF_FLOAT) ? glm::packHalf2x16(_uvs[i]) :
+          glm::packUnorm2x16(_uvs[i]);
+        memcpy(out + _uvPos, &p, sizeof(p));
+      }
     }
   }
 
-  _getAttribLocations(programID);
-
-  _loadInterleaved();
+  _interleavedData.markDirty(first * _stride, count * _stride);
 }
 
 void drawableObj::_prepareSeparate(GLuint programID) {
 
   // Figure out which buffers we need and get IDs for them.
-  glGenBuffers(1, &_vertices.bufferID);
+  if (!_dynamic) glGenBuffers(1, &_vertices.bufferID);
   if (!_colors.empty()) glGenBuffers(1, &_colors.bufferID);
   if (!_normals.empty()) glGenBuffers(1, &_normals.bufferID);
   if (!_uvs.empty()) glGenBuffers(1, &_uvs.bufferID);
+  if (!_indices.empty()) glGenBuffers(1, &_indices.bufferID);
 
   _getAttribLocations(programID);
 
   // Put the data in its buffers, for practice.
   _loadSeparate();
 
+  _prepareVertexArray();
+}
+
+void drawableObj::_prepareVertexArray() {
+
+  if (!usingVertexArrays()) return;
+
+  // Record the attribute bindings once.  The buffer IDs don't change
+  // when the data is reloaded, so this stays valid for the life of
+  // the object.  If we are asked again, the array we already have is
+  // recorded over rather than leaked.
+  if (!_vertexArrayID) glGenVertexArrays(1, &_vertexArrayID);
+  glBindVertexArray(_vertexArrayID);
+  _bindAttributes();
+  glBindVertexArray(0);
 }
 
 
 void drawableObj::load() {
 
+  // If the vertices have changed, so has the bounding box.
+  if (!_haveBoundingBox) findBoundingBox();
+
+  // Indices given after prepare() need a buffer of their own, and the
+  // vertex array object has to be told about it.
+  if (_programID && !_indices.empty() && !_indices.bufferID) {
+    glGenBuffers(1, &_indices.bufferID);
+    _prepareVertexArray();
+  }
+
   // if (_loadedIntoBuffer)
   //   std::cout << "no need " << std::endl;
   // else
@@ -748,53 +2884,229 @@ void drawableObj::load() {
   }
 }
 
+// Send all of some data to its buffer, which must be bound to
+// GL_ARRAY_BUFFER.
+template <class T>
+void drawableObj::_loadWhole(drawableObjData<T> &data) {
+
+  glBufferData(GL_ARRAY_BUFFER, data.byteSize(), data.beginAddress(),
+               GL_STATIC_DRAW);
+  _bytesLoaded += data.byteSize();
+  data.clearDirty();
+}
+
+// Send just the changed parts of some data to its buffer, which must
+// be bound to GL_ARRAY_BUFFER.
+template <class T>
+void drawableObj::_loadChanges(drawableObjData<T> &data) {
+
+  const std::vector<std::pair<size_t, size_t> > &ranges = data.getDirtyRanges();
+
+  // Each update is a separate call, with its own overhead, so changes
+  // separated by only a little unchanged data are sent together.
+  const size_t gapBytes = 1024;
+
+  std::vector<std::pair<size_t, size_t> >::const_iterator it = ranges.begin();
+  while (it != ranges.end()) {
+
+    size_t first = it->first, end = it->second;
+    for (it++; (it != ranges.end()) &&
+           ((it->first - end) * sizeof(T) <= gapBytes); it++) {
+      end = it->second;
+    }
+
+    size_t bytes = (end - first) * sizeof(T);
+    glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(T), bytes,
+                    data.beginAddress() + first);
+    _bytesLoaded += bytes;
+  }
+  data.clearDirty();
+}
+
 void drawableObj::_loadInterleaved() {
 
   if (!_loadedIntoBuffer) {
 
+    // Interleave everything, in case the arrays have been replaced
+    // with setData(), or the packing box has to grow.
+    _layoutInterleaved();
+    _interleavedData.setData(std::vector<unsigned char>(_vertices.size() *
+                                                        _stride));
+    _interleave(0, _vertices.size());
+
     // Load it into a buffer.
     glBindBuffer(GL_ARRAY_BUFFER, _interleavedData.bufferID);
-    glBufferData(GL_ARRAY_BUFFER, _interleavedData.byteSize(),
-                 _interleavedData.beginAddress(), GL_STATIC_DRAW);
-
+    _loadWhole(_interleavedData);
+    _loadIndices();
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     _loadedIntoBuffer = true;
+
+  } else if (_interleavedData.isDirty()) {
+
+    glBindBuffer(GL_ARRAY_BUFFER, _interleavedData.bufferID);
+    _loadChanges(_interleavedData);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
   }
+
+  // The separate arrays' changes have been copied into the
+  // interleaved data, so there's no need to remember them.
+  _vertices.clearDirty();
+  _colors.clearDirty();
+  _normals.clearDirty();
+  _uvs.clearDirty();
 }
 
 
 void drawableObj::_loadSeparate() {
 
+  if (_dynamic) _streamVertices();
+
   if (!_loadedIntoBuffer) {
-    glBindBuffer(GL_ARRAY_BUFFER, _vertices.bufferID);
-    glBufferData(GL_ARRAY_BUFFER, _vertices.byteSize(), _vertices.beginAddress(),
-                 GL_STATIC_DRAW);
+    if (!_dynamic) {
+      glBindBuffer(GL_ARRAY_BUFFER, _vertices.bufferID);
+      _loadWhole(_vertices);
+    }
 
     if (!_colors.empty()) {
       glBindBuffer(GL_ARRAY_BUFFER, _colors.bufferID);
-      glBufferData(GL_ARRAY_BUFFER, _colors.byteSize(), _colors.beginAddress(),
-                   GL_STATIC_DRAW);
+      _loadWhole(_colors);
     }
     if (!_normals.empty()) {
       glBindBuffer(GL_ARRAY_BUFFER, _normals.bufferID);
-      glBufferData(GL_ARRAY_BUFFER, _normals.byteSize(), _normals.beginAddress(),
-                   GL_STATIC_DRAW);
+      _loadWhole(_normals);
     }
     if (!_uvs.empty()) {
       glBindBuffer(GL_ARRAY_BUFFER, _uvs.bufferID);
-      glBufferData(GL_ARRAY_BUFFER, _uvs.byteSize(), _uvs.beginAddress(),
-                   GL_STATIC_DRAW);
+      _loadWhole(_uvs);
     }
+    _loadIndices();
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     _loadedIntoBuffer = true;
+
+  } else if (_vertices.isDirty() || _colors.isDirty() ||
+             _normals.isDirty() || _uvs.isDirty()) {
+
+    // Only some of the data has changed, so only send that.
+    if (_vertices.isDirty()) {
+      glBindBuffer(GL_ARRAY_BUFFER, _vertices.bufferID);
+      _loadChanges(_vertices);
+    }
+    if (_colors.isDirty()) {
+      glBindBuffer(GL_ARRAY_BUFFER, _colors.bufferID);
+      _loadChanges(_colors);
+    }
+    if (_normals.isDirty()) {
+      glBindBuffer(GL_ARRAY_BUFFER, _normals.bufferID);
+      _loadChanges(_normals);
+    }
+    if (_uvs.isDirty()) {
+      glBindBuffer(GL_ARRAY_BUFFER, _uvs.bufferID);
+      _loadChanges(_uvs);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
   }
 }
 
+void drawableObj::_streamVertices() {
+
+  if (_vertices.empty()) return;
+
+  streamBuffer *stream = streamBuffer::get();
+
+  // Write the vertices again if they've changed, or if their part of
+  // the ring is coming up for reuse.  That happens after
+  // getNumRegions() frames, but leave a frame to spare in case
+  // something streams more than a region's worth in one frame.
+  if (_loadedIntoBuffer && !_vertices.isDirty() &&
+      (stream->getFrame() - _streamFrame <
+       (unsigned int)streamBuffer::getNumRegions() - 1)) return;
+
+  if (!stream->write(_vertices.beginAddress(), _vertices.byteSize(),
+                     _streamOffset))
+    throw std::runtime_error("Too many vertices in " + _vertices.name +
+                             " to stream; use streamBuffer::setRegionSize().");
+
+  _streamFrame = stream->getFrame();
+  _bytesLoaded += _vertices.byteSize();
+  _vertices.clearDirty();
+}
+
+void drawableObj::_bindStreamedVertices() {
+
+  streamBuffer *stream = streamBuffer::get();
+  stream->flush();
+
+  glBindBuffer(GL_ARRAY_BUFFER, stream->getBufferID());
+  glVertexAttribPointer(_vertices.ID, _vertices.componentsPerVertex(),
+                        GL_FLOAT, 0, 0, BUFFER_OFFSET(_streamOffset));
+}
+
+void drawableObj::_loadIndices() {
+
+  if (_indices.empty()) return;
+
+  // Buffers don't care what they are used for, so we load the indices
+  // through the GL_ARRAY_BUFFER target.  Binding GL_ELEMENT_ARRAY_BUFFER
+  // here would change whatever vertex array object is bound.
+  glBindBuffer(GL_ARRAY_BUFFER, _indices.bufferID);
+  _loadWhole(_indices);
+}
+
 
 void drawableObj::draw() {
 
+  if (_vertexArrayID) {
+
+    // Everything we need is recorded in the vertex array object.  We
+    // leave it bound; the scene unbinds it at the end of the draw.
+    // Streamed vertices move around, though.
+    glBindVertexArray(_vertexArrayID);
+    if (_dynamic) _bindStreamedVertices();
+    _loadConstants();
+    _drawPrimitives();
+
+  } else {
+
+    if (usingVertexArrays()) glBindVertexArray(0);
+
+    _bindAttributes();
+    _loadConstants();
+    _drawPrimitives();
+
+    // Now disable the attribute arrays so they won't interfere with the
+    // next draw.
+    _unbindAttributes();
+  }
+}
+
+void drawableObj::_loadConstants() {
+
+  // The current value of an attribute isn't part of the vertex array
+  // object; it belongs to the context, and whoever drew last may have
+  // changed it.  So it has to be set at every draw.  It's cheap.
+  if (!_constantData) return;
+
+  if (isConstantData(GLDATA_COLORS) && (_colors.ID >= 0))
+    glVertexAttrib4fv(_colors.ID, &_constants[GLDATA_COLORS][0]);
+  if (isConstantData(GLDATA_NORMALS) && (_normals.ID >= 0))
+    glVertexAttrib4fv(_normals.ID, &_constants[GLDATA_NORMALS][0]);
+  if (isConstantData(GLDATA_TEXCOORDS) && (_uvs.ID >= 0))
+    glVertexAttrib4fv(_uvs.ID, &_constants[GLDATA_TEXCOORDS][0]);
+}
+
+void drawableObj::_drawPrimitives() {
+
+  if (_indices.empty()) {
+    glDrawArrays(_drawType, 0, _count);
+  } else {
+    glDrawElements(_drawType, _count, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
+  }
+}
+
+void drawableObj::_bindAttributes() {
+
   // Enable all the attribute arrays we'll use.
   glEnableVertexAttribArray(_vertices.ID);
   if (!_colors.empty()) glEnableVertexAttribArray(_colors.ID);
@@ -802,52 +3114,66 @@ void drawableObj::draw() {
   if (!_uvs.empty()) glEnableVertexAttribArray(_uvs.ID);
 
   if (_interleaved) {
-    _drawInterleaved();
+    _bindInterleaved();
   } else {
-    _drawSeparate();
+    _bindSeparate();
   }
 
-  // Now disable the attribute arrays so they won't interfere with the
-  // next draw.
+  if (!_indices.empty())
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indices.bufferID);
+}
+
+void drawableObj::_unbindAttributes() {
+
   glDisableVertexAttribArray(_vertices.ID);
   if (!_colors.empty()) glDisableVertexAttribArray(_colors.ID);
   if (!_normals.empty()) glDisableVertexAttribArray(_normals.ID);
   if (!_uvs.empty()) glDisableVertexAttribArray(_uvs.ID);
+
+  if (!_indices.empty()) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-void drawableObj::_drawInterleaved() {
+void drawableObj::_bindInterleaved() {
 
   glBindBuffer(GL_ARRAY_BUFFER, _interleavedData.bufferID);
 
   // Since the point of the interleaving is to make the transfer of
   // data more efficient, we are cheating in the following, and
   // leaving out the w from the vec4 data and the a from rgba.  These
-  // are restored with default values by OpenGL.
+  // are restored with default values by OpenGL.  The packed types are
+  // all normalized, to come out between 0 and 1 (or -1 and 1), except
+  // for half floats, which are just floats.
   glVertexAttribPointer(_vertices.ID, 3,//_vertices.componentsPerVertex() - 1,
-                        GL_FLOAT, GL_FALSE, _stride, BUFFER_OFFSET(0));
+                        _positionType, _positionType != GL_FLOAT, _stride,
+                        BUFFER_OFFSET(0));
 
   if (!_colors.empty()) {
-    glVertexAttribPointer(_colors.ID, 3,//_colors.componentsPerVertex() - 1,
-                            GL_FLOAT, GL_FALSE, _stride, BUFFER_OFFSET(_colorPos));
+    glVertexAttribPointer(_colors.ID, (_colorType == GL_FLOAT) ? 3 : 4,
+                          _colorType, _colorType != GL_FLOAT, _stride,
+                          BUFFER_OFFSET(_colorPos));
   }
   if (!_normals.empty()) {
-    glVertexAttribPointer(_normals.ID, 3,//_normals.componentsPerVertex() - 1,
-                            GL_FLOAT, GL_FALSE, _stride, BUFFER_OFFSET(_normalPos));
+    glVertexAttribPointer(_normals.ID, (_normalType == GL_FLOAT) ? 3 : 4,
+                          _normalType, _normalType != GL_FLOAT, _stride,
+                          BUFFER_OFFSET(_normalPos));
   }
   if (!_uvs.empty()) {
     glVertexAttribPointer(_uvs.ID, 2,//_uvs.componentsPerVertex(),
-                            GL_FLOAT, GL_FALSE, _stride, BUFFER_OFFSET(_uvPos));
+                          _uvType, _uvType == GL_UNSIGNED_SHORT, _stride,
+                          BUFFER_OFFSET(_uvPos));
   }
-
-  glDrawArrays(_drawType, 0, _count);
 }
 
 
-void drawableObj::_drawSeparate() {
+void drawableObj::_bindSeparate() {
 
-  glBindBuffer(GL_ARRAY_BUFFER, _vertices.bufferID);
-  glVertexAttribPointer(_vertices.ID, _vertices.componentsPerVertex(),
-                        GL_FLOAT, 0, 0, 0);
+  if (_dynamic) {
+    _bindStreamedVertices();
+  } else {
+    glBindBuffer(GL_ARRAY_BUFFER, _vertices.bufferID);
+    glVertexAttribPointer(_vertices.ID, _vertices.componentsPerVertex(),
+                          GL_FLOAT, 0, 0, 0);
+  }
 
   if (!_colors.empty()) {
     glBindBuffer(GL_ARRAY_BUFFER, _colors.bufferID);
@@ -864,9 +3190,74 @@ void drawableObj::_drawSeparate() {
     glVertexAttribPointer(_uvs.ID, _uvs.componentsPerVertex(),
                           GL_FLOAT, 0, 0, 0);
   }
+}
+
+void drawableObj::drawInstanced(const GLsizei &instanceCount,
+                                const GLuint &instanceBufferID,
+                                const GLint &matrixID,
+                                const GLint &normalMatrixID) {
+
+  if (_vertexArrayID) {
+    glBindVertexArray(_vertexArrayID);
+    if (_dynamic) _bindStreamedVertices();
+  } else {
+    if (usingVertexArrays()) glBindVertexArray(0);
+    _bindAttributes();
+  }
+
+  _bindInstanceAttributes(instanceBufferID, matrixID, normalMatrixID);
+  _loadConstants();
+
+  if (_indices.empty()) {
+    glDrawArraysInstancedARB(_drawType, 0, _count, instanceCount);
+  } else {
+    glDrawElementsInstancedARB(_drawType, _count, GL_UNSIGNED_INT,
+                               BUFFER_OFFSET(0), instanceCount);
+  }
 
-  glDrawArrays(_drawType, 0, _count);
+  // Take the instance attributes back out, so they don't stick to the
+  // vertex array object, which might also be drawn without instances.
+  _unbindInstanceAttributes(matrixID, normalMatrixID);
 
+  if (!_vertexArrayID) _unbindAttributes();
+}
+
+void drawableObj::_bindInstanceAttributes(const GLuint &instanceBufferID,
+                                          const GLint &matrixID,
+                                          const GLint &normalMatrixID) {
+
+  // A mat4 attribute takes up four consecutive locations, one for each
+  // column.  The instance buffer holds the model matrix and then the
+  // normal matrix for each instance, so the stride is two matrices.
+  GLsizei stride = 2 * sizeof(glm::mat4);
+
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+  for (int i = 0; i < 4; i++) {
+    glEnableVertexAttribArray(matrixID + i);
+    glVertexAttribPointer(matrixID + i, 4, GL_FLOAT, GL_FALSE, stride,
+                          BUFFER_OFFSET(i * sizeof(glm::vec4)));
+    glVertexAttribDivisorARB(matrixID + i, 1);
+
+    glEnableVertexAttribArray(normalMatrixID + i);
+    glVertexAttribPointer(normalMatrixID + i, 4, GL_FLOAT, GL_FALSE, stride,
+                          BUFFER_OFFSET(sizeof(glm::mat4) +
+                                        i * sizeof(glm::vec4)));
+    glVertexAttribDivisorARB(normalMatrixID + i, 1);
+  }
+}
+
+void drawableObj::_unbindInstanceAttributes(const GLint &matrixID,
+                                            const GLint &normalMatrixID) {
+
+  // The divisors have to be reset, too.  Otherwise the next program
+  // to use these locations for an ordinary attribute would get one
+  // value per instance instead of one per vertex.
+  for (int i = 0; i < 4; i++) {
+    glVertexAttribDivisorARB(matrixID + i, 0);
+    glDisableVertexAttribArray(matrixID + i);
+    glVertexAttribDivisorARB(normalMatrixID + i, 0);
+    glDisableVertexAttribArray(normalMatrixID + i);
+  }
 }
 
 std::string bsgName::printName() const {
@@ -879,9 +3270,281 @@ std::string bsgName::printName() const {
     return out.substr(0, out.length() - 1);
   }
 
+std::unordered_map<std::string, bsgNameID> *bsgNameTable::_ids = NULL;
+std::vector<std::string> *bsgNameTable::_names = NULL;
+
+bsgNameID bsgNameTable::intern(const std::string &name) {
+
+  if (!_ids) {
+    _ids = new std::unordered_map<std::string, bsgNameID>;
+    _names = new std::vector<std::string>;
+  }
+
+  std::unordered_map<std::string, bsgNameID>::iterator it = _ids->find(name);
+  if (it != _ids->end()) return it->second;
+
+  bsgNameID id = _names->size();
+  _names->push_back(name);
+  (*_ids)[name] = id;
+  return id;
+}
+
+bsgNameID bsgNameTable::find(const std::string &name) {
+
+  if (!_ids) return -1;
+
+  std::unordered_map<std::string, bsgNameID>::iterator it = _ids->find(name);
+  if (it == _ids->end()) return -1;
+  return it->second;
+}
+
+const std::string &bsgNameTable::getString(const bsgNameID &id) {
+
+  static const std::string unknown = "?";
+  if (!_names || (id < 0) || (id >= (int)_names->size())) return unknown;
+  return (*_names)[id];
+}
+
+bsgPath::bsgPath(const bsgName &name) : _size(0) {
+
+  for (bsgName::const_iterator it = name.begin(); it != name.end(); it++) {
+    push_back(bsgNameTable::find(*it));
+  }
+}
+
+bool bsgPath::operator==(const bsgPath &other) const {
+
+  if (_size != other._size) return false;
+  for (int i = 0; i < _size; i++) {
+    if ((*this)[i] != other[i]) return false;
+  }
+  return true;
+}
+
+void bsgPath::push_back(const bsgNameID &id) {
+
+  if (_size < _localSize) {
+    _local[_size++] = id;
+    return;
+  }
+
+  // Moving out of the local array.
+  if (_size == _localSize) _more.assign(_local, _local + _localSize);
+  _more.push_back(id);
+  _size++;
+}
+
+void bsgPath::pop_back() {
+
+  if (_size == 0) return;
+
+  // The local array still has the start of the path, so going back
+  // to it is just a matter of dropping the long version.
+  _size--;
+  if (_size > _localSize) {
+    _more.pop_back();
+  } else {
+    _more.clear();
+  }
+}
+
+void bsgPath::appendTo(bsgName &name) const {
+
+  for (int i = 0; i < _size; i++) {
+    name.push_back(bsgNameTable::getString((*this)[i]));
+  }
+}
+
+bsgName bsgPath::getName() const {
+
+  bsgName out;
+  appendTo(out);
+  return out;
+}
+
+bsgNameList bsgPath::getNames(const std::vector<bsgPath> &paths) {
+
+  // Fill the names in place, rather than copying them in.
+  bsgNameList out;
+  for (std::vector<bsgPath>::const_iterator it = paths.begin();
+       it != paths.end(); it++) {
+    out.push_back(bsgName());
+    it->appendTo(out.back());
+  }
+  return out;
+}
+
+bool transformStore::_useSIMD = true;
+
+int transformStore::addNode(const int &parent) {
+
+  if (parent >= (int)_parents.size())
+    throw std::runtime_error("A transform's parent must be added first.");
+
+  _parents.push_back((parent < 0) ? -1 : parent);
+  _px.push_back(0.0f); _py.push_back(0.0f); _pz.push_back(0.0f);
+  _qx.push_back(0.0f); _qy.push_back(0.0f); _qz.push_back(0.0f);
+  _qw.push_back(1.0f);
+  _sx.push_back(1.0f); _sy.push_back(1.0f); _sz.push_back(1.0f);
+
+  static const float identity[12] = { 1.0f, 0.0f, 0.0f, 0.0f,
+                                      0.0f, 1.0f, 0.0f, 0.0f,
+                                      0.0f, 0.0f, 1.0f, 0.0f };
+  _world.insert(_world.end(), identity, identity + 12);
+
+  return _parents.size() - 1;
+}
+
+void transformStore::_local(const int &i) {
+
+  // The same as translate * mat4_cast(orientation) * scale.
+  float x = _qx[i], y = _qy[i], z = _qz[i], w = _qw[i];
+  float* m = &_world[12 * i];
+
+  m[0] = (1.0f - 2.0f * (y * y + z * z)) * _sx[i];
+  m[1] = 2.0f * (x * y - w * z) * _sy[i];
+  m[2] = 2.0f * (x * z + w * y) * _sz[i];
+  m[3] = _px[i];
+
+  m[4] = 2.0f * (x * y + w * z) * _sx[i];
+  m[5] = (1.0f - 2.0f * (x * x + z * z)) * _sy[i];
+  m[6] = 2.0f * (y * z - w * x) * _sz[i];
+  m[7] = _py[i];
+
+  m[8] = 2.0f * (x * z - w * y) * _sx[i];
+  m[9] = 2.0f * (y * z + w * x) * _sy[i];
+  m[10] = (1.0f - 2.0f * (x * x + y * y)) * _sz[i];
+  m[11] = _pz[i];
+}
+
+void transformStore::_compose(const int &i) {
+
+  const float* a = &_world[12 * _parents[i]];
+  float* b = &_world[12 * i];
+
+#ifdef BSG_SSE2
+  if (_useSIMD) {
+
+    // Each row of the product is a combination of the rows of b,
+    // plus the parent's translation in the last place.
+    __m128 b0 = _mm_loadu_ps(b);
+    __m128 b1 = _mm_loadu_ps(b + 4);
+    __m128 b2 = _mm_loadu_ps(b + 8);
+    __m128 lastOnly = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
+    for (int r = 0; r < 3; r++) {
+      __m128 ar = _mm_loadu_ps(a + 4 * r);
+      __m128 out = _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x00), b0);
+      out = _mm_add_ps(out, _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x55), b1));
+      out = _mm_add_ps(out, _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0xaa), b2));
+      out = _mm_add_ps(out, _mm_and_ps(ar, lastOnly));
+      _mm_storeu_ps(b + 4 * r, out);
+    }
+    return;
+  }
+#endif
+
+  float out[12];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      out[4 * r + c] = a[4 * r] * b[c] + a[4 * r + 1] * b[4 + c] +
+        a[4 * r + 2] * b[8 + c] + ((c == 3) ? a[4 * r + 3] : 0.0f);
+    }
+  }
+  memcpy(b, out, sizeof(out));
+}
+
+void transformStore::update() {
+
+  int n = _parents.size();
+  int i = 0;
+
+#ifdef BSG_SSE2
+  if (_useSIMD) {
+
+    // The local matrices of four nodes at a time, one node in each
+    // lane, then turned around so each node's rows are together.
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 two = _mm_set1_ps(2.0f);
+
+    for (; i + 4 <= n; i += 4) {
+
+      __m128 x = _mm_loadu_ps(&_qx[i]);
+      __m128 y = _mm_loadu_ps(&_qy[i]);
+      __m128 z = _mm_loadu_ps(&_qz[i]);
+      __m128 w = _mm_loadu_ps(&_qw[i]);
+      __m128 sx = _mm_loadu_ps(&_sx[i]);
+      __m128 sy = _mm_loadu_ps(&_sy[i]);
+      __m128 sz = _mm_loadu_ps(&_sz[i]);
+
+      __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+      __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+      __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+      __m128 r0 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+      __m128 r1 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+      __m128 r2 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+      __m128 r3 = _mm_loadu_ps(&_px[i]);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      float* m = &_world[12 * i];
+      _mm_storeu_ps(m, r0);
+      _mm_storeu_ps(m + 12, r1);
+      _mm_storeu_ps(m + 24, r2);
+      _mm_storeu_ps(m + 36, r3);
+
+      r0 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+      r1 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+      r2 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+      r3 = _mm_loadu_ps(&_py[i]);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(m + 4, r0);
+      _mm_storeu_ps(m + 16, r1);
+      _mm_storeu_ps(m + 28, r2);
+      _mm_storeu_ps(m + 40, r3);
+
+      r0 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+      r1 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+      r2 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+      r3 = _mm_loadu_ps(&_pz[i]);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(m + 8, r0);
+      _mm_storeu_ps(m + 20, r1);
+      _mm_storeu_ps(m + 32, r2);
+      _mm_storeu_ps(m + 44, r3);
+
+      // Parents come before their children, so their world matrices
+      // are already done, even if they are in this group of four.
+      for (int k = i; k < i + 4; k++) {
+        if (_parents[k] >= 0) _compose(k);
+      }
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    _local(i);
+    if (_parents[i] >= 0) _compose(i);
+  }
+}
+
+glm::mat4 transformStore::getWorldMatrix(const int &i) const {
+
+  const float* m = &_world[12 * i];
+
+  // glm matrices are indexed by column, then row.
+  glm::mat4 out(1.0f);
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      out[c][r] = m[4 * r + c];
+    }
+  }
+  return out;
+}
 
 glm::mat4 drawableMulti::getModelMatrix() {
 
+  if (!_worldMatrixNeedsReset) return _worldMatrix;
+
   if (_modelMatrixNeedsReset) {
     glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), _position);
     glm::mat4 rotationMatrix = glm::mat4_cast(_orientation);
@@ -901,11 +3564,57 @@ glm::mat4 drawableMulti::getModelMatrix() {
   // If there is a parent, get the parent transformation (model)
   // matrix and use it with this one.
   if (_parent)
-    return _parent->getModelMatrix() * _modelMatrix;
+    _worldMatrix = _parent->getModelMatrix() * _modelMatrix;
   else
-    return _modelMatrix;
+    _worldMatrix = _modelMatrix;
+
+  _worldMatrixNeedsReset = false;
+  _inverseWorldMatrixNeedsReset = true;
+
+  return _worldMatrix;
+}
+
+glm::mat4 drawableMulti::getInverseModelMatrix() {
+
+  // This may find that the world matrix has changed.
+  glm::mat4 worldMatrix = getModelMatrix();
+
+  if (_inverseWorldMatrixNeedsReset) {
+    // It's all translation, rotation, and scale, so only the 3x3 part
+    // needs a real inverse.  (glm's affineInverse() would do, except
+    // that in this version it assumes there is no scale.)
+    glm::mat3 inverse3 = glm::inverse(glm::mat3(worldMatrix));
+    _inverseWorldMatrix = glm::mat4(inverse3);
+    _inverseWorldMatrix[3] = glm::vec4(-(inverse3 * glm::vec3(worldMatrix[3])), 1.0f);
+    _inverseWorldMatrixNeedsReset = false;
+  }
+
+  return _inverseWorldMatrix;
+}
+
+void drawableMulti::addInsidePaths(const glm::vec4 &testPoint,
+                                   bsgPath &prefix,
+                                   std::vector<bsgPath> &out) {
+
+  // This is for classes that only know how to return names.  Each
+  // name is relative to this object, so goes after the prefix.
+  bsgNameList names = insideBoundingBox(testPoint);
+  for (bsgNameList::iterator it = names.begin(); it != names.end(); it++) {
+
+    out.push_back(prefix);
+    for (bsgName::iterator jt = it->begin(); jt != it->end(); jt++) {
+      out.back().push_back(bsgNameTable::intern(*jt));
+    }
+  }
+}
+
+void drawableMulti::addToQueue(bsgRenderQueue &queue) {
+
+  queue.addOther(this);
 }
 
+int drawableMulti::_nFrozen = 0;
+
 std::string drawableMulti::randomName(const std::string &nameRoot) {
 
   // This is a pretty dopey method, but it seems to work, so long as
@@ -929,7 +3638,6 @@ std::string drawableMulti::randomName(const std::string &nameRoot) {
 
 bsgNameList drawableCompound::insideBoundingBox(const glm::vec4 &testPoint) {
 
-  bsgName out;
   bsgNameList outList;
   glm::mat4 modelMatrix = getModelMatrix();
 
@@ -941,26 +3649,33 @@ bsgNameList drawableCompound::insideBoundingBox(const glm::vec4 &testPoint) {
       // If we're here, the point is in the bounding box of at least
       // one of the member objects of this compound object.  Create a
       // one-element list of a zero-element name.
-      outList.push_back(out);
+      outList.push_back(bsgName());
       return outList;
     }
   }
 
-  // If we're here, the answer is no, so return an empty name.
+  // If we're here, the answer is no, so return an empty list.
   return outList;
 }
 
 
-void drawableCompound::prepare() {
-
-  _pShader->useProgram();
-  _pShader->prepare();
+void drawableCompound::_getLocations() {
 
   _modelMatrixID = _pShader->getUniformID(_modelMatrixName);
   _normalMatrixID = _pShader->getUniformID(_normalMatrixName);
   _viewMatrixID = _pShader->getUniformID(_viewMatrixName);
   _projMatrixID = _pShader->getUniformID(_projMatrixName);
 
+  _locationsProgramID = _pShader->getProgram();
+}
+
+void drawableCompound::prepare() {
+
+  _pShader->useProgram();
+  _pShader->prepare();
+
+  _getLocations();
+
   // Prepare each component object.
   for (DrawableObjList::iterator it = _objects.begin();
        it != _objects.end(); it++) {
@@ -972,113 +3687,720 @@ void drawableCompound::load() {
 
   _pShader->useProgram();
   _pShader->load();
+  _checkLocations();
 
   // Review the current state of the transformation matrices, and pack
   // them all into the total model matrix.
   _totalModelMatrix = getModelMatrix();
 
-  // Load each component object.
+  // Load each component object, and check whether any of their
+  // bounding boxes have changed.
+  if (_objectBoundingBoxes.size() != 2 * _objects.size()) {
+    _objectBoundingBoxes.resize(2 * _objects.size());
+    _worldBoundingBoxNeedsReset = true;
+  }
+  std::vector<glm::vec4>::iterator box = _objectBoundingBoxes.begin();
   for (DrawableObjList::iterator it = _objects.begin();
        it != _objects.end(); it++) {
     (*it)->load();
+
+    glm::vec4 lower = (*it)->getBoundingBoxLower();
+    glm::vec4 upper = (*it)->getBoundingBoxUpper();
+    if ((lower != box[0]) || (upper != box[1])) {
+      box[0] = lower;
+      box[1] = upper;
+      _worldBoundingBoxNeedsReset = true;
+    }
+    box += 2;
+  }
+
+  if (_worldBoundingBoxNeedsReset) {
+    _findWorldBoundingBox();
+    _worldBoundingBoxNeedsReset = false;
+  }
+}
+
+void drawableCompound::_findWorldBoundingBox() {
+
+  _haveWorldBoundingBox = false;
+  for (size_t i = 0; i < _objects.size(); i++) {
+    _addToWorldBoundingBox(_objectBoundingBoxes[2 * i],
+                           _objectBoundingBoxes[2 * i + 1],
+                           _totalModelMatrix);
+  }
+}
+
+void drawableCompound::_addToWorldBoundingBox(const glm::vec4 &lower,
+                                              const glm::vec4 &upper,
+                                              const glm::mat4 &modelMatrix) {
+
+  // The box might be rotated, so transform all eight corners and find
+  // a box around them.
+  for (int i = 0; i < 8; i++) {
+
+    glm::vec3 corner = glm::vec3(modelMatrix *
+                                 glm::vec4((i & 1) ? upper.x : lower.x,
+                                           (i & 2) ? upper.y : lower.y,
+                                           (i & 4) ? upper.z : lower.z,
+                                           1.0f));
+
+    if (_haveWorldBoundingBox) {
+      _worldBoundingBoxLower = glm::min(_worldBoundingBoxLower, corner);
+      _worldBoundingBoxUpper = glm::max(_worldBoundingBoxUpper, corner);
+    } else {
+      _worldBoundingBoxLower = corner;
+      _worldBoundingBoxUpper = corner;
+      _haveWorldBoundingBox = true;
+    }
   }
 }
 
+bool drawableCompound::getWorldBoundingBox(glm::vec3 &lower, glm::vec3 &upper) {
+
+  if (!_haveWorldBoundingBox) return false;
+
+  lower = _worldBoundingBoxLower;
+  upper = _worldBoundingBoxUpper;
+  return true;
+}
+
 void drawableCompound::draw(const glm::mat4& viewMatrix,
                             const glm::mat4& projMatrix) {
 
-  _pShader->useProgram();
+  drawShader(viewMatrix, projMatrix);
+  drawObjects(viewMatrix);
+}
+
+void drawableCompound::drawShader(const glm::mat4& viewMatrix,
+                                  const glm::mat4& projMatrix,
+                                  const bool &useProgram) {
+
+  if (useProgram) _pShader->useProgram();
   _pShader->draw();
+  _checkLocations();
+
+  // The view and projection matrices come from the scene object, above us.
+  _pShader->getUniforms().uniformMatrix4fv(_viewMatrixID, viewMatrix);
+  _pShader->getUniforms().uniformMatrix4fv(_projMatrixID, projMatrix);
+}
+
+void drawableCompound::drawObjects(const glm::mat4& viewMatrix) {
+
+  _checkLocations();
 
   // Load the model matrix.  This adjusts the position of each object.
   // Remember that all the objects in a compound object use the same
   // shader and the same model matrix.
-  glUniformMatrix4fv(_modelMatrixID, 1, false, &_totalModelMatrix[0][0]);
+  _pShader->getUniforms().uniformMatrix4fv(_modelMatrixID, _totalModelMatrix);
 
   // Calculate the normal matrix to use for lighting.
   _normalMatrix = glm::transpose(glm::inverse(viewMatrix * _totalModelMatrix));
-  glUniformMatrix4fv(_normalMatrixID, 1, false, &_normalMatrix[0][0]);
-
-  // The view and projection matrices come from the scene object, above us.
-  glUniformMatrix4fv(_viewMatrixID, 1, false, &viewMatrix[0][0]);
-  glUniformMatrix4fv(_projMatrixID, 1, false, &projMatrix[0][0]);
+  _pShader->getUniforms().uniformMatrix4fv(_normalMatrixID, _normalMatrix);
 
   // std::cout << "view" << glm::to_string(viewMatrix) << std::endl;
   // std::cout << "normal" << glm::to_string(_normalMatrix) << std::endl;
   // std::cout << "model" << glm::to_string(_modelMatrix) << std::endl;
   // std::cout << "proj" << glm::to_string(projMatrix) << std::endl;
 
-  for (DrawableObjList::iterator it = _objects.begin();
-       it != _objects.end(); it++) {
-    (*it)->draw();
-  }
+  for (DrawableObjList::iterator it = _objects.begin();
+       it != _objects.end(); it++) {
+    _drawObject(*it, _totalModelMatrix);
+  }
+}
+
+void drawableCompound::setPacking(const int &packing) {
+
+  if (_objects.empty()) return;
+
+  glm::vec4 lower = _objects.front()->getBoundingBoxLower();
+  glm::vec4 upper = _objects.front()->getBoundingBoxUpper();
+  for (DrawableObjList::iterator it = _objects.begin();
+       it != _objects.end(); it++) {
+    lower = glm::min(lower, (*it)->getBoundingBoxLower());
+    upper = glm::max(upper, (*it)->getBoundingBoxUpper());
+  }
+
+  for (DrawableObjList::iterator it = _objects.begin();
+       it != _objects.end(); it++) {
+    (*it)->setPacking(packing);
+    (*it)->setPackingBox(lower, upper);
+  }
+}
+
+void drawableCompound::_drawObject(const bsgPtr<drawableObj> &obj,
+                                   const glm::mat4 &modelMatrix) {
+
+  if (obj->getPacking() & GLPACK_POSITIONS) {
+
+    // The positions are fractions of a box, so put the box in the
+    // model matrix.  The normal matrix doesn't change; the normals
+    // aren't in the box.
+    _pShader->getUniforms().uniformMatrix4fv(_modelMatrixID, modelMatrix *
+                                             obj->getPositionMatrix());
+    obj->draw();
+    _pShader->getUniforms().uniformMatrix4fv(_modelMatrixID, modelMatrix);
+
+  } else {
+
+    obj->draw();
+  }
+}
+
+void drawableCompound::addToQueue(bsgRenderQueue &queue) {
+
+  queue.add(this);
+}
+
+void drawableCompound::addObjectBoundingBox(bsgPtr<drawableObj> &obj) {
+
+  obj->findBoundingBox();
+
+  bsgPtr<drawableObj> bb = new drawableObj();
+  std::vector<glm::vec4> bbCorners(24);
+  std::vector<glm::vec4> bbColors(24, glm::vec4(1.0f, 0.0f, 1.0f, 1.0f));
+
+  glm::vec4 bbLower = obj->getBoundingBoxLower();
+  glm::vec4 bbUpper = obj->getBoundingBoxUpper();
+
+  bbCorners[0] = glm::vec4(bbLower.x, bbLower.y, bbLower.z, 1.0);
+  bbCorners[1] = glm::vec4(bbLower.x, bbLower.y, bbUpper.z, 1.0);
+
+  bbCorners[2] = glm::vec4(bbLower.x, bbLower.y, bbUpper.z, 1.0);
+  bbCorners[3] = glm::vec4(bbLower.x, bbUpper.y, bbUpper.z, 1.0);
+
+  bbCorners[4] = glm::vec4(bbLower.x, bbLower.y, bbLower.z, 1.0);
+  bbCorners[5] = glm::vec4(bbLower.x, bbUpper.y, bbLower.z, 1.0);
+
+  bbCorners[6] = glm::vec4(bbLower.x, bbUpper.y, bbLower.z, 1.0);
+  bbCorners[7] = glm::vec4(bbUpper.x, bbUpper.y, bbLower.z, 1.0);
+
+  bbCorners[8] = glm::vec4(bbLower.x, bbLower.y, bbLower.z, 1.0);
+  bbCorners[9] = glm::vec4(bbUpper.x, bbLower.y, bbLower.z, 1.0);
+
+  bbCorners[10] = glm::vec4(bbUpper.x, bbLower.y, bbLower.z, 1.0);
+  bbCorners[11] = glm::vec4(bbUpper.x, bbLower.y, bbUpper.z, 1.0);
+
+  bbCorners[12] = glm::vec4(bbUpper.x, bbUpper.y, bbUpper.z, 1.0);
+  bbCorners[13] = glm::vec4(bbLower.x, bbUpper.y, bbUpper.z, 1.0);
+
+  bbCorners[14] = glm::vec4(bbLower.x, bbUpper.y, bbUpper.z, 1.0);
+  bbCorners[15] = glm::vec4(bbLower.x, bbUpper.y, bbLower.z, 1.0);
+
+  bbCorners[16] = glm::vec4(bbUpper.x, bbUpper.y, bbUpper.z, 1.0);
+  bbCorners[17] = glm::vec4(bbUpper.x, bbLower.y, bbUpper.z, 1.0);
+
+  bbCorners[18] = glm::vec4(bbUpper.x, bbLower.y, bbUpper.z, 1.0);
+  bbCorners[19] = glm::vec4(bbLower.x, bbLower.y, bbUpper.z, 1.0);
+
+  bbCorners[20] = glm::vec4(bbUpper.x, bbUpper.y, bbUpper.z, 1.0);
+  bbCorners[21] = glm::vec4(bbUpper.x, bbUpper.y, bbLower.z, 1.0);
+
+  bbCorners[22] = glm::vec4(bbUpper.x, bbUpper.y, bbLower.z, 1.0);
+  bbCorners[23] = glm::vec4(bbUpper.x, bbLower.y, bbLower.z, 1.0);
+
+  // This is a bit hackish; should query to use the same name as in
+  // obj->_vertices, etc.
+  bb->addData(GLDATA_VERTICES, "position", bbCorners);
+  bb->addData(GLDATA_COLORS, "color", bbColors);
+  bb->setDrawType(GL_LINES);
+
+  // std::cout << bb << std::endl;
+
+  // for (int i = 0; i < 24; i++) {
+  //   std::cout << "corner:" << bbCorners[i].x << "," << bbCorners[i].y << "," << bbCorners[i].z << " color:" << bbColors[i].r << "," << bbColors[i].g << "," << bbColors[i].b << std::endl;
+  // }
+
+  addObject(bb);
+}
+
+
+
+void drawableInstanced::_init() {
+
+  _instancesChanged = true;
+  _instanceBufferID = 0;
+  _instanceMatrixName = "instanceMatrix";
+  _instanceMatrixID = -1;
+  _instanceNormalMatrixName = "instanceNormalMatrix";
+  _instanceNormalMatrixID = -1;
+  _instanced = false;
+}
+
+drawableInstanced::~drawableInstanced() {
+
+  if (_instanceBufferID) glDeleteBuffers(1, &_instanceBufferID);
+}
+
+void drawableInstanced::addObjects(drawableCompound &compound) {
+
+  for (drawableCompound::iterator it = compound.begin();
+       it != compound.end(); it++) {
+    addObject(*it);
+  }
+}
+
+int drawableInstanced::addInstance(const glm::mat4 &transform) {
+
+  _instances.push_back(transform);
+  _instancesChanged = true;
+  _worldBoundingBoxNeedsReset = true;
+
+  return _instances.size() - 1;
+}
+
+void drawableInstanced::setInstances(const transformStore &store) {
+
+  _instances.resize(store.getNumNodes());
+  for (size_t i = 0; i < _instances.size(); i++) {
+    _instances[i] = store.getWorldMatrix(i);
+  }
+  _instancesChanged = true;
+  _worldBoundingBoxNeedsReset = true;
+}
+
+std::vector<int> drawableInstanced::insideInstanceBoundingBox(const glm::vec4 &testPoint) {
+
+  std::vector<int> out;
+  glm::mat4 modelMatrix = getModelMatrix();
+
+  for (size_t i = 0; i < _instances.size(); i++) {
+
+    glm::mat4 instanceModelMatrix = modelMatrix * _instances[i];
+
+    for (DrawableObjList::iterator it = _objects.begin();
+         it != _objects.end(); it++) {
+
+      if ((*it)->insideBoundingBox(testPoint, instanceModelMatrix)) {
+        out.push_back(i);
+        break;
+      }
+    }
+  }
+
+  return out;
+}
+
+bsgNameList drawableInstanced::insideBoundingBox(const glm::vec4 &testPoint) {
+
+  bsgNameList outList;
+  if (!insideInstanceBoundingBox(testPoint).empty()) {
+    outList.push_back(bsgName());
+    outList.back().push_back(_name);
+  }
+  return outList;
+}
+
+void drawableInstanced::addInsidePaths(const glm::vec4 &testPoint,
+                                       bsgPath &prefix,
+                                       std::vector<bsgPath> &out) {
+
+  // The prefix already ends with our name, so it is the whole path.
+  if (!insideInstanceBoundingBox(testPoint).empty()) out.push_back(prefix);
+}
+
+void drawableInstanced::prepare() {
+
+  // Packed positions need their box in the model matrix, before the
+  // instance matrix, and the instanced shader has no place for it.
+  // So the positions are left unpacked.  The rest can stay packed.
+  for (DrawableObjList::iterator it = _objects.begin();
+       it != _objects.end(); it++) {
+    int packing = (*it)->getPacking();
+    if (packing & GLPACK_POSITIONS)
+      (*it)->setPacking(packing & ~GLPACK_POSITIONS);
+  }
+
+  drawableCompound::prepare();
+
+  // The bounding boxes are used to test each instance, so make sure
+  // they are ready.
+  for (DrawableObjList::iterator it = _objects.begin();
+       it != _objects.end(); it++) {
+    (*it)->findBoundingBox();
+  }
+}
+
+void drawableInstanced::_getLocations() {
+
+  drawableCompound::_getLocations();
+
+  _instanceMatrixID =
+    glGetAttribLocation(_pShader->getProgram(), _instanceMatrixName.c_str());
+  _instanceNormalMatrixID =
+    glGetAttribLocation(_pShader->getProgram(),
+                        _instanceNormalMatrixName.c_str());
+
+  // We can only draw all the instances at once if the hardware
+  // supports it and the shader is ready to accept the instance
+  // matrices.  Otherwise we draw them one at a time.
+  _instanced = GLEW_ARB_draw_instanced && GLEW_ARB_instanced_arrays &&
+    (_instanceMatrixID >= 0) && (_instanceNormalMatrixID >= 0);
+
+  if (_instanced && !_instanceBufferID) glGenBuffers(1, &_instanceBufferID);
+
+  _instancesChanged = true;
+}
+
+void drawableInstanced::_findWorldBoundingBox() {
+
+  _haveWorldBoundingBox = false;
+  for (std::vector<glm::mat4>::iterator jt = _instances.begin();
+       jt != _instances.end(); jt++) {
+    glm::mat4 modelMatrix = _totalModelMatrix * (*jt);
+
+    for (size_t i = 0; i < _objects.size(); i++) {
+      _addToWorldBoundingBox(_objectBoundingBoxes[2 * i],
+                             _objectBoundingBoxes[2 * i + 1],
+                             modelMatrix);
+    }
+  }
+}
+
+void drawableInstanced::load() {
+
+  drawableCompound::load();
+
+  if (!_instanced || !_instancesChanged) return;
+
+  // Pack each instance matrix with its inverse transpose, for the
+  // normals.
+  std::vector<glm::mat4> instanceData;
+  instanceData.reserve(2 * _instances.size());
+  for (std::vector<glm::mat4>::iterator it = _instances.begin();
+       it != _instances.end(); it++) {
+    instanceData.push_back(*it);
+    instanceData.push_back(glm::transpose(glm::inverse(*it)));
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, _instanceBufferID);
+  glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(glm::mat4),
+               instanceData.empty() ? NULL : &instanceData[0][0][0],
+               GL_STATIC_DRAW);
+
+  _instancesChanged = false;
+}
+
+void drawableInstanced::drawObjects(const glm::mat4& viewMatrix) {
+
+  if (_instances.empty()) return;
+
+  _checkLocations();
+
+  if (_instanced) {
+
+    // The model and normal matrices are shared by all the instances,
+    // and the shader applies the instance matrices after them.
+    _pShader->getUniforms().uniformMatrix4fv(_modelMatrixID, _totalModelMatrix);
+    _normalMatrix = glm::transpose(glm::inverse(viewMatrix * _totalModelMatrix));
+    _pShader->getUniforms().uniformMatrix4fv(_normalMatrixID, _normalMatrix);
+
+    for (DrawableObjList::iterator it = _objects.begin();
+         it != _objects.end(); it++) {
+      (*it)->drawInstanced(_instances.size(), _instanceBufferID,
+                           _instanceMatrixID, _instanceNormalMatrixID);
+    }
+
+  } else {
+
+    // If the shader has instance matrices, but we are not using them,
+    // set them to the identity.  These are constant attribute values,
+    // used while the attribute arrays are disabled.
+    for (int i = 0; i < 4; i++) {
+      glm::vec4 column(0.0f);
+      column[i] = 1.0f;
+      if (_instanceMatrixID >= 0)
+        glVertexAttrib4fv(_instanceMatrixID + i, &column[0]);
+      if (_instanceNormalMatrixID >= 0)
+        glVertexAttrib4fv(_instanceNormalMatrixID + i, &column[0]);
+    }
+
+    // Draw each instance in turn, with the instance matrix folded into
+    // the model matrix.
+    for (std::vector<glm::mat4>::iterator jt = _instances.begin();
+         jt != _instances.end(); jt++) {
+
+      glm::mat4 modelMatrix = _totalModelMatrix * (*jt);
+      _pShader->getUniforms().uniformMatrix4fv(_modelMatrixID, modelMatrix);
+      _normalMatrix = glm::transpose(glm::inverse(viewMatrix * modelMatrix));
+      _pShader->getUniforms().uniformMatrix4fv(_normalMatrixID, _normalMatrix);
+
+      for (DrawableObjList::iterator it = _objects.begin();
+           it != _objects.end(); it++) {
+        _drawObject(*it, modelMatrix);
+      }
+    }
+  }
+}
+
+bsgFrustum::bsgFrustum(const glm::mat4 &viewMatrix,
+                       const glm::mat4 &projMatrix) {
+
+  // Each plane is a sum or difference of the last row of the combined
+  // matrix and one of the others.  (Gribb and Hartmann.)  GLM matrices
+  // are indexed by column first.
+  glm::mat4 m = projMatrix * viewMatrix;
+  glm::vec4 row[4];
+  for (int i = 0; i < 4; i++) {
+    row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+  }
+
+  _planes[0] = row[3] + row[0];  // left
+  _planes[1] = row[3] - row[0];  // right
+  _planes[2] = row[3] + row[1];  // bottom
+  _planes[3] = row[3] - row[1];  // top
+  _planes[4] = row[3] + row[2];  // near
+  _planes[5] = row[3] - row[2];  // far
+}
+
+bool bsgFrustum::insideFrustum(const glm::vec3 &lower,
+                               const glm::vec3 &upper) const {
+
+  for (int i = 0; i < 6; i++) {
+
+    // Find the corner of the box farthest along the plane's normal.
+    // If even that one is behind the plane, the whole box is.
+    glm::vec4 corner((_planes[i].x > 0.0f) ? upper.x : lower.x,
+                     (_planes[i].y > 0.0f) ? upper.y : lower.y,
+                     (_planes[i].z > 0.0f) ? upper.z : lower.z,
+                     1.0f);
+
+    if (glm::dot(_planes[i], corner) < 0.0f) return false;
+  }
+
+  return true;
+}
+
+void bsgRenderQueue::add(drawableCompound* compound) {
+
+  drawItem item;
+  item.compound = compound;
+  item.shader = compound->getShader().ptr();
+  item.programID = item.shader->getProgram();
+  item.textureID = item.shader->getTextureID();
+
+  // Objects that share their geometry (see bsgGeometryCache) sort
+  // together, which keeps their buffers hot.
+  item.geometry = (compound->getNumObjects() > 0) ?
+    compound->begin()->ptr() : NULL;
+
+  _items.push_back(item);
 }
 
-void drawableCompound::addObjectBoundingBox(bsgPtr<drawableObj> &obj) {
+void bsgRenderQueue::draw(const glm::mat4 &viewMatrix,
+                          const glm::mat4 &projMatrix) {
+
+  std::sort(_items.begin(), _items.end());
+
+  _stateChanges = 0;
+  _programChanges = 0;
+  shaderMgr* lastShader = NULL;
+  GLuint lastProgramID = 0;
+
+  for (std::vector<drawItem>::iterator it = _items.begin();
+       it != _items.end(); it++) {
+
+    if (it->shader != lastShader) {
+
+      // The program, the shader's lights and texture, and the view
+      // and projection matrices only need to be loaded when the shader
+      // changes.  Everything after that in the same run only needs its
+      // own model matrix.  Shaders can share a program (see
+      // shaderProgram), in which case only the texture and lights
+      // need to change.
+      bool newProgram = (lastShader == NULL) || (it->programID != lastProgramID);
+      it->compound->drawShader(viewMatrix, projMatrix, newProgram);
+      lastShader = it->shader;
+      lastProgramID = it->programID;
+      _stateChanges++;
+      if (newProgram) _programChanges++;
+    }
 
-  obj->findBoundingBox();
+    it->compound->drawObjects(viewMatrix);
+  }
 
-  bsgPtr<drawableObj> bb = new drawableObj();
-  std::vector<glm::vec4> bbCorners(24);
-  std::vector<glm::vec4> bbColors(24, glm::vec4(1.0f, 0.0f, 1.0f, 1.0f));
+  _stateChangesSaved = _items.size() - _stateChanges;
 
-  glm::vec4 bbLower = obj->getBoundingBoxLower();
-  glm::vec4 bbUpper = obj->getBoundingBoxUpper();
+  for (std::vector<drawableMulti*>::iterator it = _others.begin();
+       it != _others.end(); it++) {
+    (*it)->draw(viewMatrix, projMatrix);
+  }
+}
 
-  bbCorners[0] = glm::vec4(bbLower.x, bbLower.y, bbLower.z, 1.0);
-  bbCorners[1] = glm::vec4(bbLower.x, bbLower.y, bbUpper.z, 1.0);
+// One merged object in a frozen collection, while it is being built.
+struct frozenBatch {
+  bsgPtr<shaderMgr> shader;
+  GLenum drawType;
+  bsgPtr<drawableObj> first;  // For the attribute names.
+  std::vector<glm::vec4> vertices, colors, normals;
+  std::vector<glm::vec2> uvs;
+  std::vector<GLuint> indices;
+};
+
+// Turns the vertex list of a primitive type into a list of plain
+// triangles, lines, or points, in the order OpenGL would draw them.
+// Returns the plain type, or zero if we don't know how to do it.
+static GLenum simplifyPrimitives(const GLenum &drawType,
+                                 const std::vector<GLuint> &in,
+                                 std::vector<GLuint> &out) {
+
+  int n = in.size();
+
+  switch(drawType) {
+  case(GL_TRIANGLES):
+    out.insert(out.end(), in.begin(), in.begin() + 3 * (n / 3));
+    return GL_TRIANGLES;
+
+  case(GL_TRIANGLE_STRIP):
+  case(GL_TRIANGLE_FAN):
+    for (int i = 0; i < n - 2; i++) {
+      GLuint a, b, c;
+      if (drawType == GL_TRIANGLE_FAN) {
+        a = in[0]; b = in[i + 1]; c = in[i + 2];
+      } else if (i % 2 == 0) {
+        a = in[i]; b = in[i + 1]; c = in[i + 2];
+      } else {
+        // Every other triangle of a strip is flipped, to keep the
+        // winding consistent.
+        a = in[i + 1]; b = in[i]; c = in[i + 2];
+      }
+      // Triangles with a repeated vertex draw nothing.
+      if ((a == b) || (b == c) || (a == c)) continue;
+      out.push_back(a); out.push_back(b); out.push_back(c);
+    }
+    return GL_TRIANGLES;
 
-  bbCorners[2] = glm::vec4(bbLower.x, bbLower.y, bbUpper.z, 1.0);
-  bbCorners[3] = glm::vec4(bbLower.x, bbUpper.y, bbUpper.z, 1.0);
+  case(GL_LINES):
+    out.insert(out.end(), in.begin(), in.begin() + 2 * (n / 2));
+    return GL_LINES;
 
-  bbCorners[4] = glm::vec4(bbLower.x, bbLower.y, bbLower.z, 1.0);
-  bbCorners[5] = glm::vec4(bbLower.x, bbUpper.y, bbLower.z, 1.0);
+  case(GL_LINE_STRIP):
+  case(GL_LINE_LOOP):
+    for (int i = 0; i < n - 1; i++) {
+      out.push_back(in[i]); out.push_back(in[i + 1]);
+    }
+    if ((drawType == GL_LINE_LOOP) && (n > 2)) {
+      out.push_back(in[n - 1]); out.push_back(in[0]);
+    }
+    return GL_LINES;
 
-  bbCorners[6] = glm::vec4(bbLower.x, bbUpper.y, bbLower.z, 1.0);
-  bbCorners[7] = glm::vec4(bbUpper.x, bbUpper.y, bbLower.z, 1.0);
+  case(GL_POINTS):
+    out.insert(out.end(), in.begin(), in.end());
+    return GL_POINTS;
 
-  bbCorners[8] = glm::vec4(bbLower.x, bbLower.y, bbLower.z, 1.0);
-  bbCorners[9] = glm::vec4(bbUpper.x, bbLower.y, bbLower.z, 1.0);
+  default:
+    return 0;
+  }
+}
 
-  bbCorners[10] = glm::vec4(bbUpper.x, bbLower.y, bbLower.z, 1.0);
-  bbCorners[11] = glm::vec4(bbUpper.x, bbLower.y, bbUpper.z, 1.0);
+// The list of vertices an object draws, as indices.
+static std::vector<GLuint> drawnIndices(const bsgPtr<drawableObj> &obj) {
 
-  bbCorners[12] = glm::vec4(bbUpper.x, bbUpper.y, bbUpper.z, 1.0);
-  bbCorners[13] = glm::vec4(bbLower.x, bbUpper.y, bbUpper.z, 1.0);
+  std::vector<GLuint> out = obj->getIndices();
 
-  bbCorners[14] = glm::vec4(bbLower.x, bbUpper.y, bbUpper.z, 1.0);
-  bbCorners[15] = glm::vec4(bbLower.x, bbUpper.y, bbLower.z, 1.0);
+  if (out.empty()) {
+    for (GLsizei i = 0; i < obj->getCount(); i++) out.push_back(i);
+  } else {
+    out.resize(obj->getCount());
+  }
 
-  bbCorners[16] = glm::vec4(bbUpper.x, bbUpper.y, bbUpper.z, 1.0);
-  bbCorners[17] = glm::vec4(bbUpper.x, bbLower.y, bbUpper.z, 1.0);
+  return out;
+}
 
-  bbCorners[18] = glm::vec4(bbUpper.x, bbLower.y, bbUpper.z, 1.0);
-  bbCorners[19] = glm::vec4(bbLower.x, bbLower.y, bbUpper.z, 1.0);
+// Sorts the pieces of a collection into batches for freezing.  The
+// pieces that can't be merged go on the live list.
+static void gatherFrozen(const bsgPtr<drawableMulti> &pMultiObject,
+                         const glm::mat4 &toLocal,
+                         std::map<std::string, frozenBatch> &batches,
+                         std::vector<bsgPtr<drawableMulti> > &live,
+                         std::vector<bsgPtr<drawableObj> > &merged) {
+
+  drawableCollection* collection = bPtr(drawableCollection, pMultiObject);
+  if (collection) {
+    for (drawableCollection::iterator it = collection->begin();
+         it != collection->end(); it++) {
+      gatherFrozen(it->second, toLocal, batches, live, merged);
+    }
+    return;
+  }
 
-  bbCorners[20] = glm::vec4(bbUpper.x, bbUpper.y, bbUpper.z, 1.0);
-  bbCorners[21] = glm::vec4(bbUpper.x, bbUpper.y, bbLower.z, 1.0);
+  // Instanced objects need their own shader and draw calls, so they
+  // stay live, along with anything else we don't recognize.
+  drawableCompound* compound = bPtr(drawableCompound, pMultiObject);
+  if (!compound || bPtr(drawableInstanced, pMultiObject)) {
+    live.push_back(pMultiObject);
+    return;
+  }
 
-  bbCorners[22] = glm::vec4(bbUpper.x, bbUpper.y, bbLower.z, 1.0);
-  bbCorners[23] = glm::vec4(bbUpper.x, bbLower.y, bbLower.z, 1.0);
+  // Dynamic objects change all the time, so they stay live too.
+  std::vector<GLuint> none;
+  for (drawableCompound::iterator it = compound->begin();
+       it != compound->end(); it++) {
+    if ((*it)->isDynamic() ||
+        !simplifyPrimitives((*it)->getDrawType(), none, none)) {
+      live.push_back(pMultiObject);
+      return;
+    }
+  }
 
-  // This is a bit hackish; should query to use the same name as in
-  // obj->_vertices, etc.
-  bb->addData(GLDATA_VERTICES, "position", bbCorners);
-  bb->addData(GLDATA_COLORS, "color", bbColors);
-  bb->setDrawType(GL_LINES);
+  glm::mat4 modelMatrix = toLocal * compound->getModelMatrix();
+  glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
+
+  for (drawableCompound::iterator it = compound->begin();
+       it != compound->end(); it++) {
+
+    const bsgPtr<drawableObj> &obj = *it;
+    std::vector<glm::vec4> vertices = obj->getData(GLDATA_VERTICES);
+    std::vector<glm::vec4> colors = obj->getData(GLDATA_COLORS);
+    std::vector<glm::vec4> normals = obj->getData(GLDATA_NORMALS);
+    std::vector<glm::vec2> uvs = obj->getTexCoords();
+
+    std::vector<GLuint> indices;
+    GLenum drawType = simplifyPrimitives(obj->getDrawType(),
+                                         drawnIndices(obj), indices);
+
+    // Objects can only be merged if they have the same shader, the
+    // same kind of primitives, and the same attributes.
+    std::ostringstream key;
+    key << compound->getShader().ptr() << ":" << drawType << ":"
+        << obj->getDataName(GLDATA_VERTICES) << ":"
+        << (colors.empty() ? "" : obj->getDataName(GLDATA_COLORS)) << ":"
+        << (normals.empty() ? "" : obj->getDataName(GLDATA_NORMALS)) << ":"
+        << (uvs.empty() ? "" : obj->getDataName(GLDATA_TEXCOORDS)) << ":"
+        << obj->getPacking();
+
+    std::map<std::string, frozenBatch>::iterator bt = batches.find(key.str());
+    if (bt == batches.end()) {
+      frozenBatch batch;
+      batch.shader = compound->getShader();
+      batch.drawType = drawType;
+      batch.first = obj;
+      bt = batches.insert(std::make_pair(key.str(), batch)).first;
+    }
+    frozenBatch &batch = bt->second;
 
-  // std::cout << bb << std::endl;
+    GLuint base = batch.vertices.size();
+    for (size_t i = 0; i < vertices.size(); i++) {
+      batch.vertices.push_back(modelMatrix * vertices[i]);
+    }
+    batch.colors.insert(batch.colors.end(), colors.begin(), colors.end());
+    for (size_t i = 0; i < normals.size(); i++) {
+      batch.normals.push_back(glm::vec4(normalMatrix * glm::vec3(normals[i]),
+                                        normals[i].w));
+    }
+    batch.uvs.insert(batch.uvs.end(), uvs.begin(), uvs.end());
 
-  // for (int i = 0; i < 24; i++) {
-  //   std::cout << "corner:" << bbCorners[i].x << "," << bbCorners[i].y << "," << bbCorners[i].z << " color:" << bbColors[i].r << "," << bbColors[i].g << "," << bbColors[i].b << std::endl;
-  // }
+    for (size_t i = 0; i < indices.size(); i++) {
+      batch.indices.push_back(base + indices[i]);
+    }
 
-  addObject(bb);
+    merged.push_back(obj);
+  }
 }
 
 
-
-drawableCollection::drawableCollection() {
+drawableCollection::drawableCollection() :
+  _haveWorldBoundingBox(false), _frozen(false), _frozenNeedPrepare(false),
+  _culling(true), _nCulled(0), _nDrawn(0) {
   // Seed a random number generator to generate default names randomly.
   #ifdef WIN32
   srand(GetTickCount());
@@ -1089,7 +4411,9 @@ drawableCollection::drawableCollection() {
 }
 
 drawableCollection::drawableCollection (const std::string name) :
-  drawableMulti(name) {
+  drawableMulti(name), _haveWorldBoundingBox(false),
+  _frozen(false), _frozenNeedPrepare(false),
+  _culling(true), _nCulled(0), _nDrawn(0) {
   // Seed a random number generator to generate default names randomly.
   #ifdef WIN32
   srand(GetTickCount());
@@ -1100,10 +4424,37 @@ drawableCollection::drawableCollection (const std::string name) :
 
 std::string drawableCollection::addObject(const std::string name,
                                    const bsgPtr<drawableMulti> &pMultiObject) {
+  _memberChanged();
   pMultiObject->setParent(this);
-  _collection[name] = pMultiObject;
   pMultiObject->setName(name);
 
+  // If the name is taken, the new object just takes over the slot.
+  int place = _findName(name);
+  if (place >= 0) {
+    _collection[place].second = pMultiObject;
+    return name;
+  }
+
+  int slot;
+  if (_freeSlots.empty()) {
+    if (_slotPlaces.size() > 0xffffff)
+      throw std::runtime_error("Too many members for " + getName() + ".");
+    slot = _slotPlaces.size();
+    _slotPlaces.push_back(-1);
+    _slotGenerations.push_back(0);
+  } else {
+    slot = _freeSlots.back();
+    _freeSlots.pop_back();
+  }
+
+  bsgNameID id = bsgNameTable::intern(name);
+
+  _slotPlaces[slot] = _collection.size();
+  _collection.push_back(CollectionMember(name, pMultiObject));
+  _memberSlots.push_back(slot);
+  _memberIDs.push_back(id);
+  _index[id] = slot | (_slotGenerations[slot] << 24);
+
   return name;
 }
 
@@ -1117,7 +4468,7 @@ std::string drawableCollection::addObject(const bsgPtr<drawableMulti> &pMultiObj
 
   } else {
     // Is the name already used?
-    if (_collection.find(pMultiObject->getName()) != _collection.end()) {
+    if (_findName(pMultiObject->getName()) >= 0) {
 
       std::cerr << "You have already used " << pMultiObject->getName()
                 << " in " << getName()
@@ -1133,16 +4484,74 @@ std::string drawableCollection::addObject(const bsgPtr<drawableMulti> &pMultiObj
   }
 }
 
+int drawableCollection::_findHandle(const bsgHandle &handle) const {
+
+  if (handle < 0) return -1;
+
+  size_t slot = handle & 0xffffff;
+  if ((slot >= _slotPlaces.size()) ||
+      (_slotGenerations[slot] != (handle >> 24))) return -1;
+
+  return _slotPlaces[slot];
+}
+
+int drawableCollection::_findName(const std::string &name) const {
+
+  return _findID(bsgNameTable::find(name));
+}
+
+int drawableCollection::_findID(const bsgNameID &id) const {
+
+  CollectionIndex::const_iterator it = _index.find(id);
+
+  if (it == _index.end()) {
+    return -1;
+  } else {
+    return _findHandle(it->second);
+  }
+}
+
+bsgPtr<drawableMulti> drawableCollection::_removeMember(const int &place) {
+
+  _memberChanged();
+
+  bsgPtr<drawableMulti> out = std::move(_collection[place].second);
+  _index.erase(_memberIDs[place]);
+
+  // Free the slot.  Bumping the generation means the old handle
+  // won't match whatever is put in the slot next.  When the count
+  // runs out of bits, the slot is never used again, instead of
+  // starting over at zero and matching old handles.
+  int slot = _memberSlots[place];
+  _slotPlaces[slot] = -1;
+  if (_slotGenerations[slot] < 0x7f) {
+    _slotGenerations[slot]++;
+    _freeSlots.push_back(slot);
+  }
+
+  // Move the last member into the hole.
+  int last = _collection.size() - 1;
+  if (place != last) {
+    std::swap(_collection[place], _collection[last]);
+    _memberSlots[place] = _memberSlots[last];
+    _memberIDs[place] = _memberIDs[last];
+    _slotPlaces[_memberSlots[place]] = place;
+  }
+  _collection.pop_back();
+  _memberSlots.pop_back();
+  _memberIDs.pop_back();
+
+  return out;
+}
+
 bsgPtr<drawableMulti> drawableCollection::delObject(const std::string &name) {
 
-  CollectionMap::iterator it = _collection.find(name);
+  int place = _findName(name);
 
-  if (it == _collection.end()) {
+  if (place < 0) {
     return NULL;
   } else {
-    bsgPtr<drawableMulti> out = it->second;
-    _collection.erase(it);
-    return out;
+    return _removeMember(place);
   }
 }
 
@@ -1150,27 +4559,24 @@ bsgPtr<drawableMulti> drawableCollection::delObject(bsgName name) {
 
   if (name.size() > 0) {
 
-    CollectionMap::iterator it = _collection.find(name.front());
+    int place = _findName(name.front());
 
-    if (it == _collection.end()) {
+    if (place < 0) {
 
       // No match.
       return NULL;
 
-    } else {
+    } else if (name.size() > 1) {
 
-      if (name.size() > 1) {
+      unfreeze();
 
-        // Step down a level.
-        name.pop_front();
-        return it->second->delObject(name);
+      // Step down a level.
+      name.pop_front();
+      return _collection[place].second->delObject(name);
 
-      } else {
+    } else {
 
-        bsgPtr<drawableMulti> out = it->second;
-        _collection.erase(it);
-        return out;
-      }
+      return _removeMember(place);
     }
   } else {
 
@@ -1179,106 +4585,143 @@ bsgPtr<drawableMulti> drawableCollection::delObject(bsgName name) {
   }
 }
 
+bsgPtr<drawableMulti> drawableCollection::delObject(const bsgHandle &handle) {
+
+  int place = _findHandle(handle);
+
+  if (place < 0) {
+    return NULL;
+  } else {
+    return _removeMember(place);
+  }
+}
 
 bsgPtr<drawableMulti> drawableCollection::getObject(const std::string &name) {
 
-  CollectionMap::iterator it = _collection.find(name);
+  int place = _findName(name);
 
-  if (it == _collection.end()) {
+  if (place < 0) {
     return NULL;
   } else {
-    return it->second;
+    return _collection[place].second;
   }
 }
 
 bsgPtr<drawableMulti> drawableCollection::getObject(bsgName name) {
 
-  if (name.size() > 1) {
+  return getObject(bsgPath(name));
+}
 
-    CollectionMap::iterator it = _collection.find(name.front());
+bsgPtr<drawableMulti> drawableCollection::getObject(const bsgPath &path) {
 
-    if (it == _collection.end()) {
+  if (path.empty()) return NULL;
 
-      // No match.
-      return NULL;
+  // Step down a level at a time.  Only a collection has a level
+  // under it.
+  drawableCollection* level = this;
+  for (int i = 0; ; i++) {
 
-    } else {
+    int place = level->_findID(path[i]);
+    if (place < 0) return NULL;
 
-      // Step down a level.
-      name.pop_front();
-      return it->second->getObject(name);
+    if (i == path.size() - 1) return level->_collection[place].second;
 
-    }
-  } else if (name.size() > 0) {
+    level = bPtr(drawableCollection, level->_collection[place].second);
+    if (!level) return NULL;
+  }
+}
 
-    return getObject(name.front());
+bsgPtr<drawableMulti> drawableCollection::getObject(const bsgHandle &handle) {
 
-  } else {
+  int place = _findHandle(handle);
 
-    // This was called with an empty list for some reason.
+  if (place < 0) {
     return NULL;
+  } else {
+    return _collection[place].second;
+  }
+}
+
+bsgHandle drawableCollection::getHandle(const std::string &name) const {
+
+  CollectionIndex::const_iterator it = _index.find(bsgNameTable::find(name));
+
+  if (it == _index.end()) {
+    return -1;
+  } else {
+    return it->second;
   }
 }
 
 bsgNameList drawableCollection::getNames() {
 
-  // Our output.
   bsgNameList out;
+  bsgPath prefix;
+  _addNames(prefix, out);
+  return out;
+}
 
-  // Loop through the collection, running getNames() on all the members.
-  for (CollectionMap::iterator it = _collection.begin();
-       it != _collection.end(); it++) {
-    bsgNameList sublist = it->second->getNames();
+std::vector<bsgPath> drawableCollection::getPaths() {
 
-    if (!sublist.empty()) {
-      for (bsgNameList::iterator jt = sublist.begin();
-           jt != sublist.end(); jt++) {
-        jt->push_front(it->first);
-      }
+  std::vector<bsgPath> out;
+  bsgPath prefix;
+  _addPaths(prefix, out);
+  return out;
+}
+
+void drawableCollection::_addNames(bsgPath &prefix, bsgNameList &out) {
+
+  for (size_t i = 0; i < _collection.size(); i++) {
+
+    prefix.push_back(_memberIDs[i]);
+
+    // A member with nothing under it is named by itself.
+    drawableCollection* sub = bPtr(drawableCollection, _collection[i].second);
+    if (!sub || sub->_collection.empty()) {
+      out.push_back(bsgName());
+      prefix.appendTo(out.back());
     } else {
-      bsgName b;
-      b.push_back(it->first);
-      sublist.push_back(b);
+      sub->_addNames(prefix, out);
     }
 
-    // If any of them reply, add them to the output list.
-    out.splice(out.end(), sublist);
+    prefix.pop_back();
   }
-
-  return out;
 }
 
-bsgNameList drawableCollection::insideBoundingBox(const glm::vec4 &testPoint) {
-
-  bsgNameList out;
+void drawableCollection::_addPaths(bsgPath &prefix, std::vector<bsgPath> &out) {
 
-  for (CollectionMap::iterator it = _collection.begin();
-       it != _collection.end(); it++) {
-    bsgNameList sublist = it->second->insideBoundingBox(testPoint);
+  for (size_t i = 0; i < _collection.size(); i++) {
 
-    // Check if the list is empty.  Note that the list might have one
-    // zero-length entry, if this child is a drawableCompound and the
-    // condition is met.
-    if (!sublist.empty()) {
+    prefix.push_back(_memberIDs[i]);
 
-      for (bsgNameList::iterator jt = sublist.begin();
-           jt != sublist.end(); jt++) {
-        jt->push_front(it->first);
-      }
+    drawableCollection* sub = bPtr(drawableCollection, _collection[i].second);
+    if (!sub || sub->_collection.empty()) {
+      out.push_back(prefix);
+    } else {
+      sub->_addPaths(prefix, out);
     }
 
-    out.splice(out.end(), sublist);
+    prefix.pop_back();
   }
+}
 
-  // If we're here, the answer is no, so this should be an empty list.
-  return out;
+void drawableCollection::addInsidePaths(const glm::vec4 &testPoint,
+                                        bsgPath &prefix,
+                                        std::vector<bsgPath> &out) {
+
+  for (size_t i = 0; i < _collection.size(); i++) {
+
+    prefix.push_back(_memberIDs[i]);
+    _collection[i].second->addInsidePaths(testPoint, prefix, out);
+    prefix.pop_back();
+  }
 }
 
 std::string drawableCollection::printObj (const std::string &prefix) const {
 
   std::string out = prefix + "<drawableCollection:" + _name + ">";
 
-  for (CollectionMap::const_iterator it = _collection.begin();
+  for (CollectionList::const_iterator it = _collection.begin();
        it != _collection.end(); it++) {
 
     out += "\n" + it->second->printObj(prefix + "| ");
@@ -1290,28 +4733,284 @@ std::string drawableCollection::printObj (const std::string &prefix) const {
 
 void drawableCollection::prepare() {
 
-  for (CollectionMap::iterator it =  _collection.begin();
+  for (CollectionList::iterator it =  _collection.begin();
        it != _collection.end(); it++) {
     it->second->prepare();
   }
+
+  // The members are prepared even if we are frozen, so we can thaw
+  // at any time.
+  for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+       it != _frozenObjects.end(); it++) {
+    (*it)->prepare();
+  }
+  _frozenNeedPrepare = false;
+}
+
+void drawableCollection::freeze() {
+
+  unfreeze();
+
+  // Everything is merged in the coordinates of this collection, so
+  // the merged objects can use our model matrix.
+  glm::mat4 toLocal = getInverseModelMatrix();
+
+  std::map<std::string, frozenBatch> batches;
+  std::vector<bsgPtr<drawableMulti> > live;
+  std::vector<bsgPtr<drawableObj> > merged;
+  for (CollectionList::iterator it =  _collection.begin();
+       it != _collection.end(); it++) {
+    gatherFrozen(it->second, toLocal, batches, live, merged);
+  }
+
+  // Ask the merged objects to tell us when they change.  An object
+  // can be used by many compounds, but it only needs telling once.
+  for (std::vector<bsgPtr<drawableObj> >::iterator it = merged.begin();
+       it != merged.end(); it++) {
+    std::vector<drawableCollection*> &frozenIn = (*it)->_frozenIn;
+    if (std::find(frozenIn.begin(), frozenIn.end(), this) == frozenIn.end()) {
+      frozenIn.push_back(this);
+      _mergedObjects.push_back(*it);
+    }
+  }
+
+  for (std::map<std::string, frozenBatch>::iterator it = batches.begin();
+       it != batches.end(); it++) {
+
+    frozenBatch &batch = it->second;
+
+    bsgPtr<drawableObj> obj = new drawableObj();
+    obj->addData(GLDATA_VERTICES, batch.first->getDataName(GLDATA_VERTICES),
+                 batch.vertices);
+    if (!batch.colors.empty())
+      obj->addData(GLDATA_COLORS, batch.first->getDataName(GLDATA_COLORS),
+                   batch.colors);
+    if (!batch.normals.empty())
+      obj->addData(GLDATA_NORMALS, batch.first->getDataName(GLDATA_NORMALS),
+                   batch.normals);
+    if (!batch.uvs.empty())
+      obj->addData(GLDATA_TEXCOORDS, batch.first->getDataName(GLDATA_TEXCOORDS),
+                   batch.uvs);
+    obj->setIndices(batch.indices);
+    obj->setDrawType(batch.drawType);
+    obj->setPacking(batch.first->getPacking());
+
+    drawableCompound* compound =
+      new drawableCompound(randomName("frozen"), batch.shader);
+    compound->addObject(obj);
+    compound->setParent(this);
+
+    _frozenObjects.push_back(compound);
+  }
+
+  _frozenObjects.insert(_frozenObjects.end(), live.begin(), live.end());
+
+  _frozen = true;
+  _frozenNeedPrepare = true;
+  _nFrozen++;
+}
+
+void drawableCollection::unfreeze() {
+
+  if (!_frozen) return;
+
+  for (std::vector<bsgPtr<drawableObj> >::iterator it = _mergedObjects.begin();
+       it != _mergedObjects.end(); it++) {
+    std::vector<drawableCollection*> &frozenIn = (*it)->_frozenIn;
+    frozenIn.erase(std::find(frozenIn.begin(), frozenIn.end(), this));
+  }
+  _mergedObjects.clear();
+
+  _frozenObjects.clear();
+  _frozen = false;
+  _frozenNeedPrepare = false;
+  _nFrozen--;
+}
+
+void drawableCollection::_memberChanged() {
+
+  unfreeze();
+  if (_nFrozen) drawableMulti::_memberChanged();
 }
 
 void drawableCollection::load() {
 
-  // Then draw all the objects.
-  for (CollectionMap::iterator it =  _collection.begin();
+  // This is the one place the counts start over.  load() is once a
+  // frame, and draw() may be more (once for each eye).
+  _nCulled = 0;
+  _nDrawn = 0;
+
+  // Load all the objects, and put a box around their boxes.  If any
+  // one of them doesn't have a box, we can't have one either.
+  bool haveBox = true;
+  _haveWorldBoundingBox = false;
+
+  if (_frozen) {
+
+    if (_frozenNeedPrepare) {
+      for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+           it != _frozenObjects.end(); it++) {
+        (*it)->prepare();
+      }
+      _frozenNeedPrepare = false;
+    }
+
+    for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+         it != _frozenObjects.end(); it++) {
+      _loadMember(*it, haveBox);
+    }
+
+  } else {
+
+    for (CollectionList::iterator it =  _collection.begin();
+         it != _collection.end(); it++) {
+      _loadMember(it->second, haveBox);
+    }
+  }
+
+  _haveWorldBoundingBox = _haveWorldBoundingBox && haveBox;
+}
+
+void drawableCollection::_invalidateChildren() {
+
+  for (CollectionList::iterator it =  _collection.begin();
        it != _collection.end(); it++) {
-    it->second->load();
+    it->second->invalidateWorldMatrix();
+  }
+
+  for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+       it != _frozenObjects.end(); it++) {
+    (*it)->invalidateWorldMatrix();
+  }
+}
+
+void drawableCollection::_loadMember(const bsgPtr<drawableMulti> &pMultiObject,
+                                     bool &haveBox) {
+
+  pMultiObject->load();
+
+  glm::vec3 lower, upper;
+  if (!haveBox) return;
+  if (!pMultiObject->getWorldBoundingBox(lower, upper)) {
+    haveBox = false;
+    return;
+  }
+
+  if (_haveWorldBoundingBox) {
+    _worldBoundingBoxLower = glm::min(_worldBoundingBoxLower, lower);
+    _worldBoundingBoxUpper = glm::max(_worldBoundingBoxUpper, upper);
+  } else {
+    _worldBoundingBoxLower = lower;
+    _worldBoundingBoxUpper = upper;
+    _haveWorldBoundingBox = true;
+  }
+}
+
+bool drawableCollection::getWorldBoundingBox(glm::vec3 &lower, glm::vec3 &upper) {
+
+  if (!_haveWorldBoundingBox) return false;
+
+  lower = _worldBoundingBoxLower;
+  upper = _worldBoundingBoxUpper;
+  return true;
+}
+
+bool drawableCollection::_visible(const bsgPtr<drawableMulti> &pMultiObject,
+                                  const bsgFrustum &frustum) {
+
+  glm::vec3 lower, upper;
+  if (_culling &&
+      pMultiObject->getWorldBoundingBox(lower, upper) &&
+      !frustum.insideFrustum(lower, upper)) {
+    _nCulled++;
+    return false;
+  }
+
+  // Collections are not drawn themselves, only their members.
+  if (!bPtr(drawableCollection, pMultiObject)) _nDrawn++;
+  return true;
+}
+
+int drawableCollection::getNumCulled() {
+
+  int nCulled = _nCulled;
+
+  // Only the members that were drawn have counts of their own.
+  if (_frozen) {
+    for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+         it != _frozenObjects.end(); it++) {
+      drawableCollection* pColl = bPtr(drawableCollection, (*it));
+      if (pColl) nCulled += pColl->getNumCulled();
+    }
+  } else {
+    for (CollectionList::iterator it =  _collection.begin();
+         it != _collection.end(); it++) {
+      drawableCollection* pColl = bPtr(drawableCollection, it->second);
+      if (pColl) nCulled += pColl->getNumCulled();
+    }
+  }
+
+  return nCulled;
+}
+
+int drawableCollection::getNumDrawn() {
+
+  int nDrawn = _nDrawn;
+
+  if (_frozen) {
+    for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+         it != _frozenObjects.end(); it++) {
+      drawableCollection* pColl = bPtr(drawableCollection, (*it));
+      if (pColl) nDrawn += pColl->getNumDrawn();
+    }
+  } else {
+    for (CollectionList::iterator it =  _collection.begin();
+         it != _collection.end(); it++) {
+      drawableCollection* pColl = bPtr(drawableCollection, it->second);
+      if (pColl) nDrawn += pColl->getNumDrawn();
+    }
   }
+
+  return nDrawn;
 }
 
 void drawableCollection::draw(const glm::mat4 &viewMatrix,
                               const glm::mat4 &projMatrix) {
 
-  // Then draw all the objects.
-  for (CollectionMap::iterator it =  _collection.begin();
+  bsgFrustum frustum(viewMatrix, projMatrix);
+
+  if (_frozen) {
+
+    for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+         it != _frozenObjects.end(); it++) {
+      if (_visible(*it, frustum)) (*it)->draw(viewMatrix, projMatrix);
+    }
+    return;
+  }
+
+  // Then draw all the objects that can be seen.
+  for (CollectionList::iterator it =  _collection.begin();
        it != _collection.end(); it++) {
-    it->second->draw(viewMatrix, projMatrix);
+    if (_visible(it->second, frustum))
+      it->second->draw(viewMatrix, projMatrix);
+  }
+}
+
+void drawableCollection::addToQueue(bsgRenderQueue &queue) {
+
+  if (_frozen) {
+
+    for (std::vector<bsgPtr<drawableMulti> >::iterator it = _frozenObjects.begin();
+         it != _frozenObjects.end(); it++) {
+      if (_visible(*it, queue.getFrustum())) (*it)->addToQueue(queue);
+    }
+    return;
+  }
+
+  for (CollectionList::iterator it =  _collection.begin();
+       it != _collection.end(); it++) {
+    if (_visible(it->second, queue.getFrustum()))
+      it->second->addToQueue(queue);
   }
 }
 
@@ -1389,13 +5088,32 @@ glm::mat4 scene::getViewMatrix() {
 
 void scene::load() {
 
+  // Dynamic objects write this frame's vertices into the next part of
+  // the stream buffer.
+  if (streamBuffer::inUse()) streamBuffer::get()->nextFrame();
+
   _sceneRoot.load();
 }
 
 void scene::draw(const glm::mat4 &viewMatrix,
                  const glm::mat4 &projMatrix) {
 
-  _sceneRoot.draw(viewMatrix, projMatrix);
+  if (_sortedDraw) {
+
+    _renderQueue.clear();
+    _renderQueue.setFrustum(bsgFrustum(viewMatrix, projMatrix));
+    _sceneRoot.addToQueue(_renderQueue);
+    _renderQueue.draw(viewMatrix, projMatrix);
+
+  } else {
+
+    _sceneRoot.draw(viewMatrix, projMatrix);
+  }
+
+  // The drawableObj objects leave their vertex array bound, so
+  // consecutive draws don't have to unbind it.  Clean up here, so
+  // whatever comes after us starts with the default state.
+  if (drawableObj::usingVertexArrays()) glBindVertexArray(0);
 }
 
 }
@@ -6,14 +6,21 @@
 #include <stdexcept>
 #include <memory.h>
 #include <math.h>
+#include <time.h>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <string>
 #include <vector>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <memory>
+#include <atomic>
+#include <type_traits>
 
 // Include GLM
 #include <glm/glm.hpp>
@@ -53,6 +60,20 @@ typedef enum {
   GLMATRIX_NORMAL = 3      //! This is a 'normal' matrix, or an inverse model matrix.
 } GLMATRIXTYPE;
 
+/// \brief Compact ways to store interleaved vertex data.
+///
+/// By default, every attribute is stored as 32-bit floats.  These can
+/// be combined with | and handed to drawableObj::setPacking().
+typedef enum {
+  GLPACK_NONE       = 0,   //! Everything as floats.
+  GLPACK_NORMALS    = 1,   //! Normals in 10 bits per component, 4 bytes.
+  GLPACK_COLORS     = 2,   //! Colors as normalized bytes, 4 bytes.
+  GLPACK_UVS_HALF   = 4,   //! Texture coordinates as half floats, 4 bytes.
+  GLPACK_UVS_SHORT  = 8,   //! Texture coordinates as normalized shorts, 4 bytes.  Only for coordinates between 0 and 1.
+  GLPACK_POSITIONS  = 16,  //! Positions as 16-bit fractions of the bounding box, 8 bytes.
+  GLPACK_ALL        = 23   //! All of the above, with half float texture coordinates.
+} GLPACKING;
+
 
 /// \mainpage Baby Scene Graph
 ///
@@ -117,71 +138,149 @@ typedef enum {
 ///
 ///  For an introduction to this library, start with the \ref scene object.
 
-/// \brief A reference counter for a smart pointer to bsg objects.
-class bsgPtrRC {
+/// \brief The reference count for objects used with bsgPtr.
+///
+/// The count lives in the object itself, so making a bsgPtr to a new
+/// object doesn't allocate anything more, and two bsgPtrs made from
+/// the same plain pointer share a count.  The count is atomic, so
+/// pointers to the same object can be copied and dropped on
+/// different threads.  (A single bsgPtr still shouldn't be changed
+/// on one thread while another is using it.)
+///
+/// All the bsg classes that are used with a bsgPtr inherit from this.
+/// Other classes can be used with a bsgPtr too, but then the pointer
+/// has to allocate a count for each new object.
+class bsgRefCounted {
  private:
-  int count; // Reference count
+  mutable std::atomic<int> _refCount;
 
  public:
- bsgPtrRC(int start) : count(start) {};
+  bsgRefCounted() : _refCount(0) {};
+
+  // A copy is a new object, which nothing points to yet.
+  bsgRefCounted(const bsgRefCounted &) : _refCount(0) {};
+  bsgRefCounted &operator=(const bsgRefCounted &) { return *this; };
 
   /// Increment the reference count.
-  void addRef() { count++; }
+  void addRef() const { _refCount.fetch_add(1, std::memory_order_relaxed); };
+
+  /// Decrement and return the count.
+  int release() const {
+    return _refCount.fetch_sub(1, std::memory_order_acq_rel) - 1;
+  };
 
-  // Decrement and return count.
-  int release() { return --count; }
+  /// How many bsgPtrs point to this object?
+  int getRefCount() const { return _refCount.load(std::memory_order_relaxed); };
 };
 
 /// \brief A smart pointer to a bsg object.
 ///
 /// A smart pointer to the bsgPtr so that multiple objects can use
-/// the same shader object.
+/// the same shader object.  The object is deleted when the last
+/// pointer to it goes away.  If the object is a \ref bsgRefCounted,
+/// the reference count is kept in the object.  Otherwise, a separate
+/// count is allocated when the first pointer to the object is made,
+/// and the other pointers share it, as they always used to.  Either
+/// way the count is atomic, and a null pointer costs nothing at all.
 ///
 template <class T>
 class bsgPtr {
  private:
-  T* _pData;       // The pointer.
-  bsgPtrRC* _reference; // The reference count.
+  // For an object that doesn't keep its own count, the pointer goes
+  // in here with the count.
+  struct _countBlock {
+    std::atomic<int> count;
+    T* pData;
+    _countBlock(T* p) : count(1), pData(p) {};
+  };
+
+  // Which one is used depends on T.  Either way, NULL is a null
+  // pointer.
+  union {
+    T* _pData;       // The pointer.
+    _countBlock* _pBlock;
+  };
+
+  // These pick the kind of count at the point of use, not when the
+  // class is declared, since T may not be complete yet then.
+  typedef std::is_base_of<bsgRefCounted, T> _inObject;
+
+  void _attach(T* pValue, std::true_type) {
+    _pData = pValue;
+    _pData->addRef();
+  }
+  void _attach(T* pValue, std::false_type) { _pBlock = new _countBlock(pValue); }
+
+  T* _get(std::true_type) const { return _pData; }
+  T* _get(std::false_type) const { return _pBlock ? _pBlock->pData : 0; }
+
+  void _addRef(std::true_type) const { _pData->addRef(); }
+  void _addRef(std::false_type) const {
+    _pBlock->count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void _release(std::true_type) {
+    if (_pData->release() == 0) delete _pData;
+  }
+  void _release(std::false_type) {
+    if (_pBlock->count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete _pBlock->pData;
+      delete _pBlock;
+    }
+  }
+
+  int _getCount(std::true_type) const { return _pData->getRefCount(); }
+  int _getCount(std::false_type) const {
+    return _pBlock->count.load(std::memory_order_relaxed);
+  }
+
+  void _addRef() const { if (_pData) _addRef(typename _inObject::type()); }
+  void _release() { if (_pData) _release(typename _inObject::type()); }
 
  public:
- bsgPtr() : _pData(0) { _reference = new bsgPtrRC(1); };
- bsgPtr(T* pValue) : _pData(pValue) { _reference = new bsgPtrRC(1); };
+ bsgPtr() : _pData(0) {};
+ bsgPtr(T* pValue) : _pData(0) {
+    if (pValue) _attach(pValue, typename _inObject::type());
+  };
 
   /// Copy constructor
- bsgPtr(const bsgPtr &sp) : _pData(sp._pData), _reference(sp._reference) {
-    _reference->addRef();
-  }
+ bsgPtr(const bsgPtr &sp) : _pData(sp._pData) { _addRef(); }
+
+  /// Move constructor.  The other pointer is left null.
+ bsgPtr(bsgPtr &&sp) : _pData(sp._pData) { sp._pData = 0; }
 
   /// Destructor.  Decrement the reference count.  If the count
   /// becomes zero, delete the data.
-  ~bsgPtr() {
-    if (_reference->release() == 0) {
-      delete _pData;
-      delete _reference;
-    }
-  }
+  ~bsgPtr() { _release(); }
 
   operator bool() const { return _pData != 0; };
 
-  T& operator*() { return *_pData; };
-  T* operator->() const { return _pData; };
-  T* ptr() const { return _pData; }; // Use this for casts.
+  T& operator*() { return *ptr(); };
+  T* operator->() const { return ptr(); };
+  T* ptr() const { return _get(typename _inObject::type()); }; // Use this for casts.
+
+  /// How many pointers share this data?  A count of one means this is
+  /// the only one.  A null pointer has a count of zero.
+  int getCount() const {
+    return _pData ? _getCount(typename _inObject::type()) : 0;
+  };
 
   /// Assignment operator.
   bsgPtr<T>& operator=(const bsgPtr<T> &sp) {
+    // Add the new reference before dropping the old one, in case
+    // they are the same.
+    sp._addRef();
+    _release();
+    _pData = sp._pData;
+    return *this;
+  }
+
+  /// Move assignment.  The other pointer is left null.
+  bsgPtr<T>& operator=(bsgPtr<T> &&sp) {
     if (this != &sp) {
-      // Decrement the old reference count.  If references become
-      // zero, delete the data.
-      if (_reference->release() == 0) {
-        delete _pData;
-        delete _reference;
-      }
-
-      // Copy the data and reference pointer and increment the
-      // reference count.
+      _release();
       _pData = sp._pData;
-      _reference = sp._reference;
-      _reference->addRef();
+      sp._pData = 0;
     }
     return *this;
   }
@@ -200,6 +299,27 @@ class bsgUtils {
 
 };
 
+/// \brief The volume of space visible to a camera.
+///
+/// Six planes, extracted from a projection matrix times a view matrix,
+/// with their normals pointing inward.  Used to skip drawing objects
+/// that are out of sight.
+class bsgFrustum {
+ private:
+  glm::vec4 _planes[6];
+
+ public:
+  bsgFrustum() {};
+  bsgFrustum(const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix);
+
+  /// \brief Is any of a box, given in world space, inside the frustum?
+  ///
+  /// This is conservative.  A box near a corner of the frustum might
+  /// be reported as inside when it isn't, but a box that is reported
+  /// as outside is definitely outside.
+  bool insideFrustum(const glm::vec3 &lower, const glm::vec3 &upper) const;
+};
+
 /// \brief Some data for an OpenGL object.
 ///
 /// For most OpenGL objects referencing data used in a shader, there
@@ -221,18 +341,25 @@ class drawableObjData {
  private:
   std::vector<T> _data;
 
+  // The parts of the data that have changed since they were last
+  // loaded into the buffer, as [first, end) pairs of element indices.
+  // They are kept in order, and ranges that touch are merged.
+  std::vector<std::pair<size_t, size_t> > _dirty;
+
  public:
  drawableObjData(): name("") {
     _data.reserve(50);
     ID = 0; bufferID = 0;
   };
  drawableObjData(const std::string inName, const std::vector<T> inData) :
-  name(inName), _data(inData) {}
+  name(inName), _data(inData) {
+    ID = 0; bufferID = 0;
+  };
 
   // Copy constructor
  drawableObjData(const drawableObjData &objData) :
-  _data(objData.getData()), name(objData.name), ID(objData.ID),
-    bufferID(objData.bufferID) {};
+  _data(objData.getData()), _dirty(objData._dirty), name(objData.name),
+    ID(objData.ID), bufferID(objData.bufferID) {};
 
   /// The name of that data inside a shader.
   std::string name;
@@ -262,6 +389,99 @@ class drawableObjData {
 
   /// Yet another size calculator.
   size_t componentsPerVertex() { return sizeof(T) / sizeof(float); };
+
+  /// \brief Replace count elements, starting at first.
+  ///
+  /// The elements must already exist.  The range is marked as
+  /// changed, so only that part of the buffer need be reloaded.
+  void updateRange(const size_t &first, const size_t &count, const T *data) {
+    std::copy(data, data + count, _data.begin() + first);
+    markDirty(first, count);
+  };
+
+  /// \brief Note that count elements, starting at first, have changed.
+  ///
+  /// The range is merged with any changed ranges it overlaps or
+  /// touches, so a run of edits to neighboring elements becomes a
+  /// single upload.
+  void markDirty(const size_t &first, const size_t &count) {
+    if (count == 0) return;
+
+    size_t lower = first, upper = first + count;
+
+    // Skip the ranges entirely below this one, then swallow the ones
+    // that overlap or touch it.
+    typename std::vector<std::pair<size_t, size_t> >::iterator it =
+      _dirty.begin();
+    while ((it != _dirty.end()) && (it->second < lower)) it++;
+
+    typename std::vector<std::pair<size_t, size_t> >::iterator jt = it;
+    while ((jt != _dirty.end()) && (jt->first <= upper)) {
+      lower = std::min(lower, jt->first);
+      upper = std::max(upper, jt->second);
+      jt++;
+    }
+
+    it = _dirty.erase(it, jt);
+    _dirty.insert(it, std::pair<size_t, size_t>(lower, upper));
+  };
+
+  /// Has anything changed since the buffer was loaded?
+  bool isDirty() { return !_dirty.empty(); };
+
+  /// The changed ranges, as [first, end) element indices, in order.
+  const std::vector<std::pair<size_t, size_t> > &getDirtyRanges() {
+    return _dirty;
+  };
+
+  /// Forget the changed ranges, usually because they've been loaded.
+  void clearDirty() { _dirty.clear(); };
+};
+
+/// \brief A record of the uniform values loaded into a shader program.
+///
+/// A program holds on to its uniform values until they are changed,
+/// so there is no need to upload the same view matrix or light list
+/// again for every object drawn with it.  Each shaderMgr has one of
+/// these, and all the uniform uploads for its program go through it.
+/// Anything that hasn't changed since the last upload is skipped.
+///
+/// This only works if nobody else changes the program's uniforms
+/// behind our back.  If you do that, call clear().
+class uniformCache {
+ private:
+
+  std::map<GLint, std::vector<GLfloat> > _values;
+
+  int _nUploaded, _nSkipped;
+
+  /// Compare the values with the ones recorded for the location, and
+  /// record them if they are different.  Returns true if they were.
+  bool _changed(const GLint &location, const GLfloat *values,
+                const size_t &nValues);
+
+ public:
+  uniformCache() : _nUploaded(0), _nSkipped(0) {};
+
+  /// \brief Load an integer uniform, like a texture sampler.
+  void uniform1i(const GLint &location, const GLint &value);
+
+  /// \brief Load an array of vec4 uniforms.
+  void uniform4fv(const GLint &location, const GLsizei &count,
+                  const GLfloat *values);
+
+  /// \brief Load a mat4 uniform.
+  void uniformMatrix4fv(const GLint &location, const glm::mat4 &matrix);
+
+  /// \brief Forget all the recorded values.
+  ///
+  /// The next upload of each uniform will go through.
+  void clear() { _values.clear(); };
+
+  /// \brief How many uploads were done, and how many skipped?
+  int getNumUploaded() { return _nUploaded; };
+  int getNumSkipped() { return _nSkipped; };
+  void resetCounts() { _nUploaded = 0; _nSkipped = 0; };
 };
 
 /// \class lightList
@@ -281,7 +501,7 @@ class drawableObjData {
 /// result in multiple loads of the same data.  Optimizing that
 /// redundancy out of the system is an exercise left for the reader.
 ///
-class lightList {
+class lightList : public bsgRefCounted {
  private:
 
   /// The positions of the lights in the list.
@@ -292,8 +512,8 @@ class lightList {
   /// The default names of things in the shaders, put here for easy
   /// comparison or editing.  If you're mucking around with the
   /// shaders, don't forget that these are names of arrays inside the
-  /// shader, and that the size of the arrays is set with 'XX', see
-  /// the shader constructors below.
+  /// shader, and that the size of the arrays is set with NUM_LIGHTS,
+  /// see the shaderMgr below.
   void _setupDefaultNames() {
     setNames("lightPositionWS", "lightColor");
   }
@@ -372,24 +592,199 @@ class lightList {
   //
   // This must be preceded by a glUseProgram(programID) call.
   void draw();
+
+  /// \brief "Draw" these lights, skipping the unchanged uploads.
+  void draw(uniformCache &uniforms);
 };
 
 typedef enum {
   texturePNG = 0, //! Use for a PNG file.
-  textureDDS = 1, //! Not implemented.
+  textureDDS = 1, //! Use for a DDS file with DXT1 or DXT5 compression.
   textureBMP = 2, //! Not implemented.
   textureCHK = 3, //! Will provide a checkerboard texture.
   textureJPG = 4, //! Not implemented.
   textureTTF = 5  //! Not implemented yet (MKE)
 } textureType;
 
+/// \brief A chain of mipmap levels, made on the CPU.
+///
+/// Each level is half the size of the one before, averaging 2x2
+/// blocks of texels, down to 1x1.  The images are 8-bit RGBA or RGB.
+/// The averaging uses SSE2 where it is available; the results are
+/// the same either way.
+class mipmapChain {
+ private:
+  std::vector<std::vector<unsigned char> > _levels;
+  std::vector<int> _widths, _heights;
+  int _components;
+
+  static bool _useSIMD;
+
+ public:
+  mipmapChain() : _components(0) {};
+
+  /// \brief Make the chain from an image.
+  ///
+  /// If maxBytes is not zero, the biggest levels are dropped until
+  /// the whole chain fits in that many bytes (or only the 1x1 level
+  /// is left), so a big image can be loaded into a small budget.
+  void build(const unsigned char* data, const int &width, const int &height,
+             const int &components, const size_t &maxBytes = 0);
+
+  /// \brief Shrink an image by half in each direction.
+  ///
+  /// The output must have room for max(1, width/2) x max(1, height/2)
+  /// texels.  Rows are packed, with no padding.
+  static void downsample(const unsigned char* in,
+                         const int &width, const int &height,
+                         const int &components, unsigned char* out);
+
+  /// \brief Use SSE2 for downsample(), if available.  On by default.
+  static void setUseSIMD(const bool &useSIMD) { _useSIMD = useSIMD; };
+
+  int getNumLevels() const { return _levels.size(); };
+  int getComponents() const { return _components; };
+  int getWidth(const int &level) const { return _widths[level]; };
+  int getHeight(const int &level) const { return _heights[level]; };
+  const unsigned char* getData(const int &level) const { return &_levels[level][0]; };
+
+  /// \brief The size of all the levels together.
+  size_t getBytes() const;
+};
+
+/// \brief Compresses images to S3TC (DXT) blocks, and writes DDS files.
+///
+/// Compressed textures take a quarter (BC1, also called DXT1) or half
+/// (BC3, or DXT5, which keeps the alpha) of the memory of 8-bit RGBA,
+/// and a DDS file can be loaded without decoding a PNG.  Compressing
+/// is much slower than loading, so it is meant to be done ahead of
+/// time, with the pngToDDS program in the examples directory.
+///
+/// The encoder fits each 4x4 block's colors to a line through the
+/// block's bounding box, which is fast, and usually good enough.
+///
+/// The DDS files written here have their top row first, like those
+/// written by other programs, so the images handed to writeDDS()
+/// should be top row first, too.  textureMgr turns DDS files over
+/// as it reads them, since OpenGL wants the bottom row first.  That
+/// is quick if the height is a multiple of four, but otherwise the
+/// blocks have to be decoded and compressed again, which is slower
+/// and loses a little quality.
+class textureCompressor {
+ public:
+  /// \brief Compress one 4x4 block of RGBA texels.
+  ///
+  /// Writes 8 bytes (BC1) or 16 bytes (BC3, with alpha) to out.
+  static void compressBlock(const unsigned char* rgba, const bool &alpha,
+                            unsigned char* out);
+
+  /// \brief Compress an RGBA image.
+  ///
+  /// Each dimension is padded to a multiple of four by repeating the
+  /// last row or column.  The work is split among nThreads threads.
+  static std::vector<unsigned char> compress(const unsigned char* rgba,
+                                             const int &width, const int &height,
+                                             const bool &alpha,
+                                             const int &nThreads = 1);
+
+  /// \brief Compress all the levels of an RGBA mipmap chain, and
+  /// write them to a DDS file.
+  ///
+  /// Throws an exception if the file can't be written.
+  static void writeDDS(const std::string &fileName, const mipmapChain &mipmaps,
+                       const bool &alpha, const int &nThreads = 1);
+};
+
+/// \brief An OpenGL texture, shared among textureMgr objects.
+///
+/// Decoding an image and loading it onto the GPU is slow, and scenes
+/// often use the same image for several textureMgr objects.  The
+/// textureMgr looks in the cache here before reading a file, and
+/// shares the texture it finds, if any.  Textures are keyed by the
+/// file name (as given, so "a/../b.png" and "b.png" are different),
+/// the texture type, and the sampler options, like the filters.
+///
+/// A texture stays in the cache as long as some textureMgr is using
+/// it, and is deleted from the GPU when the last one lets go.
+///
+/// The cache is for separate textureMgr objects that read the same
+/// file.  One textureMgr given to several shaders, as kbDemoMinVR
+/// does with the board texture, reads its file once anyway.
+class sharedTexture : public bsgRefCounted {
+ private:
+  GLuint _textureID;
+  GLfloat _width, _height;
+  size_t _bytes;
+
+  // This is a pointer so the cache is never destroyed at exit, when
+  // there may be no GL context left to take the textures back.
+  static std::map<std::string, bsgPtr<sharedTexture> > *_cache;
+  static bool _enabled;
+  static int _nHits, _nMisses;
+  static size_t _bytesLoaded, _bytesSaved;
+
+ public:
+  sharedTexture(const GLuint &textureID,
+                const GLfloat &width, const GLfloat &height,
+                const size_t &bytes) :
+    _textureID(textureID), _width(width), _height(height), _bytes(bytes) {};
+  ~sharedTexture() { glDeleteTextures(1, &_textureID); };
+
+  GLuint getTextureID() { return _textureID; };
+  GLfloat getWidth() { return _width; };
+  GLfloat getHeight() { return _height; };
+  /// \brief The approximate size of the texture on the GPU.
+  size_t getBytes() { return _bytes; };
+
+  /// \brief Make a key for the cache.
+  ///
+  /// The options are whatever else affects the texture, such as the
+  /// filter settings.
+  static std::string makeKey(const textureType &type,
+                             const std::string &fileName,
+                             const std::string &options);
+
+  /// \brief Look for a texture.  Returns a null pointer if there is none.
+  static bsgPtr<sharedTexture> find(const std::string &key);
+
+  /// \brief Put a newly loaded texture in the cache.
+  static void add(const std::string &key, const bsgPtr<sharedTexture> &texture);
+
+  /// \brief Drop the textures nobody is using, deleting them.
+  ///
+  /// Returns the number dropped.
+  static int purge();
+
+  /// \brief Drop one texture, if nobody is using it.
+  ///
+  /// Returns true if it was dropped.
+  static bool purge(const std::string &key);
+
+  /// \brief The number of textures in the cache.
+  static int size() { return _cache ? _cache->size() : 0; };
+
+  /// \brief Turn the cache on or off.  It is on by default.
+  static void setEnabled(const bool &enabled) { _enabled = enabled; };
+
+  /// \brief How many textures were found in the cache, and how many
+  /// had to be loaded?
+  static int getNumHits() { return _nHits; };
+  static int getNumMisses() { return _nMisses; };
+
+  /// \brief How many bytes of texture were loaded onto the GPU, and
+  /// how many loads did the cache save?
+  static size_t getBytesLoaded() { return _bytesLoaded; };
+  static size_t getBytesSaved() { return _bytesSaved; };
+};
+
+class textureDecodeJob;
 
 /// \brief A manager of textures and texture files.
 ///
 ///  A class to hold a texture and take care of loading it into the
 ///  OpenGL slots where it belongs.
 ///
-class textureMgr {
+class textureMgr : public bsgRefCounted {
  private:
   GLfloat _width, _height;
 
@@ -402,23 +797,108 @@ class textureMgr {
 
   GLuint _textureBufferID;
 
+  /// The texture itself, possibly shared with other textureMgr
+  /// objects, and its key in the cache.
+  bsgPtr<sharedTexture> _shared;
+  std::string _sharedKey;
+
+  /// The sampler filters.
+  GLint _minFilter, _magFilter;
+
+  /// Whether to make mipmaps, and the most memory the texture can use
+  /// (zero means no limit).  See setMipmaps().
+  bool _mipmaps;
+  size_t _maxBytes;
+
+  /// The size of the most recently loaded texture, on the GPU.
+  size_t _bytes;
+
+  /// An image being decoded in the background, and its cache key.
+  /// See readFileAsync().
+  std::shared_ptr<textureDecodeJob> _pending;
+  std::string _pendingKey;
+
+  std::string _makeKey(const textureType &type, const std::string &fileName);
+  void _finishPending();
+
+  /// Loads decoded RGBA image data into a new texture.
+  GLuint _uploadImage(const unsigned char* data,
+                      const int &width, const int &height,
+                      const int &components);
+  /// Loads a mipmap chain into a new texture.
+  GLuint _uploadMipmaps(const mipmapChain &mipmaps);
   GLuint _loadPNG(const std::string imagePath);
+  GLuint _loadDDS(const std::string imagePath);
   GLuint _loadCheckerBoard (const int size, int numFields);
   GLuint _loadTTF(const std::string ttfPath); // MKE
 
  public:
-  textureMgr() { _setupDefaultNames(); };
+  textureMgr() : _textureBufferID(0), _minFilter(GL_NEAREST),
+                 _magFilter(GL_NEAREST), _mipmaps(false), _maxBytes(0),
+                 _bytes(0) {
+    _setupDefaultNames();
+  };
+  ~textureMgr() {
+    // Let go of the texture, and delete it if no one else wants it.
+    if (_shared) {
+      _shared = bsgPtr<sharedTexture>();
+      sharedTexture::purge(_sharedKey);
+    }
+  };
+
+  /// \brief Set the minification and magnification filters.
+  ///
+  /// The defaults are GL_NEAREST.  Use this before readFile().
+  void setFilters(const GLint &minFilter, const GLint &magFilter) {
+    _minFilter = minFilter;
+    _magFilter = magFilter;
+  };
+
+  /// \brief Make mipmaps for PNG textures, and use trilinear filtering.
+  ///
+  /// Textures seen from far away look better and draw faster with
+  /// mipmaps.  The mipmaps are made on the CPU when the image is
+  /// decoded (in the background, with readFileAsync()).  If maxBytes
+  /// is not zero, the biggest levels are left out until the texture
+  /// fits in that many bytes.  Use this before readFile().  Turning
+  /// mipmaps off goes back to GL_NEAREST filtering.
+  void setMipmaps(const bool &mipmaps, const size_t &maxBytes = 0) {
+    _mipmaps = mipmaps;
+    _maxBytes = maxBytes;
+    _minFilter = mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST;
+    _magFilter = mipmaps ? GL_LINEAR : GL_NEAREST;
+  };
 
   /// \brief Reads a texture from an image file.
   ///
   /// The type can be texturePNG, in which case fileName better be a
   /// PNG file name, or textureCHK, in which case you get a
-  /// checkerboard pattern, and the file name is ignored.
+  /// checkerboard pattern, and the file name is ignored.  It can also
+  /// be textureDDS, for DDS files compressed with DXT1 or DXT5 (see
+  /// textureCompressor); any mipmaps in the file are loaded too, and
+  /// are used if setMipmaps() is on.  If some
+  /// other textureMgr has already read the same file, with the same
+  /// filters, its texture is shared instead; see sharedTexture.
   void readFile(const textureType &type, const std::string &fileName);
 
+  /// \brief Reads a texture from an image file, in the background.
+  ///
+  /// Like readFile(), but the image is decoded by a pool of worker
+  /// threads, and loaded onto the GPU in the first load() after the
+  /// decoding is done.  Until then the texture is a checkerboard.
+  /// Use this to start reading a lot of images at once, so they can
+  /// be decoded in parallel while the first frames are drawn.  Only
+  /// PNG files can be read this way; other types are read right away.
+  void readFileAsync(const textureType &type, const std::string &fileName);
+
+  /// \brief Is the texture ready, or still being read in the background?
+  bool isLoaded() { return !_pending; };
+
   /// \brief Prepare the texture to be rendered.
   ///
-  /// Meant to be used during the shaderMgr.load() step.
+  /// Meant to be used during the shaderMgr.load() step.  This is also
+  /// where a texture read with readFileAsync() is loaded onto the GPU,
+  /// once it is ready.
   void load(const GLuint programID);
 
   /// \brief Call this just before the draw.
@@ -427,6 +907,9 @@ class textureMgr {
   /// during the shaderMgr.draw() step.
   void draw();
 
+  /// \brief Call this just before the draw, with a uniform cache.
+  void draw(uniformCache &uniforms);
+
   /// \brief Return the ID of the texture buffer.
   GLuint getTextureID() { return _textureBufferID; };
 
@@ -436,18 +919,140 @@ class textureMgr {
   GLfloat getHeight() { return _height; };
 };
 
+/// \brief A linked shader program, shared among shaderMgr objects.
+///
+/// Scenes often have several shaderMgr objects made from the same
+/// shader files, differing only in their textures, and there is no
+/// reason to compile and link the same program for each one.  The
+/// shaderMgr looks in the registry here before compiling, and shares
+/// a program made from the same source text if there is one.  The
+/// text is taken after the number of lights has been edited in (see
+/// shaderMgr::addShader()), so shaders with different numbers of
+/// lights do not share.  The uniform values belong to the program, so
+/// they are kept here too, while each shaderMgr keeps its own lights
+/// and texture.
+///
+/// A program stays registered as long as some shaderMgr is using it.
+///
+/// Linked programs can also be kept on disk, so the next run of the
+/// program can skip compiling; see setBinaryCacheDir().
+class shaderProgram : public bsgRefCounted {
+ private:
+  GLuint _programID;
+
+  /// The uniform values we've loaded into the program.
+  uniformCache _uniforms;
+
+  // This is a pointer so the registry is never destroyed at exit,
+  // when there may be no GL context left to take the programs back.
+  static std::map<std::string, bsgPtr<shaderProgram> > *_registry;
+  static bool _enabled;
+  static int _nLinked, _nShared;
+
+  /// The on-disk cache of program binaries.
+  static std::string _binaryCacheDir;
+  static int _nBinaryHits, _nBinaryMisses;
+  static double _binaryTimeSaved;
+
+  static std::string _binaryFileName(const std::string &binaryKey);
+
+ public:
+  shaderProgram(const GLuint &programID) : _programID(programID) {};
+  ~shaderProgram() { glDeleteProgram(_programID); };
+
+  GLuint getProgram() { return _programID; };
+  uniformCache &getUniforms() { return _uniforms; };
+
+  /// \brief Look for a program made from the given source.
+  ///
+  /// The key is the complete source text of all the shaders, so there
+  /// are no false matches.  Returns a null pointer if there is none.
+  static bsgPtr<shaderProgram> find(const std::string &key);
+
+  /// \brief Register a newly linked program.
+  static void add(const std::string &key, const bsgPtr<shaderProgram> &program);
+
+  /// \brief Drop the programs nobody is using, deleting them.
+  ///
+  /// Returns the number dropped.
+  static int purge();
+
+  /// \brief Turn the sharing on or off.  It is on by default.
+  static void setEnabled(const bool &enabled) { _enabled = enabled; };
+
+  /// \brief How many programs were linked, and how many requests for
+  /// one were satisfied by sharing one already linked?
+  static int getNumLinked() { return _nLinked; };
+  static int getNumShared() { return _nShared; };
+
+  /// \brief Keep program binaries in this directory.
+  ///
+  /// With a directory set, each newly linked program is written there
+  /// (with glGetProgramBinary), and read back instead of compiled the
+  /// next time the same shaders are used.  The binaries are keyed by
+  /// the shader text, the number of lights, and the OpenGL renderer
+  /// and version, so a driver update or a different graphics card
+  /// just causes a fresh compile.  If the driver rejects a binary
+  /// anyway, the shaders are compiled from source.  The directory
+  /// must exist already, and can be shared by several machines.  An
+  /// empty string, the default, turns the cache off.
+  static void setBinaryCacheDir(const std::string &dir) { _binaryCacheDir = dir; };
+
+  /// \brief Is the binary cache turned on, and supported?
+  static bool usingBinaryCache();
+
+  /// \brief Make the key for a program's binary.
+  static std::string makeBinaryKey(const std::string &source, const int &nLights);
+
+  /// \brief Try to load a program from the binary cache.
+  ///
+  /// Returns true if it worked, meaning the program is linked and
+  /// ready to use.
+  static bool loadBinary(const GLuint &programID, const std::string &binaryKey);
+
+  /// \brief Save a linked program in the binary cache.
+  ///
+  /// The compile time, in milliseconds, is saved along with it, so we
+  /// can tell later how much time the cache saved.
+  static void saveBinary(const GLuint &programID, const std::string &binaryKey,
+                         const double &compileTime);
+
+  /// \brief How many programs were found in the binary cache, and how
+  /// many were not?
+  static int getNumBinaryHits() { return _nBinaryHits; };
+  static int getNumBinaryMisses() { return _nBinaryMisses; };
+
+  /// \brief Roughly how many milliseconds of compiling the binary
+  /// cache has saved.
+  static double getBinaryTimeSaved() { return _binaryTimeSaved; };
+};
+
+/// \brief A set of preprocessor definitions for a shader variant.
+///
+/// Maps each name to its value, like NUM_LIGHTS to "3".  Being a map,
+/// the same set always comes out in the same order.
+typedef std::map<std::string, std::string> shaderDefines;
 
 ///  /brief A collection of shaders that work together as a shader program.
 ///
 ///  Holds the code for the pieces of a shader collection.  Use this
 ///  to add a vertex or fragment shader.  Has switches to compile
-///  them, and returns the program index when it's needed.  Controls
-///  the text of the shader to adjust to match the number of lights
-///  and so on.
-class shaderMgr {
+///  them, and returns the program index when it's needed.
+///
+///  The shader text is adjusted to match the number of lights and so
+///  on by #define lines put at the top of each shader, right after
+///  the #version line.  NUM_LIGHTS is always defined, as the number
+///  of lights in the light list.  Use addDefine() for the rest, to
+///  compile features in or out of a shader with #if or #ifdef.  Each
+///  set of definitions makes a different program, or "variant," of
+///  the same shader code.  Variants you'll want later can be declared
+///  with declareVariant(), so they are compiled at the start, and
+///  switched to with useVariant() without a pause to compile.
+class shaderMgr : public bsgRefCounted {
  private:
   /// The shader text and compilation log together are stored here,
-  /// using the GLSHADERTYPE as an index to keep them straight.
+  /// using the GLSHADERTYPE as an index to keep them straight.  The
+  /// text is as read from the file, without the definitions.
   std::vector<std::string> _shaderText;
   std::vector<std::string> _shaderFiles;
   std::vector<std::string> _shaderLog;
@@ -457,6 +1062,10 @@ class shaderMgr {
 
   GLuint _programID;
 
+  /// The compiled program, possibly shared with other shaderMgr
+  /// objects.  Also holds the uniform values.
+  bsgPtr<shaderProgram> _program;
+
   /// Tells us whether the shaders have been loaded and compiled yet.
   bool _compiled;
 
@@ -465,6 +1074,18 @@ class shaderMgr {
   bsgPtr<textureMgr> _texture;
   bool _textureLoaded;
 
+  /// The definitions for the shader text, besides NUM_LIGHTS.
+  shaderDefines _defines;
+
+  /// The variants to compile along with the main program, and the
+  /// ones compiled so far, keyed by their definitions.
+  std::vector<shaderDefines> _declaredVariants;
+  std::map<std::string, bsgPtr<shaderProgram> > _variants;
+
+  shaderDefines _allDefines(const shaderDefines &defines);
+  std::string _addDefines(const std::string &text, const shaderDefines &defines);
+  bsgPtr<shaderProgram> _compileVariant(const shaderDefines &defines);
+
   std::string _getShaderInfoLog(GLuint obj);
   std::string _getProgramInfoLog(GLuint obj);
 
@@ -489,26 +1110,57 @@ class shaderMgr {
     _textureLoaded = false;
   };
   ~shaderMgr() {
-    if (_compiled) glDeleteProgram(_programID);
+    // Let go of the programs, and delete them if no one else wants them.
+    if (_compiled) {
+      _program = bsgPtr<shaderProgram>();
+      _variants.clear();
+      shaderProgram::purge();
+    }
   }
 
 
   /// \brief Add lights to the shader.
   ///
-  /// This should be done before adding the shader code itself, unless
-  /// the shader does not depend on the number of lights.  The shader
-  /// manager class will edit any 'XX' string in the shader and
-  /// replace it with the number of lights in this list.  If your
-  /// shader ignores lighting, as many do, this will not do anything
-  /// besides issue a polite warning that the shader doesn't care.
-  void addLights(const bsgPtr<lightList> lightList);
+  /// This must be done before compiling the shaders.  The number of
+  /// lights in the list is given to the shaders as NUM_LIGHTS.  For
+  /// the sake of older shaders, the first 'XX' in a shader's text is
+  /// replaced with the number of lights instead, and NUM_LIGHTS is
+  /// left undefined in that shader.  Shaders that ignore
+  /// lighting, as many do, can ignore NUM_LIGHTS, too.
+  void addLights(const bsgPtr<lightList> &lightList);
+
+  /// \brief Define a preprocessor symbol for the shaders.
+  ///
+  /// Each shader gets a "#define name value" line at the top when it
+  /// is compiled.  This must be done before compiling the shaders.
+  /// Defining the same name again replaces its value.
+  void addDefine(const std::string &name, const std::string &value = "1");
+  void addDefine(const std::string &name, const int &value);
+
+  /// \brief Returns the definitions added with addDefine().
+  shaderDefines getDefines() { return _defines; };
+
+  /// \brief Compile another variant along with the shaders.
+  ///
+  /// The variant uses these definitions on top of the ones from
+  /// addDefine(), replacing any with the same name.  It is compiled
+  /// by compileShaders(), and kept ready for useVariant().
+  void declareVariant(const shaderDefines &defines);
+
+  /// \brief Switch to another variant of the shaders.
+  ///
+  /// The definitions work as for declareVariant().  If the variant was
+  /// not declared, or shared by another shaderMgr, it is compiled
+  /// now, which can make a noticeable pause.  An empty set goes back
+  /// to the main program.  The shaders must be compiled already.
+  void useVariant(const shaderDefines &defines);
 
   /// \brief Add a texture to the shader.
   ///
   /// This will make a single 2D texture available as an option to the
   /// fragment shader.  If you want something more elaborate, you
   /// probably don't want to be using this package.
-  void addTexture(const bsgPtr<textureMgr> texture) {
+  void addTexture(const bsgPtr<textureMgr> &texture) {
     _texture = texture;
     _textureLoaded = true;
   };
@@ -522,18 +1174,34 @@ class shaderMgr {
   /// \brief Compile and link the loaded shaders.
   ///
   /// You need to have specified at least a vertex and fragment
-  /// shader.  The geometry shader is optional.
+  /// shader.  The geometry shader is optional.  If another shaderMgr
+  /// has already compiled the same shader text with the same
+  /// definitions, its program is used instead; see shaderProgram.
+  /// Any declared variants are compiled, too.
   void compileShaders();
 
   /// Get the ID number for an attribute name that appears in a shader.
   GLuint getAttribID(const std::string &attribName);
 
+  /// \brief The location every program gives a standard attribute.
+  ///
+  /// The names used by the bsgMenagerie shapes ("position", "color",
+  /// "normal", and "texture") get the same locations in every
+  /// program, whether the program uses them or not.  Returns -1 for
+  /// any other name.
+  static GLint getStandardAttribLocation(const std::string &name);
+
   /// Get the ID number for a uniform name that appears in a shader.
   GLuint getUniformID(const std::string &unifName);
 
   /// \brief Returns the program ID of the compiled shader.
   GLuint getProgram() { return _programID; };
 
+  /// \brief Returns the ID of the shader's texture, or zero if none.
+  GLuint getTextureID() {
+    return _textureLoaded ? _texture->getTextureID() : 0;
+  };
+
   /// \brief Use this to enable the shader program.
   ///
   /// This call should appear before any of the OpenGL calls that rely
@@ -558,8 +1226,191 @@ class shaderMgr {
   ///
   /// Actually loads data like the light list to be used in the shader.
   void draw();
+
+  /// \brief Returns the uniform cache for this shader's program.
+  ///
+  /// Load uniforms through this so that unchanged values are not
+  /// uploaded again.  See uniformCache.  The cache is shared by all
+  /// the shaderMgr objects that share the program.
+  uniformCache &getUniforms() {
+    if (!_compiled) throw std::runtime_error("Shader is not compiled yet.");
+    return _program->getUniforms();
+  };
 };
 
+/// \brief A ring buffer for vertex data that changes every frame.
+///
+/// Things like wand rays and tethers that follow a tracker move every
+/// frame.  Loading their vertices the ordinary way means re-creating
+/// a buffer each time, and the driver may have to wait for the GPU to
+/// finish with the old one.  Instead, the vertices of dynamic objects
+/// (see drawableObj::setDynamic()) are written into one big shared
+/// buffer, divided into three regions.  Each frame writes into the
+/// next region, while the GPU may still be reading the previous two.
+///
+/// At the end of a frame, after its draws, a fence is set for each
+/// region the frame used, and before a region is reused we wait on
+/// its fence, which should long since have passed.  Where fences
+/// aren't available (before OpenGL 3.2 or GL_ARB_sync), the buffer is
+/// orphaned instead at the start of each frame, so the driver can
+/// hand us fresh memory, and everything is written again.
+///
+/// The scene calls nextFrame() in its load(), so if you draw without
+/// a scene, call it yourself once per frame, before loading.  If a
+/// frame writes more than a region holds, it moves on to the next
+/// region early, but it can't use more than all three.
+class streamBuffer {
+ private:
+
+  static const int _nRegions = 3;
+
+  GLuint _bufferID;
+  size_t _regionSize;
+
+  // The region being filled, and how much of it has been used.
+  int _region;
+  size_t _used;
+
+  // How many regions this frame has written, counting the current one.
+  int _regionsThisFrame;
+
+  // Counts every move to a new region.  An allocation made in frame f
+  // is good until frame f + _nRegions.  This carries on from one
+  // buffer to the next, so nothing written to a destroyed buffer
+  // looks current.
+  unsigned int _frame;
+  static unsigned int _nextFrame;
+
+  GLsync _fences[_nRegions];
+
+  // While a frame is being written, the rest of its region is mapped,
+  // starting at _mappedFrom.  It's unmapped before anything is drawn.
+  unsigned char *_mapped;
+  size_t _mappedFrom;
+
+  int _nStalls;
+  size_t _bytesStreamed;
+
+  static size_t _defaultRegionSize;
+  static streamBuffer* _streamBuffer;
+
+  streamBuffer(const size_t &regionSize);
+  ~streamBuffer();
+
+  static bool _usingFences();
+
+  // Move on to the next region, waiting for the GPU if it is still
+  // reading it.
+  void _nextRegion();
+
+ public:
+
+  /// \brief Returns the shared stream buffer, making it if necessary.
+  ///
+  /// Needs a GL context.
+  static streamBuffer* get();
+
+  /// \brief Has anyone asked for the stream buffer yet?
+  static bool inUse() { return _streamBuffer != NULL; };
+
+  /// \brief Deletes the shared stream buffer and its GL objects.
+  ///
+  /// Call this while the GL context is still current, before it is
+  /// destroyed.  If anything streams after that, get() makes a new
+  /// buffer.
+  static void destroy();
+
+  /// \brief Set the size of each of the three regions, in bytes.
+  ///
+  /// That's the most vertex data that can be streamed in one frame.
+  /// The default is 1MB.  Only meaningful before the first get().
+  static void setRegionSize(const size_t &regionSize) {
+    _defaultRegionSize = regionSize;
+  };
+
+  /// \brief Finish a frame, and move on to the next region of the ring.
+  ///
+  /// The last frame's draws must have been issued, since the fences
+  /// set here mark when the GPU is done with them.
+  void nextFrame();
+
+  /// \brief Copy some data into the current region.
+  ///
+  /// The offset of the data in the buffer is returned.  Returns false
+  /// if the data is larger than a region, or if this frame has already
+  /// filled every region, and can't be streamed.
+  bool write(const void *data, const size_t &bytes, GLintptr &offset);
+
+  /// \brief Finish the writes, so the data can be drawn.
+  ///
+  /// The region is kept mapped while it is being written, so that a
+  /// frame's worth of small writes costs only one map.  A buffer
+  /// can't be drawn from while it is mapped, so drawableObj calls this
+  /// before drawing streamed vertices.  It's cheap to call again.
+  void flush();
+
+  GLuint getBufferID() { return _bufferID; };
+  unsigned int getFrame() { return _frame; };
+  static int getNumRegions() { return _nRegions; };
+
+  /// \brief How many times did we have to wait for the GPU?
+  ///
+  /// With three regions, this should stay at zero.
+  int getNumStalls() { return _nStalls; };
+
+  /// \brief How many bytes have been written to the buffer?
+  size_t getBytesStreamed() { return _bytesStreamed; };
+};
+
+/// \brief Reorders indexed triangles to make better use of the GPU.
+///
+/// After the vertex shader runs on a vertex, the result is kept in a
+/// small cache, so a triangle whose corners were used recently is
+/// cheap to draw.  Triangles in the order they come out of a modeling
+/// program or a file use that cache poorly.  optimizeVertexCache()
+/// reorders them, using Tom Forsyth's "Linear-Speed Vertex Cache
+/// Optimisation", to reuse as many cached vertices as it can.  Then
+/// optimizeVertexFetch() renumbers the vertices in the order the
+/// triangles first use them, so the vertex data is read from memory
+/// more or less in order, too.
+///
+/// The usual measure of success is the ACMR, or average cache miss
+/// ratio: the number of vertices transformed per triangle.  It is 3
+/// with no reuse at all, and around 0.5 to 0.7 for a well-ordered
+/// regular mesh.  These work on plain vectors, so they can be used at
+/// load time or in a separate program, ahead of time.
+class meshOptimizer {
+ public:
+  /// \brief The cache misses per triangle for a list of triangles.
+  ///
+  /// This simulates a first-in, first-out cache, like most hardware.
+  static float getACMR(const std::vector<GLuint> &indices,
+                       const int &nVertices, const int &cacheSize = 16);
+
+  /// \brief Reorder a list of triangles to reuse cached vertices.
+  static void optimizeVertexCache(std::vector<GLuint> &indices,
+                                  const int &nVertices);
+
+  /// \brief Renumber the vertices in the order they are first used.
+  ///
+  /// The indices are changed, and the return value says where each
+  /// old vertex goes: remap[old] = new.  Vertices no triangle uses go
+  /// at the end.  Use reorder() to rearrange the vertex data to match.
+  static std::vector<GLuint> optimizeVertexFetch(std::vector<GLuint> &indices,
+                                                 const int &nVertices);
+
+  /// \brief Rearrange some vertex data according to a remap.
+  template <class T>
+  static std::vector<T> reorder(const std::vector<T> &data,
+                                const std::vector<GLuint> &remap) {
+    std::vector<T> out(data.size());
+    for (size_t i = 0; i < data.size(); i++) out[remap[i]] = data[i];
+    return out;
+  };
+};
+
+class drawableCollection;
+
 /// \brief The information necessary to draw an object.
 ///
 /// This object contains a set of vertices, colors, normals, texture
@@ -570,7 +1421,7 @@ class shaderMgr {
 ///
 /// All the drawableObj shapes in a compound object (see below) use the
 /// same shader, and the same model matrix.
-class drawableObj {
+class drawableObj : public bsgRefCounted {
  protected:
 
   // Specifies whether this is a triangle, a triangle strip, fan,
@@ -586,6 +1437,11 @@ class drawableObj {
   drawableObjData<glm::vec4> _normals;
   drawableObjData<glm::vec2> _uvs;
 
+  // Optional indices into the arrays above.  If there are any, the
+  // object is drawn with glDrawElements, and the count is the number
+  // of indices rather than the number of vertices.
+  drawableObjData<GLuint> _indices;
+
   std::string print() const { return std::string("drawableObj"); };
   friend std::ostream &operator<<(std::ostream &os, const drawableObj &obj);
 
@@ -603,27 +1459,191 @@ class drawableObj {
   // vertices array is not optional, so there is no vertexPos variable.
   bool _interleaved;
   GLshort _colorPos, _normalPos, _uvPos, _stride;
-  drawableObjData<float> _interleavedData;
+  drawableObjData<unsigned char> _interleavedData;
+  void _layoutInterleaved();
+  void _interleave(const size_t &first, const size_t &count);
+
+  // The interleaved data can be packed into smaller types than
+  // floats.  These are the GL types chosen for each attribute, and
+  // for packed positions, the box they are fractions of.
+  int _packing;
+  GLenum _positionType, _colorType, _normalType, _uvType;
+  glm::vec4 _packLower, _packSize;
+
+  // A box to pack the positions in, other than the bounding box.
+  bool _havePackingBox;
+  glm::vec4 _packingBoxLower, _packingBoxUpper;
+
+  // A dynamic object's vertices go through the streamBuffer rather
+  // than a buffer of their own.  This is where they are, and the
+  // frame in which they were put there.
+  bool _dynamic;
+  GLintptr _streamOffset;
+  unsigned int _streamFrame;
+  void _streamVertices();
+  void _bindStreamedVertices();
+
+  // The frozen collections this object has been merged into.  Any
+  // change to the data thaws them, since they draw a copy of it.  See
+  // drawableCollection::freeze().
+  std::vector<drawableCollection*> _frozenIn;
+  friend class drawableCollection;
+  void _changed() { if (!_frozenIn.empty()) _thaw(); };
+  void _thaw();
+
+  // Attributes that are the same for every vertex aren't arrays at
+  // all.  This is a bit for each GLDATATYPE that is constant, and its
+  // value, which is handed to glVertexAttrib4fv() at each draw.
+  int _constantData;
+  glm::vec4 _constants[4];
+  void _loadConstants();
+
+  // How many bytes of vertex data have been sent to the graphics
+  // card, whole buffers and partial updates alike.
+  static size_t _bytesLoaded;
+
+  // If the GL supports vertex array objects, the attribute bindings
+  // are recorded once into one of them during prepare(), and the draw
+  // is just a bind and a glDrawArrays.  Zero means we are using the
+  // old-fashioned enable/bind/pointer sequence for every draw.
+  GLuint _vertexArrayID;
+  static bool _useVertexArrays;
+
+  // The program this object was prepared with, or zero if it hasn't
+  // been prepared yet.  An object can be shared among several compound
+  // objects, so it can be asked to prepare more than once.
+  GLuint _programID;
 
+  GLint _getAttribLocation(GLuint programID, const std::string &name);
   void _getAttribLocations(GLuint programID);
+  bool _sameAttribLocations(GLuint programID);
   void _prepareSeparate(GLuint programID);
   void _prepareInterleaved(GLuint programID);
+  void _prepareVertexArray();
   void _loadSeparate();
   void _loadInterleaved();
-  void _drawSeparate();
-  void _drawInterleaved();
+  template <class T>
+  void _loadWhole(drawableObjData<T> &data);
+  template <class T>
+  void _loadChanges(drawableObjData<T> &data);
+  void _loadIndices();
+  void _drawPrimitives();
+  void _bindAttributes();
+  void _unbindAttributes();
+  void _bindSeparate();
+  void _bindInterleaved();
+  void _bindInstanceAttributes(const GLuint &instanceBufferID,
+                               const GLint &matrixID,
+                               const GLint &normalMatrixID);
+  void _unbindInstanceAttributes(const GLint &matrixID,
+                                 const GLint &normalMatrixID);
+
+  // The GL objects above belong to this object and are deleted with
+  // it, so a copy would delete them a second time.  Not implemented.
+  drawableObj(const drawableObj &);
+  drawableObj &operator=(const drawableObj &);
 
  public:
  drawableObj() :
   _loadedIntoBuffer(false),
-    _interleaved(false),
     _selectable(true),
+    _haveBoundingBox(false),
     _boundingBoxMin(0.1),
-    _haveBoundingBox(false) {};
+    _interleaved(false),
+    _packing(GLPACK_NONE),
+    _packLower(0.0f),
+    _packSize(1.0f),
+    _havePackingBox(false),
+    _dynamic(false),
+    _streamOffset(0),
+    _streamFrame(0),
+    _constantData(0),
+    _vertexArrayID(0),
+    _programID(0) {};
+  ~drawableObj();
+
+  /// \brief Turn the vertex array object path on or off.
+  ///
+  /// By default, objects record their attribute bindings in a vertex
+  /// array object (GL_ARB_vertex_array_object) when the GL has them,
+  /// and fall back to binding every attribute on every draw when it
+  /// doesn't.  Use this before prepare() to force the fallback, for
+  /// example to compare the two.
+  static void setUseVertexArrays(const bool &use) { _useVertexArrays = use; };
+
+  /// \brief Are we drawing with vertex array objects?
+  ///
+  /// True if they have been requested and the GL supports them.  Only
+  /// meaningful after the GL context has been initialized.
+  static bool usingVertexArrays();
+
+  /// \brief How many bytes of vertex data have been loaded?
+  ///
+  /// This counts everything sent to the graphics card by load(), for
+  /// all objects, whether whole buffers or the changed parts of them.
+  static size_t getBytesLoaded() { return _bytesLoaded; };
 
   /// \brief Set up the buffers to be interleaved,
   void setInterleaved(bool interleaved) { _interleaved = interleaved; };
 
+  /// \brief Mark the vertices as changing every frame.
+  ///
+  /// The vertices of a dynamic object are streamed through the shared
+  /// streamBuffer, instead of living in a buffer of their own, so
+  /// changing them with updateData() every frame costs no buffer
+  /// re-creation and no waiting on the GPU.  The other attributes are
+  /// loaded the usual way.  Meant for small objects, like lines, that
+  /// move often.  Call it before prepare(), and don't combine it with
+  /// setInterleaved().
+  void setDynamic(const bool &dynamic) { _dynamic = dynamic; };
+  bool isDynamic() { return _dynamic; };
+
+  /// \brief Store the vertex data in smaller types.
+  ///
+  /// Pass a combination of the GLPACKING values.  Packing only works
+  /// with the interleaved layout, so this turns interleaving on.
+  /// Where the GL can't read a packed type, the attribute is stored
+  /// some other way: 10-bit normals become bytes, and half float
+  /// texture coordinates stay floats.  Call it before prepare().
+  ///
+  /// Packed positions are fractions of the bounding box, and the
+  /// compound object folds the box into the model matrix when it
+  /// draws, so the shader has to use the model matrix.  That can't be
+  /// done when drawableInstanced has the GL do the instancing, so
+  /// drawableInstanced::prepare() turns off GLPACK_POSITIONS for its
+  /// objects.
+  void setPacking(const int &packing) {
+    _packing = packing;
+    if (packing != GLPACK_NONE) _interleaved = true;
+  };
+
+  /// \brief Returns the GLPACKING values in use.
+  int getPacking() { return _packing; };
+
+  /// \brief Pack the positions in some box other than the bounding box.
+  ///
+  /// Objects that share vertices, like the faces of a cube, should
+  /// pack their positions in the same box.  Otherwise the shared
+  /// vertices round differently, and there are cracks along the
+  /// seams.  The box is stretched to fit the bounding box, if
+  /// necessary.
+  void setPackingBox(const glm::vec4 &lower, const glm::vec4 &upper) {
+    _havePackingBox = true;
+    _packingBoxLower = lower;
+    _packingBoxUpper = upper;
+  };
+
+  /// \brief Turns packed positions back into model coordinates.
+  ///
+  /// The identity, unless the positions are packed, in which case it
+  /// maps the unit cube onto the bounding box they were packed in.
+  /// Apply it before the model matrix.
+  glm::mat4 getPositionMatrix() {
+    if (!_interleaved || !(_packing & GLPACK_POSITIONS)) return glm::mat4(1.0f);
+    return glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(_packLower)),
+                      glm::vec3(_packSize));
+  };
+
   /// \brief Specify the draw type of the shape.
   ///
   /// This refers to the OpenGL primitive draw types.  You can read
@@ -633,16 +1653,19 @@ class drawableObj {
   /// http://www.falloutsoftware.com/tutorials/gl/gl3.htm
   void setDrawType(const GLenum drawType) {
     _drawType = drawType;
-    _count = _vertices.size();
+    _count = _indices.empty() ? _vertices.size() : _indices.size();
+    _changed();
   };
 
   /// \brief Specify the draw type and the vertex count.
   ///
   /// The count refers here to the number of vertices, *not* the
-  /// number of triangles, line segments, quads, whatever.
+  /// number of triangles, line segments, quads, whatever.  For an
+  /// indexed object, it is the number of indices.
   void setDrawType(const GLenum drawType, const GLsizei count) {
     _drawType = drawType;
     _count = count;
+    _changed();
   };
 
   /// \brief Set bounding box minimum dimension.
@@ -672,6 +1695,24 @@ class drawableObj {
                const std::string &name,
                const std::vector<glm::vec2> &data);
 
+  /// \brief Use one value for every vertex.
+  ///
+  /// When all the colors (or normals, or texture coordinates) of an
+  /// object are the same, there is no need to store one per vertex.
+  /// This gives the shader attribute a constant value instead of an
+  /// array, which saves the buffer space and the bandwidth of reading
+  /// it.  Texture coordinates use the first two components of the
+  /// value.  Vertices can't be constant.  Adding ordinary data of the
+  /// same type replaces the constant.
+  void addConstantData(const GLDATATYPE type,
+                       const std::string &name,
+                       const glm::vec4 &value);
+
+  /// \brief Is this kind of data constant?
+  bool isConstantData(const GLDATATYPE type) {
+    return (_constantData & (1 << type)) != 0;
+  };
+
   /// \brief Change the underlying data of an object.
   ///
   /// Use this to reset the vec4 data inside an object.
@@ -682,6 +1723,59 @@ class drawableObj {
   /// Use this to reset the vec2 data inside an object.
   void setData(const GLDATATYPE type, const std::vector<glm::vec2>& data);
 
+  /// \brief Change some of the vec4 data of an object.
+  ///
+  /// This replaces data.size() entries, starting with entry first.
+  /// Unlike setData(), only the entries changed are sent to the
+  /// graphics card at the next load(), so small edits to big objects,
+  /// like moving a few points of a large point cloud, are cheap.
+  /// Changes to neighboring entries are sent together.  The entries
+  /// must already exist; use setData() to change the size.
+  void updateData(const GLDATATYPE type, const size_t &first,
+                  const std::vector<glm::vec4>& data);
+
+  /// \brief Change some of the texture coordinates of an object.
+  ///
+  /// Just like the vec4 version, but for vec2 texture coordinates.
+  void updateData(const GLDATATYPE type, const size_t &first,
+                  const std::vector<glm::vec2>& data);
+
+  /// \brief Draw the object using an index array.
+  ///
+  /// Each index refers to one entry in each of the vertex, color,
+  /// normal, and texture coordinate arrays, so shared vertices only
+  /// need to appear in those arrays once.  This works with both the
+  /// separate and interleaved buffer layouts.  The draw count is set
+  /// to the number of indices.
+  void setIndices(const std::vector<GLuint> &indices);
+
+  /// \brief Returns a copy of the vertex, color, or normal data.
+  ///
+  /// Constant data is returned as one copy of the value per vertex.
+  std::vector<glm::vec4> getData(const GLDATATYPE type);
+
+  /// \brief Returns the shader attribute name of some data.
+  std::string getDataName(const GLDATATYPE type);
+
+  /// \brief Returns a copy of the texture coordinates.
+  std::vector<glm::vec2> getTexCoords();
+
+  /// \brief Reorder the triangles and vertices for the vertex cache.
+  ///
+  /// This uses the meshOptimizer to rearrange an indexed list of
+  /// GL_TRIANGLES, and the vertex data to match.  It does nothing to
+  /// other kinds of object.  The picture is the same, only faster.
+  void optimizeVertexCache();
+
+  /// \brief Returns a copy of the indices, if there are any.
+  std::vector<GLuint> getIndices() { return _indices.getData(); };
+
+  /// \brief Returns the OpenGL primitive type.
+  GLenum getDrawType() { return _drawType; };
+
+  /// \brief Returns the number of vertices (or indices) drawn.
+  GLsizei getCount() { return _count; };
+
   /// \brief Set whether the object is selectable.
   ///
   /// Often used for things like axes that you probably don't want to
@@ -738,10 +1832,24 @@ class drawableObj {
 
   /// \brief This is the actual step of drawing the object.
   ///
-  /// The method binds each OpenGL buffer, then enables the arrays.
-  /// We assume the data we want to draw is already in the buffer, via
+  /// The method binds each OpenGL buffer, then enables the arrays, or
+  /// just binds the vertex array object that remembers all that.  We
+  /// assume the data we want to draw is already in the buffer, via
   /// the load() method.
   void draw();
+
+  /// \brief Draw many copies of the object in one call.
+  ///
+  /// This is for the use of drawableInstanced.  The instance buffer
+  /// holds a pair of mat4 values for each instance: a model matrix
+  /// and its inverse transpose, for the normals.  They are fed to the
+  /// shader as per-instance mat4 attributes at the given locations.
+  /// The attributes are only enabled for the duration of this draw, so
+  /// the same object can still be drawn the usual way elsewhere.
+  void drawInstanced(const GLsizei &instanceCount,
+                     const GLuint &instanceBufferID,
+                     const GLint &matrixID,
+                     const GLint &normalMatrixID);
 };
 
 /// \brief The name of an object as it exists in the scene hierarchy.
@@ -767,10 +1875,208 @@ class bsgName : public std::list<std::string> {
 /// hierarchy of the scene graph.
 typedef std::list<bsgName> bsgNameList;
 
+/// \brief The number of a name in the bsgNameTable.
+typedef int bsgNameID;
+
+/// \brief A table of interned names.
+///
+/// Each name given to a member of a drawableCollection is kept here
+/// once, and is known inside the scene graph by its number, so names
+/// can be hashed and compared as ints.  Names are never taken out of
+/// the table.  Like the rest of the scene graph, this is not meant to
+/// be used from more than one thread.
+class bsgNameTable {
+ private:
+  // These are pointers so they exist whenever the first name is
+  // added, even by a collection that is constructed statically.
+  static std::unordered_map<std::string, bsgNameID> *_ids;
+  static std::vector<std::string> *_names;
+
+ public:
+  /// \brief The number for a name, adding it to the table if needed.
+  static bsgNameID intern(const std::string &name);
+
+  /// \brief The number for a name, or -1 if it isn't in the table.
+  ///
+  /// Use this for lookups, so asking about a name that nothing has
+  /// doesn't add it to the table.
+  static bsgNameID find(const std::string &name);
+
+  /// \brief The name with the given number.
+  static const std::string &getString(const bsgNameID &id);
+
+  /// \brief How many names are in the table?
+  static int getNumNames() { return _names ? _names->size() : 0; };
+};
+
+/// \brief A compact bsgName, made of interned name numbers.
+///
+/// This is what the scene graph uses inside to name objects in the
+/// hierarchy, since it is cheap to copy, build, and compare.  Paths
+/// of up to six levels, which is almost all of them, don't use the
+/// heap at all.  Use getName() to get a readable bsgName.
+class bsgPath {
+ private:
+  static const int _localSize = 6;
+  int _size;
+  bsgNameID _local[_localSize];
+
+  /// The whole path, once it is too long for _local.
+  std::vector<bsgNameID> _more;
+
+  friend std::ostream &operator<<(std::ostream &os, const bsgPath &path) {
+    return os << path.getName();
+  }
+
+ public:
+  bsgPath() : _size(0) {};
+
+  /// \brief Makes a path from a readable name.
+  ///
+  /// Names that aren't in the bsgNameTable become -1, which matches
+  /// nothing.
+  explicit bsgPath(const bsgName &name);
+
+  int size() const { return _size; };
+  bool empty() const { return _size == 0; };
+
+  bsgNameID operator[](const int &i) const {
+    return (_size > _localSize) ? _more[i] : _local[i];
+  };
+
+  bool operator==(const bsgPath &other) const;
+  bool operator!=(const bsgPath &other) const { return !(*this == other); };
+
+  void push_back(const bsgNameID &id);
+  void pop_back();
+  void clear() { _size = 0; _more.clear(); };
+
+  /// \brief Returns the readable version of the path.
+  bsgName getName() const;
+
+  /// \brief Adds the readable version of the path to a bsgName.
+  void appendTo(bsgName &name) const;
+
+  /// \brief Returns the readable versions of a bunch of paths.
+  static bsgNameList getNames(const std::vector<bsgPath> &paths);
+};
+
+/// \brief A handle for a member of a drawableCollection.
+///
+/// Ask a collection for a member's handle with getHandle(), once
+/// the member has been added.  The handle is a quicker way than the
+/// name to get at the member again: no strings are compared.  A
+/// handle stays good until its member is deleted, no matter what
+/// else comes and goes, and after that it just doesn't find
+/// anything.  The bottom 24 bits pick a slot in the collection,
+/// and the 7 above them count how many times that slot has been
+/// reused.  A slot that has been used 128 times is retired rather
+/// than reused again, so an old handle can never come to match a
+/// new member.
+typedef int bsgHandle;
+
+/// \brief Transforms for many nodes at once, kept as arrays.
+///
+/// The scene graph objects each keep their own position, scale, and
+/// orientation, and work out their model matrices one at a time.
+/// That's fine for a few hundred objects, but for thousands of nodes
+/// that all move every frame, use one of these instead.  The
+/// positions, orientations, and scales of all the nodes are kept in
+/// separate arrays, and update() works out the world matrices of all
+/// of them in one pass, four nodes at a time with SSE2 where it is
+/// available.  The results are the same either way, up to rounding.
+///
+/// Each node can have a parent, which must be added before it, so
+/// going through the nodes in order always finds a parent's matrix
+/// ready before its children's.  The world matrices are kept as
+/// affine 3x4 matrices, the top three rows of a 4x4 matrix.  Use
+/// getWorldMatrix() for a glm::mat4, or setInstances() to hand them
+/// all to a drawableInstanced object.
+class transformStore {
+ private:
+  std::vector<int> _parents;
+
+  std::vector<float> _px, _py, _pz;
+  std::vector<float> _qx, _qy, _qz, _qw;
+  std::vector<float> _sx, _sy, _sz;
+
+  /// Twelve floats per node, the rows one after another.
+  std::vector<float> _world;
+
+  static bool _useSIMD;
+
+  /// Works out the local matrix of node i, into its place in _world.
+  void _local(const int &i);
+
+  /// Replaces node i's matrix in _world with its parent's times it.
+  void _compose(const int &i);
+
+ public:
+  transformStore() {};
+
+  /// \brief Add a node, with an identity transform.
+  ///
+  /// The parent is the index of a node already added, or -1 for a
+  /// node at the top.  Returns the index of the new node.
+  int addNode(const int &parent = -1);
+
+  int getNumNodes() const { return _parents.size(); };
+  int getParent(const int &i) const { return _parents[i]; };
+
+  /// \brief Set the position of a node, relative to its parent.
+  void setPosition(const int &i, const glm::vec3 &position) {
+    _px[i] = position.x; _py[i] = position.y; _pz[i] = position.z;
+  };
+  /// \brief Set the scale of a node.
+  void setScale(const int &i, const glm::vec3 &scale) {
+    _sx[i] = scale.x; _sy[i] = scale.y; _sz[i] = scale.z;
+  };
+  /// \brief Set the rotation of a node with a quaternion.
+  void setOrientation(const int &i, const glm::quat &orientation) {
+    _qx[i] = orientation.x; _qy[i] = orientation.y;
+    _qz[i] = orientation.z; _qw[i] = orientation.w;
+  };
+  /// \brief Set the rotation of a node with Euler angles.
+  ///
+  /// Uses a 3-vector of (pitch, yaw, roll) in radians.
+  void setRotation(const int &i, const glm::vec3 &pitchYawRoll) {
+    setOrientation(i, glm::quat(pitchYawRoll));
+  };
+
+  glm::vec3 getPosition(const int &i) const {
+    return glm::vec3(_px[i], _py[i], _pz[i]);
+  };
+  glm::vec3 getScale(const int &i) const {
+    return glm::vec3(_sx[i], _sy[i], _sz[i]);
+  };
+  glm::quat getOrientation(const int &i) const {
+    return glm::quat(_qw[i], _qx[i], _qy[i], _qz[i]);
+  };
+
+  /// \brief Work out the world matrices of all the nodes.
+  ///
+  /// Call this after changing the nodes, and before asking for their
+  /// matrices.
+  void update();
+
+  /// \brief The world matrix of a node, as of the last update().
+  glm::mat4 getWorldMatrix(const int &i) const;
+
+  /// \brief The world matrix of a node as twelve floats.
+  ///
+  /// This is the top three rows of the matrix, one row after another.
+  const float* getWorldAffine(const int &i) const { return &_world[12 * i]; };
+
+  /// \brief Use SSE2 for update(), if available.  On by default.
+  static void setUseSIMD(const bool &useSIMD) { _useSIMD = useSIMD; };
+};
+
 /// \brief A list of drawableObjs.
 /// Use this type to keep all of the drawableObjs in a compound object
 typedef std::list<bsgPtr<drawableObj> > DrawableObjList;
 
+class bsgRenderQueue;
+
 /// \brief An abstract class to handle transformation matrices.
 ///
 /// This class is the common root of drawableCompound and
@@ -787,7 +2093,7 @@ typedef std::list<bsgPtr<drawableObj> > DrawableObjList;
 /// orientation, and scale parameters) with all the model matrices of
 /// the parents above it.
 ///
-class drawableMulti {
+class drawableMulti : public bsgRefCounted {
  protected:
 
   // Do not use a smart pointer here.  Since it is not a copy of
@@ -809,14 +2115,46 @@ class drawableMulti {
   glm::mat4 _modelMatrix;
   bool _modelMatrixNeedsReset;
 
+  /// The model matrix times those of all the parents, and its
+  /// inverse, with flags to say whether they must be recalculated.
+  /// The world matrix is marked stale whenever this object or any of
+  /// its parents moves, so an object whose world matrix is stale has
+  /// stale ones all the way down.
+  glm::mat4 _worldMatrix;
+  bool _worldMatrixNeedsReset;
+  glm::mat4 _inverseWorldMatrix;
+  bool _inverseWorldMatrixNeedsReset;
+
   void _init() {
     _position = glm::vec3(0.0f, 0.0f, 0.0f);
     _scale = glm::vec3(1.0f, 1.0f, 1.0f);
     // The glm::quat constructor initializes orientation to be zero
     // rotation by default, so need not be mentioned here.
     _modelMatrixNeedsReset = true;
+    _worldMatrixNeedsReset = true;
+    _inverseWorldMatrixNeedsReset = true;
+  };
+
+  /// How many collections are frozen.  While there are none, there is
+  /// no one above to tell about changes.
+  static int _nFrozen;
+
+  /// Called when something in or below this object changes that a
+  /// frozen collection above would have merged.  This passes the news
+  /// up, so the collection can thaw.  See drawableCollection::freeze().
+  virtual void _memberChanged() { if (_parent) _parent->_memberChanged(); };
+
+  /// Called when the position, scale, or orientation changes.
+  void _moved() {
+    _modelMatrixNeedsReset = true;
+    invalidateWorldMatrix();
+    if (_nFrozen && _parent) _parent->_memberChanged();
   };
 
+  /// Passes invalidateWorldMatrix() on to the objects below this one,
+  /// or to anything else that depends on the world matrix.
+  virtual void _invalidateChildren() {};
+
  public:
  drawableMulti() : _parent(0), _name("") { _init(); };
  drawableMulti(std::string name) : _parent(0), _name(name) { _init(); };
@@ -826,7 +2164,10 @@ class drawableMulti {
   ///
   /// Our scene graph is doubly connected in order to provide the
   /// correct nested transformation from model space to world space.
-  void setParent(drawableMulti* p) { _parent = p; }
+  void setParent(drawableMulti* p) {
+    _parent = p;
+    invalidateWorldMatrix();
+  }
 
   /// \brief Set the name of this object.
   void setName(const std::string name) { _name = name; };
@@ -837,14 +2178,32 @@ class drawableMulti {
   /// \brief Calculate the model matrix.
   ///
   /// Uses the current position, rotation, and scale to calculate a
-  /// new model matrix.  There is an internal flag used to set whether
-  /// the model matrix needs to be recalculated or not.
+  /// new model matrix, and multiplies it by the parents' matrices.
+  /// The result is kept until something changes, so asking again
+  /// when nothing has moved costs nothing.
   glm::mat4 getModelMatrix();
 
+  /// \brief The inverse of the model matrix.
+  ///
+  /// This takes world coordinates to this object's coordinates.  Like
+  /// the model matrix, it is kept until something moves.
+  glm::mat4 getInverseModelMatrix();
+
+  /// \brief Forget the model matrix of this object and all below it.
+  ///
+  /// This happens by itself when this object or a parent moves, so
+  /// you shouldn't need to call it.
+  void invalidateWorldMatrix() {
+    // If it's already stale, so is everything below.
+    if (_worldMatrixNeedsReset) return;
+    _worldMatrixNeedsReset = true;
+    _invalidateChildren();
+  };
+
     /// \brief Set the model position using a vector.
   void setPosition(glm::vec3 position) {
     _position = position;
-    _modelMatrixNeedsReset = true;
+    _moved();
   };
   /// \brief Set the model position using three floats.
   void setPosition(GLfloat x, GLfloat y, GLfloat z) {
@@ -853,24 +2212,24 @@ class drawableMulti {
   /// \brief Set the scale using a vector.
   void setScale(glm::vec3 scale) {
     _scale = scale;
-    _modelMatrixNeedsReset = true;
+    _moved();
   };
   /// \brief Set the scale using a single float, applied in three dimensions.
   void setScale(float scale) {
     _scale = glm::vec3(scale, scale, scale);
-    _modelMatrixNeedsReset = true;
+    _moved();
   };
   /// \brief Set the rotation with a quaternion.
   void setOrientation(glm::quat orientation) {
     _orientation = orientation;
-    _modelMatrixNeedsReset = true;
+    _moved();
   };
   /// \brief Set the rotation with Euler angles.
   ///
   /// Uses a 3-vector of (pitch, yaw, roll) in radians.
   void setRotation(glm::vec3 pitchYawRoll) {
     _orientation = glm::quat(pitchYawRoll);
-    _modelMatrixNeedsReset = true;
+    _moved();
   };
   /// \brief Set the rotation with Euler angles.
   ///
@@ -878,7 +2237,7 @@ class drawableMulti {
   /// individually, in radians.
   void setRotation(GLfloat pitch, GLfloat yaw, GLfloat roll) {
     _orientation = glm::quat(glm::vec3(pitch, yaw, roll));
-    _modelMatrixNeedsReset = true;
+    _moved();
   };
 
   /// \brief Returns the vector position.
@@ -910,6 +2269,27 @@ class drawableMulti {
     return insideBoundingBox(glm::vec4(testPoint, 1.0));
   }
 
+  /// \brief Like insideBoundingBox(), but returns paths.
+  ///
+  /// This is quicker, since no strings are involved.
+  std::vector<bsgPath> insidePaths(const glm::vec4 &testPoint) {
+    std::vector<bsgPath> out;
+    bsgPath prefix;
+    addInsidePaths(testPoint, prefix, out);
+    return out;
+  }
+
+  /// \brief Adds the paths of what contains the test point to a list.
+  ///
+  /// Each path starts with the given prefix, which is this object's
+  /// own path.  An object at the bottom of the hierarchy adds just
+  /// the prefix, if it contains the point.  The prefix is used as
+  /// scratch space, but is as it was when this returns.  This
+  /// version builds the paths from whatever insideBoundingBox()
+  /// returns, so a class that only overrides that still works.
+  virtual void addInsidePaths(const glm::vec4 &testPoint, bsgPath &prefix,
+                              std::vector<bsgPath> &out);
+
   virtual DrawableObjList getDrawableObjList() { return *(new DrawableObjList); }
 
   /// \brief Returns the names involved in this object.
@@ -922,7 +2302,7 @@ class drawableMulti {
   /// Used in drawableCollection.  If there is no name found, returns
   /// NULL.  So be wary of the return value, unless you like hunting
   /// segfaults.
-  virtual bsgPtr<drawableMulti> getObject(const std::string &name) {
+  virtual bsgPtr<drawableMulti> getObject(const std::string &) {
     return NULL;
   }
 
@@ -930,7 +2310,7 @@ class drawableMulti {
   ///
   /// Used in drawableCollection.  If there is no object found, returns
   /// NULL.  So be wary of segfaults.
-  virtual bsgPtr<drawableMulti> getObject(bsgName name) {
+  virtual bsgPtr<drawableMulti> getObject(bsgName) {
     return NULL;
   }
 
@@ -938,7 +2318,7 @@ class drawableMulti {
   ///
   /// Used in drawableCollection.  If there is no name found, returns
   /// NULL.  So be wary of segfaults.
-  virtual bsgPtr<drawableMulti> delObject(const std::string &name) {
+  virtual bsgPtr<drawableMulti> delObject(const std::string &) {
     return NULL;
   }
 
@@ -946,7 +2326,7 @@ class drawableMulti {
   ///
   /// Used in drawableCollection.  If there is no object found, returns
   /// NULL.  So be wary of segfaults.
-  virtual bsgPtr<drawableMulti> delObject(bsgName name) {
+  virtual bsgPtr<drawableMulti> delObject(bsgName) {
     return NULL;
   }
 
@@ -973,6 +2353,20 @@ class drawableMulti {
   virtual void draw(const glm::mat4 &viewMatrix,
                     const glm::mat4 &projMatrix) = 0;
 
+  /// \brief The bounding box of the whole object, in world space.
+  ///
+  /// Valid after load().  Returns false if the object does not know
+  /// its bounds, in which case it will never be culled.
+  virtual bool getWorldBoundingBox(glm::vec3 &, glm::vec3 &) {
+    return false;
+  };
+
+  /// \brief Adds an object to a render queue, instead of drawing it.
+  ///
+  /// Used by the scene for sorted drawing; see bsgRenderQueue.
+  /// Objects that don't know how to be sorted are just drawn in the
+  /// usual way when the queue is drawn.
+  virtual void addToQueue(bsgRenderQueue &queue);
 };
 
 
@@ -1034,6 +2428,33 @@ class drawableCompound : public drawableMulti {
   /// texture processing.
   glm::mat4 _normalMatrix;
 
+  /// The bounding box of all the component objects, in world space.
+  /// This is used for culling.  It is recalculated in load(), but
+  /// only when the world matrix has changed, or the bounding box of
+  /// one of the components.  Those are kept here, in pairs of lower
+  /// and upper corners, as of the last time.
+  bool _haveWorldBoundingBox;
+  bool _worldBoundingBoxNeedsReset;
+  glm::vec3 _worldBoundingBoxLower, _worldBoundingBoxUpper;
+  std::vector<glm::vec4> _objectBoundingBoxes;
+
+  /// Adds a box, transformed by the given matrix, to the world
+  /// bounding box.
+  void _addToWorldBoundingBox(const glm::vec4 &lower, const glm::vec4 &upper,
+                              const glm::mat4 &modelMatrix);
+
+  /// Recalculates the world bounding box from the components.
+  virtual void _findWorldBoundingBox();
+
+  /// The world bounding box moves with the world matrix.
+  void _invalidateChildren() { _worldBoundingBoxNeedsReset = true; };
+
+  /// Draws one of the component objects.  The model matrix is what's
+  /// already been loaded; objects with packed positions need a
+  /// little more than that.
+  void _drawObject(const bsgPtr<drawableObj> &obj,
+                   const glm::mat4 &modelMatrix);
+
   /// These are pairs of ways to reference the matrices that include
   /// the matrix name (used in the shader) and the ID (used in the
   /// OpenGL code).
@@ -1049,6 +2470,15 @@ class drawableCompound : public drawableMulti {
   std::string _projMatrixName;
   GLuint _projMatrixID;
 
+  /// The program the IDs above were found in.  The shader can switch
+  /// to another variant (see shaderMgr::useVariant()), whose IDs may
+  /// be different, so they are looked up again when it does.
+  GLuint _locationsProgramID;
+  virtual void _getLocations();
+  void _checkLocations() {
+    if (_pShader->getProgram() != _locationsProgramID) _getLocations();
+  };
+
   friend std::ostream &operator<<(std::ostream &os,
                                   const drawableCompound &comp) {
     return os << comp.printObj("");  }
@@ -1057,21 +2487,27 @@ class drawableCompound : public drawableMulti {
  drawableCompound(bsgPtr<shaderMgr> pShader) :
   drawableMulti(),
     _pShader(pShader),
+    _haveWorldBoundingBox(false),
+    _worldBoundingBoxNeedsReset(true),
     // Set the default names for our matrices.
     _modelMatrixName("modelMatrix"),
     _normalMatrixName("normalMatrix"),
     _viewMatrixName("viewMatrix"),
-    _projMatrixName("projMatrix") {
+    _projMatrixName("projMatrix"),
+    _locationsProgramID(0) {
     _name = randomName("obj");
   };
  drawableCompound(const std::string name, bsgPtr<shaderMgr> pShader) :
   drawableMulti(name),
     _pShader(pShader),
+    _haveWorldBoundingBox(false),
+    _worldBoundingBoxNeedsReset(true),
     // Set the default names for our matrices.
     _modelMatrixName("modelMatrix"),
     _normalMatrixName("normalMatrix"),
     _viewMatrixName("viewMatrix"),
-    _projMatrixName("projMatrix") {
+    _projMatrixName("projMatrix"),
+    _locationsProgramID(0) {
   };
 
   // The equipment to allow us to define an iterator over this class.
@@ -1115,6 +2551,7 @@ class drawableCompound : public drawableMulti {
   /// rendering with.
   void addObject(bsgPtr<drawableObj> &pObj) {
     _objects.push_back(pObj);
+    if (_nFrozen) _memberChanged();
   };
 
   /// \brief Add an object's bounding box to a compound object.
@@ -1125,6 +2562,14 @@ class drawableCompound : public drawableMulti {
   /// \brief How many objects are in this compound?
   int getNumObjects() { return _objects.size(); };
 
+  /// \brief Store the vertex data of all the pieces in smaller types.
+  ///
+  /// See drawableObj::setPacking().  The pieces pack their positions
+  /// in one box that holds them all, so there are no cracks where
+  /// they meet.  Call it after adding the pieces, and before
+  /// prepare().
+  void setPacking(const int &packing);
+
   /// \brief Returns the name of this object.
   bsgNameList getNames() { bsgNameList out; return out;}
 
@@ -1155,9 +2600,273 @@ class drawableCompound : public drawableMulti {
   /// \brief Draws an object.
   ///
   /// Just executes draw() using the given view and projection matrices.
+  /// This is drawShader() followed by drawObjects().
   void draw(const glm::mat4 &viewMatrix,
             const glm::mat4 &projMatrix);
 
+  /// \brief Sets up the shader for a draw.
+  ///
+  /// Selects the shader program and loads the lights, the texture, and
+  /// the view and projection matrices.  Objects that use the same
+  /// shader in a row only need to do this once; see bsgRenderQueue.
+  /// Set useProgram to false if the program is already in use, as it
+  /// is when the previous object had a different shader with the same
+  /// program.
+  void drawShader(const glm::mat4 &viewMatrix,
+                  const glm::mat4 &projMatrix,
+                  const bool &useProgram = true);
+
+  /// \brief Draws the component objects.
+  ///
+  /// Loads the model and normal matrices and draws.  The shader has to
+  /// be set up already, with drawShader().
+  virtual void drawObjects(const glm::mat4 &viewMatrix);
+
+  /// \brief Returns the shader used by this object.
+  bsgPtr<shaderMgr> getShader() { return _pShader; };
+
+  /// \brief The bounding box of the whole object, in world space.
+  bool getWorldBoundingBox(glm::vec3 &lower, glm::vec3 &upper);
+
+  /// \brief Adds this object to a render queue.
+  void addToQueue(bsgRenderQueue &queue);
+
+};
+
+/// \brief Many copies of the same compound object.
+///
+/// A drawableInstanced holds one set of drawableObj objects, like any
+/// drawableCompound, plus a list of instance transforms.  Each instance
+/// is drawn with the compound's model matrix times its own transform,
+/// so it behaves like a drawableCompound that appears in many places
+/// at once.  This is meant for things like the walls of a maze, where
+/// dozens of identical shapes differ only in their position and size.
+///
+/// If the GL supports instanced drawing (GL_ARB_draw_instanced and
+/// GL_ARB_instanced_arrays) and the shader has the per-instance
+/// attributes, every instance is drawn with a single draw call per
+/// component object.  The shader must declare something like:
+///
+/// \code
+/// attribute mat4 instanceMatrix;
+/// attribute mat4 instanceNormalMatrix;
+/// \endcode
+///
+/// and apply them after the model and normal matrices.  See
+/// instancedTextureShader.vp.  Otherwise, each instance is drawn in
+/// turn with its own model and normal matrix uniforms, which works
+/// with any shader that works with drawableCompound.
+///
+/// The bounding box queries work per instance.  See
+/// insideInstanceBoundingBox().
+class drawableInstanced : public drawableCompound {
+ protected:
+
+  /// The instance transforms, relative to this object's model matrix.
+  std::vector<glm::mat4> _instances;
+  bool _instancesChanged;
+
+  /// The buffer that holds the instance transforms and their inverse
+  /// transposes, interleaved, for the shader.
+  GLuint _instanceBufferID;
+
+  std::string _instanceMatrixName;
+  GLint _instanceMatrixID;
+
+  std::string _instanceNormalMatrixName;
+  GLint _instanceNormalMatrixID;
+
+  /// Are we using the hardware instancing path?  Decided in prepare().
+  bool _instanced;
+
+  void _init();
+
+  /// The world bounding box has to hold all the instances.
+  void _findWorldBoundingBox();
+
+  /// Looks up the instance matrix attributes, too.
+  void _getLocations();
+
+ public:
+  drawableInstanced(bsgPtr<shaderMgr> pShader) : drawableCompound(pShader) {
+    _name = randomName("instanced");
+    _init();
+  };
+  drawableInstanced(const std::string name, bsgPtr<shaderMgr> pShader) :
+    drawableCompound(name, pShader) {
+    _init();
+  };
+  ~drawableInstanced();
+
+  /// \brief Use the component objects of another compound object.
+  ///
+  /// This is the easy way to instance one of the bsgMenagerie shapes.
+  /// Only the component objects are used, not the other object's
+  /// position, scale, or orientation.
+  void addObjects(drawableCompound &compound);
+
+  /// \brief Set the attribute names used in the shader.
+  ///
+  /// The defaults are "instanceMatrix" and "instanceNormalMatrix".
+  void setInstanceMatrixNames(const std::string &matrixName,
+                              const std::string &normalMatrixName) {
+    _instanceMatrixName = matrixName;
+    _instanceNormalMatrixName = normalMatrixName;
+  };
+
+  /// \brief Add an instance with the given transform.
+  ///
+  /// Returns the index of the new instance.
+  int addInstance(const glm::mat4 &transform);
+
+  /// \brief Add an instance at a position, with a scale.
+  int addInstance(const glm::vec3 &position, const glm::vec3 &scale) {
+    return addInstance(glm::scale(glm::translate(glm::mat4(1.0f), position),
+                                  scale));
+  };
+
+  /// \brief Change the transform of an instance.
+  void setInstance(const int &i, const glm::mat4 &transform) {
+    _instances[i] = transform;
+    _instancesChanged = true;
+    _worldBoundingBoxNeedsReset = true;
+  };
+
+  /// \brief Use the world matrices of a transformStore as the instances.
+  ///
+  /// There is one instance for each node in the store, with the
+  /// matrix from its last update().  Call this again whenever the
+  /// store changes.
+  void setInstances(const transformStore &store);
+
+  /// \brief Returns the transform of an instance.
+  glm::mat4 getInstance(const int &i) { return _instances[i]; };
+
+  /// \brief How many instances are there?
+  int getNumInstances() { return _instances.size(); };
+
+  /// \brief Returns the complete model matrix of one instance.
+  ///
+  /// That is, the model matrix of this object, including all its
+  /// parents, times the instance transform.
+  glm::mat4 getInstanceModelMatrix(const int &i) {
+    return getModelMatrix() * _instances[i];
+  };
+
+  /// \brief Which instances contain the test point?
+  ///
+  /// Returns the indices of all the instances for which the test
+  /// point is inside the bounding box of one of the component
+  /// objects.  The test is done in world space.
+  std::vector<int> insideInstanceBoundingBox(const glm::vec4 &testPoint);
+
+  /// \brief Is a given test point within the bounding box of any instance?
+  ///
+  /// Returns this object's name if any instance contains the point,
+  /// and an empty list if none does.  Use insideInstanceBoundingBox()
+  /// to find out which instances.
+  bsgNameList insideBoundingBox(const glm::vec4 &testPoint);
+
+  /// \brief Adds the prefix, which is our own path, if any instance
+  /// contains the test point.
+  void addInsidePaths(const glm::vec4 &testPoint, bsgPath &prefix,
+                      std::vector<bsgPath> &out);
+
+  /// \brief A printable representation of the object.
+  std::string printObj(const std::string &prefix) const {
+    return prefix + "<drawableInstanced:" + _name + ">"; }
+
+  /// \brief Gets ready for the drawing sequence.
+  void prepare();
+
+  /// \brief Loads the component objects and the instance transforms.
+  void load();
+
+  /// \brief Draws all the instances.
+  ///
+  /// The shader has to be set up already, with drawShader().
+  void drawObjects(const glm::mat4 &viewMatrix);
+};
+
+/// \brief A list of objects to draw, sorted to avoid state changes.
+///
+/// Drawing the scene graph in order means drawing the objects in the
+/// order of their names, which are often random.  Each compound
+/// object selects its shader, loads its lights and binds its texture,
+/// even if the object drawn just before it did exactly the same
+/// thing.  The render queue collects the compound objects of a scene,
+/// sorts them by shader program, texture, and geometry, and then
+/// sets up each shader only once for the whole run of objects that
+/// use it.
+///
+/// Sorting changes the order in which objects are drawn, so this is
+/// not for scenes that depend on that order, such as ones that use
+/// blending for transparency.  See scene::setSortedDraw().
+class bsgRenderQueue {
+ private:
+
+  /// One compound object, with the things we sort it on.
+  struct drawItem {
+    drawableCompound* compound;
+    shaderMgr* shader;
+    GLuint programID;
+    GLuint textureID;
+    drawableObj* geometry;
+
+    bool operator<(const drawItem &item) const {
+      if (programID != item.programID) return programID < item.programID;
+      if (textureID != item.textureID) return textureID < item.textureID;
+      if (shader != item.shader) return shader < item.shader;
+      return geometry < item.geometry;
+    };
+  };
+
+  std::vector<drawItem> _items;
+
+  /// Objects that can't be sorted, drawn in the usual way after the
+  /// sorted ones.
+  std::vector<drawableMulti*> _others;
+
+  /// Counts from the most recent draw.
+  int _stateChanges;
+  int _stateChangesSaved;
+  int _programChanges;
+
+  /// Objects outside this are left out of the queue.
+  bsgFrustum _frustum;
+
+ public:
+  bsgRenderQueue() : _stateChanges(0), _stateChangesSaved(0), _programChanges(0) {};
+
+  /// \brief Sets the frustum used to cull objects added to the queue.
+  void setFrustum(const bsgFrustum &frustum) { _frustum = frustum; };
+  const bsgFrustum &getFrustum() { return _frustum; };
+
+  /// \brief Empties the queue.
+  void clear() { _items.clear(); _others.clear(); };
+
+  /// \brief Adds a compound object to be sorted and drawn.
+  void add(drawableCompound* compound);
+
+  /// \brief Adds some other object, to be drawn without sorting.
+  void addOther(drawableMulti* multi) { _others.push_back(multi); };
+
+  /// \brief Sorts the queue and draws everything in it.
+  void draw(const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix);
+
+  /// \brief How many shader set-ups were done in the last draw?
+  ///
+  /// Each one is a glUseProgram (if the program changed), plus the
+  /// light, texture and view and projection matrix uploads.
+  int getStateChanges() const { return _stateChanges; };
+
+  /// \brief How many shader set-ups did sorting save in the last draw?
+  ///
+  /// That is, compared with drawing each object separately.
+  int getStateChangesSaved() const { return _stateChangesSaved; };
+
+  /// \brief How many of the shader set-ups needed a glUseProgram?
+  int getProgramChanges() const { return _programChanges; };
 };
 
 /// \brief A collection of drawable objects.
@@ -1189,9 +2898,85 @@ class drawableCollection : public drawableMulti {
 
   /// We use a pointer to the drawableCompound objects so you can
   /// create an object that inherits from drawableCompound and still
-  /// use it here.
-  typedef std::map<std::string, bsgPtr<drawableMulti> > CollectionMap;
-  CollectionMap _collection;
+  /// use it here.  The members are kept in one dense array, along
+  /// with their names, so drawing and loading just walk down it.
+  /// Deleting a member moves the last one into its place, so the
+  /// order is the order of addition until something is deleted.
+  typedef std::pair<std::string, bsgPtr<drawableMulti> > CollectionMember;
+  typedef std::vector<CollectionMember> CollectionList;
+  CollectionList _collection;
+
+  /// The slot and the interned name of each member of _collection,
+  /// in the same order.
+  std::vector<int> _memberSlots;
+  std::vector<bsgNameID> _memberIDs;
+
+  /// For each slot, the place of its member in _collection, or -1
+  /// if the slot is free, and how many times it has been reused.  A
+  /// handle is a slot and a reuse count; see bsgHandle.
+  std::vector<int> _slotPlaces;
+  std::vector<int> _slotGenerations;
+  std::vector<int> _freeSlots;
+
+  /// Finds the handle for an interned name.
+  typedef std::unordered_map<bsgNameID, bsgHandle> CollectionIndex;
+  CollectionIndex _index;
+
+  /// The place in _collection of the member with this handle, or -1.
+  int _findHandle(const bsgHandle &handle) const;
+
+  /// The place in _collection of the member with this name, or -1.
+  int _findName(const std::string &name) const;
+  int _findID(const bsgNameID &id) const;
+
+  /// Takes the member at this place out of the collection.
+  bsgPtr<drawableMulti> _removeMember(const int &place);
+
+  /// Add the names or paths of everything under this collection to a
+  /// list, each starting with the given prefix.  The names are made
+  /// as they are found, since a long list of paths in between turns
+  /// out to cost more than it saves.
+  void _addNames(bsgPath &prefix, bsgNameList &out);
+  void _addPaths(bsgPath &prefix, std::vector<bsgPath> &out);
+
+  /// The bounding box of all the members, in world space.  This is
+  /// recalculated in load().  If any member doesn't know its bounds,
+  /// neither do we.
+  bool _haveWorldBoundingBox;
+  glm::vec3 _worldBoundingBoxLower, _worldBoundingBoxUpper;
+
+  /// A frozen collection draws these instead of its members: the
+  /// merged objects, followed by the ones that couldn't be merged.
+  /// See freeze().  They are prepared in prepare(), or in load() if
+  /// they came along later.
+  bool _frozen;
+  bool _frozenNeedPrepare;
+  std::vector<bsgPtr<drawableMulti> > _frozenObjects;
+
+  /// The drawableObj objects that were merged, each listed once.  A
+  /// change to any of them thaws the collection.
+  std::vector<bsgPtr<drawableObj> > _mergedObjects;
+
+  /// Thaws this collection, and any frozen ones above it.
+  void _memberChanged();
+
+  /// The members' world matrices depend on ours.
+  void _invalidateChildren();
+
+  /// Loads a member, and adds its box to the world bounding box.
+  void _loadMember(const bsgPtr<drawableMulti> &pMultiObject, bool &haveBox);
+
+  /// Whether this collection culls its members.
+  bool _culling;
+
+  /// How many of this collection's members were culled or drawn since
+  /// the last load().
+  int _nCulled;
+  int _nDrawn;
+
+  /// Should this member be drawn, given the frustum?  Keeps count.
+  bool _visible(const bsgPtr<drawableMulti> &pMultiObject,
+                const bsgFrustum &frustum);
 
   friend std::ostream &operator<<(std::ostream &os,
                                   const drawableCollection &coll) {
@@ -1206,11 +2991,17 @@ class drawableCollection : public drawableMulti {
   /// \brief A constructor with a specified name for the collection.
   drawableCollection(const std::string name);
 
+  /// Thaws the collection, so the merged objects forget about it.
+  ~drawableCollection() { unfreeze(); };
+
   // The equipment to allow us to define an iterator over this class.
   // The iterators are each a std::pair with a name and a pointer to a
-  // drawableMulti object.
-  typedef CollectionMap::iterator iterator;
-  typedef CollectionMap::const_iterator const_iterator;
+  // drawableMulti object.  Adding or deleting members invalidates
+  // them.  The members are not in order by name: they come in the
+  // order they were added, except that deleting one moves the last
+  // member into its place.
+  typedef CollectionList::iterator iterator;
+  typedef CollectionList::const_iterator const_iterator;
 
   /// \brief Returns an iterator to the first element of the object.
   iterator begin() { return _collection.begin(); }
@@ -1264,15 +3055,54 @@ class drawableCollection : public drawableMulti {
   /// careful.
   bsgPtr<drawableMulti> getObject(bsgName name);
 
+  /// \brief Retrieve an object by handle.
+  ///
+  /// This is the quick way to get at a member you will need often.
+  /// Returns NULL if the member has been deleted.
+  bsgPtr<drawableMulti> getObject(const bsgHandle &handle);
+
+  /// \brief Retrieve an object by path.
+  ///
+  /// Works like getObject(bsgName), but without comparing strings.
+  /// Returns NULL if no match.
+  bsgPtr<drawableMulti> getObject(const bsgPath &path);
+
+  /// \brief Remove an object by handle.
+  ///
+  /// Returns a pointer to the removed object, or NULL if there was
+  /// none.  The handle doesn't find anything after this.
+  bsgPtr<drawableMulti> delObject(const bsgHandle &handle);
+
+  /// \brief The handle for a member's name.
+  ///
+  /// Returns -1 if there is no member by that name.
+  bsgHandle getHandle(const std::string &name) const;
+
+  /// \brief How many members are there?
+  int getNumObjects() const { return _collection.size(); };
+
   /// \brief Return a list of object names in the collection.
+  ///
+  /// Every object at the bottom of the hierarchy is named, including
+  /// empty collections.  They are in the order of the members, as
+  /// for begin(), not sorted.
   bsgNameList getNames();
 
+  /// \brief Like getNames(), but returns paths.
+  std::vector<bsgPath> getPaths();
+
   /// \brief Returns the names of objects containing the test point.
   ///
   /// Returns a collection of the names of objects containing the test
-  /// point.  Note that a "name" is actually a vector of names, one
-  /// for each level of the hierarchy.
-  bsgNameList insideBoundingBox(const glm::vec4 &testPoint);
+  /// point.  Note that a "name" is actually a list of names, one for
+  /// each level of the hierarchy.
+  bsgNameList insideBoundingBox(const glm::vec4 &testPoint) {
+    return bsgPath::getNames(insidePaths(testPoint));
+  }
+
+  /// \brief Like insideBoundingBox(), but adds paths to a list.
+  void addInsidePaths(const glm::vec4 &testPoint, bsgPath &prefix,
+                      std::vector<bsgPath> &out);
 
   /// \brief Returns a printable display of the collection.
   std::string printObj(const std::string &prefix) const;
@@ -1295,6 +3125,73 @@ class drawableCollection : public drawableMulti {
   void draw(const glm::mat4 &viewMatrix,
             const glm::mat4 &projMatrix);
 
+  /// \brief Adds all the members of this collection to a render queue.
+  ///
+  /// Leaves out the ones outside the queue's frustum.
+  void addToQueue(bsgRenderQueue &queue);
+
+  /// \brief The bounding box of the whole collection, in world space.
+  bool getWorldBoundingBox(glm::vec3 &lower, glm::vec3 &upper);
+
+  /// \brief Merge everything in this collection for faster drawing.
+  ///
+  /// Use this for parts of a scene that don't change, except to move
+  /// as a whole.  All the drawableObj objects of all the members of
+  /// this collection, and their members, are transformed into the
+  /// coordinates of this collection and merged into one object for
+  /// each combination of shader and kind of primitive (triangles,
+  /// lines, or points).  Those merged objects are then drawn instead
+  /// of the members, in a handful of draw calls.
+  ///
+  /// The members are still there, so you can still get at them, and
+  /// bounding box tests still work on the individual members.  This
+  /// collection itself can still be moved.  Adding, deleting, or
+  /// moving a member, or anything below one, or changing the data of
+  /// a merged drawableObj, unfreezes the collection, and what is
+  /// drawn goes back to following the members until you freeze()
+  /// again.
+  ///
+  /// The members keep their own buffers on the graphics card, so
+  /// unfreezing costs nothing, but the merged geometry is a second
+  /// copy, and a frozen collection uses about twice the memory.
+  ///
+  /// Objects that can't be merged, like drawableInstanced objects,
+  /// compounds with a dynamic drawableObj (see
+  /// drawableObj::setDynamic()), or primitives other than those
+  /// above, are drawn as usual.
+  void freeze();
+
+  /// \brief Go back to drawing the members themselves.
+  void unfreeze();
+
+  /// \brief Is the collection frozen?
+  bool isFrozen() { return _frozen; };
+
+  /// \brief How many objects does a frozen collection draw?
+  ///
+  /// This is the merged objects, plus the ones that couldn't be merged.
+  int getNumFrozenObjects() { return _frozenObjects.size(); };
+
+  /// \brief Turn view-frustum culling on or off for this collection.
+  ///
+  /// When culling is on, which is the default, a collection does not
+  /// draw any member whose bounding box is out of sight.  If the
+  /// member is itself a collection, none of its members are even
+  /// considered.  Collections inside this one keep their own setting.
+  void setCulling(const bool &culling) { _culling = culling; };
+  bool getCulling() { return _culling; };
+
+  /// \brief How many objects were culled in this frame?
+  ///
+  /// The counts include the collections inside this one.  A culled
+  /// collection counts as one object.  They start again at zero with
+  /// each load(), so they cover every draw of one frame, for example
+  /// both eyes of a stereo display.
+  int getNumCulled();
+
+  /// \brief How many objects were drawn in this frame?  See getNumCulled().
+  int getNumDrawn();
+
 };
 
 /// \brief A collection of drawable objects that make up a scene.
@@ -1357,6 +3254,10 @@ class scene {
 
   drawableCollection _sceneRoot;
 
+  /// For sorted drawing.  See setSortedDraw().
+  bool _sortedDraw;
+  bsgRenderQueue _renderQueue;
+
   glm::mat4 _viewMatrix;
   glm::mat4 _projMatrix;
 
@@ -1385,8 +3286,34 @@ class scene {
     _aspect = 1.0f;
     _nearClip = 0.1f;
     _farClip = 100.0f;
+    _sortedDraw = false;
   }
 
+  /// \brief Draw the scene sorted by shader and texture?
+  ///
+  /// When this is on, draw() collects the compound objects in the
+  /// scene into a bsgRenderQueue, sorts them, and sets up each shader
+  /// only once per draw.  It is off by default, because it changes
+  /// the order in which objects are drawn.
+  void setSortedDraw(const bool &sortedDraw) { _sortedDraw = sortedDraw; };
+
+  /// \brief Turn view-frustum culling on or off.
+  ///
+  /// This is for the scene's own collection; see
+  /// drawableCollection::setCulling().
+  void setCulling(const bool &culling) { _sceneRoot.setCulling(culling); };
+
+  /// \brief How many objects were culled, and how many drawn, in this
+  /// frame?  See drawableCollection::getNumCulled().
+  int getNumCulled() { return _sceneRoot.getNumCulled(); };
+  int getNumDrawn() { return _sceneRoot.getNumDrawn(); };
+
+  /// \brief Returns the render queue used for sorted drawing.
+  ///
+  /// Use this to see how many state changes were saved in the last
+  /// draw.
+  const bsgRenderQueue &getRenderQueue() { return _renderQueue; };
+
   /// \brief Where is the eye position?
   void setCameraPosition(const glm::vec3 cameraPosition) {
     _cameraPosition = cameraPosition;
@@ -1506,9 +3433,22 @@ class scene {
   /// using it.
   bsgPtr<drawableMulti> getObject(bsgName &name);
 
+  /// \brief Retrieve an object by path.
+  ///
+  /// The path starts below the scene root, as the ones from
+  /// insidePaths() do.
+  bsgPtr<drawableMulti> getObject(const bsgPath &path) {
+    return _sceneRoot.getObject(path);
+  }
+
   /// \brief Retrieve an object name identified by a selected point.
   bsgNameList insideBoundingBox(const glm::vec4 &testPoint);
 
+  /// \brief Like insideBoundingBox(), but returns paths.
+  std::vector<bsgPath> insidePaths(const glm::vec4 &testPoint) {
+    return _sceneRoot.insidePaths(testPoint);
+  }
+
   /// \brief Loads all the compound elements.
   void load();
 
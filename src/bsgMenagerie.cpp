@@ -1,7 +1,75 @@
 #include "bsgMenagerie.h"
+#include <sstream>
 
 namespace bsg {
 
+  std::map<std::string, DrawableObjList> *bsgGeometryCache::_cache = NULL;
+  bool bsgGeometryCache::_enabled = true;
+
+  std::string bsgGeometryCache::makeKey(const std::string &shape,
+                                        const glm::vec4 &params,
+                                        const glm::vec4 &color) {
+
+    // Enough digits that two different floats never print the same.
+    std::ostringstream key;
+    key.precision(9);
+    key << shape << ":" << params.x << "," << params.y << ","
+        << params.z << "," << params.w << ":" << color.r << ","
+        << color.g << "," << color.b << "," << color.a;
+    return key.str();
+  }
+
+  bool bsgGeometryCache::find(const std::string &key, DrawableObjList &objects) {
+
+    if (!_enabled || !_cache) return false;
+
+    std::map<std::string, DrawableObjList>::iterator it = _cache->find(key);
+    if (it == _cache->end()) return false;
+
+    objects.insert(objects.end(), it->second.begin(), it->second.end());
+    return true;
+  }
+
+  void bsgGeometryCache::add(const std::string &key, const DrawableObjList &objects) {
+
+    if (!_enabled) return;
+
+    if (!_cache) _cache = new std::map<std::string, DrawableObjList>;
+
+    purge();
+    (*_cache)[key] = objects;
+  }
+
+  int bsgGeometryCache::purge() {
+
+    if (!_cache) return 0;
+
+    int nDropped = 0;
+    std::map<std::string, DrawableObjList>::iterator it = _cache->begin();
+    while (it != _cache->end()) {
+
+      // If the cache holds the only pointers to these objects, no
+      // shape is using them.
+      bool inUse = false;
+      for (DrawableObjList::iterator jt = it->second.begin();
+           jt != it->second.end(); jt++) {
+        if (jt->getCount() > 1) {
+          inUse = true;
+          break;
+        }
+      }
+
+      if (inUse) {
+        it++;
+      } else {
+        _cache->erase(it++);
+        nDropped++;
+      }
+    }
+
+    return nDropped;
+  }
+
   drawableRectangle::drawableRectangle(bsgPtr<shaderMgr> pShader,
                                        const float &width, const float &height,
                                        const int &nDivs) :
@@ -178,6 +246,14 @@ namespace bsg {
 
     _name = randomName("sphere");
 
+    std::string key = bsgGeometryCache::makeKey("sphere",
+                                                glm::vec4(_phi, _theta, 0, 0),
+                                                color);
+    if (bsgGeometryCache::find(key, _objects)) {
+      _sphere = _objects.front();
+      return;
+    }
+
     float pi = 3.14159265358979323;
     float r = 0.5;
     float thetaStep = 2 * pi/_theta;
@@ -186,17 +262,17 @@ namespace bsg {
     std::vector<glm::vec4> verts(0);
     std::vector<glm::vec2> uvs(0);
     std::vector<glm::vec4> normals(0);
-    std::vector<glm::vec4> colors(0);
 
-    // Uses a triangle strip to draw the sphere, so two vertices are defined at a time and are automatically turned into
-    // a strip of triangles. (the / in |/|/|.../| are automatically filled in.)
-    for (int j = 0; j < _phi; j++) {
+    // The sphere is a grid of (_phi + 1) rings of (_theta + 1)
+    // vertices each.  The first and last vertex of each ring coincide,
+    // so the texture can wrap around.
+    for (int j = 0; j <= _phi; j++) {
         for (int i = 0; i < (_theta + 1); i++) {
-            // Top vertex position
+            // Vertex position
             verts.push_back(glm::vec4(r * std::sin(phiStep * j) * std::cos(-thetaStep * i), r * std::cos(phiStep * j),
               r * std::sin(phiStep * j) * std::sin(-thetaStep * i), 1.0f));
 
-            // Top vertex normal
+            // Vertex normal
             glm::vec4 normal = glm::vec4(r * std::sin(phiStep * j) * std::cos(-thetaStep * i),
                                          r * std::cos(phiStep * j),
                                          r * std::sin(phiStep * j) * std::sin(-thetaStep * i), 0.0f);
@@ -204,64 +280,62 @@ namespace bsg {
             normal = glm::normalize(normal);
             normals.push_back(normal);
 
-            // Top UV
+            // UV
             uvs.push_back(glm::vec2(static_cast<float>(i)/thetaTesselation, 1.0f - static_cast<float>(j)/phiTesselation));
-
-            // Bottom vertex position
-            verts.push_back(glm::vec4(r * std::sin(phiStep * (j + 1)) * std::cos(-thetaStep * i), r * std::cos(phiStep * (j + 1)),
-              r * std::sin(phiStep * (j + 1)) * std::sin(-thetaStep * i), 1.0f));
-
-            // Bottom vertex normal
-            normal = glm::vec4(r * std::sin(phiStep * (j + 1)) * std::cos(-thetaStep * i),
-                                r * std::cos(phiStep * (j + 1)),
-                                r * std::sin(phiStep * (j + 1)) * std::sin(-thetaStep * i), 0.0f);
-            normal = normalize(normal);
-            normals.push_back(normal);
-
-
-            // Bottom UV
-            uvs.push_back(glm::vec2(static_cast<float>(i)/thetaTesselation, 1.0f - static_cast<float>(j + 1)/phiTesselation));
-
-            // float c1 = ((double) rand() / (RAND_MAX));
-            // float c2 = ((double) rand() / (RAND_MAX));
-            // float c3 = ((double) rand() / (RAND_MAX));
-            // float c4 = ((double) rand() / (RAND_MAX));
-            // float c5 = ((double) rand() / (RAND_MAX));
-            // float c6 = ((double) rand() / (RAND_MAX));
-            // glm::vec4 randColor = glm::vec4(c1, c2, c3, 1.0f);
-            // glm::vec4 randColor2 = glm::vec4(c4, c5, c6, 1.0f);
-
-            // Color
-            colors.push_back(color);
-            colors.push_back(color);
         }
     }
 
-
+    // Uses a triangle strip to draw the sphere, so two vertices are defined at a time and are automatically turned into
+    // a strip of triangles. (the / in |/|/|.../| are automatically filled in.)  Each ring is used
+    // by the band above it and the band below it.
+    std::vector<GLuint> indices(0);
+    int ringLength = _theta + 1;
+    for (int j = 0; j < _phi; j++) {
+        for (int i = 0; i < ringLength; i++) {
+            indices.push_back(j * ringLength + i);
+            indices.push_back((j + 1) * ringLength + i);
+        }
+    }
 
     _sphere = new drawableObj();
 
     _sphere->addData(bsg::GLDATA_VERTICES, "position", verts);
 
-    _sphere->addData(bsg::GLDATA_COLORS, "color", colors);
+    _sphere->addConstantData(bsg::GLDATA_COLORS, "color", color);
 
     _sphere->addData(bsg::GLDATA_NORMALS, "normal", normals);
 
     _sphere->addData(bsg::GLDATA_TEXCOORDS, "texture", uvs);
 
+    _sphere->setIndices(indices);
+
     // The vertices above are arranged into a set of triangles.
-    _sphere->setDrawType(GL_TRIANGLE_STRIP, verts.size());
+    _sphere->setDrawType(GL_TRIANGLE_STRIP);
 
     addObject(_sphere);
+
+    bsgGeometryCache::add(key, _objects);
   }
 
   drawableCircle::drawableCircle(bsgPtr<shaderMgr> pShader, const int &thetaTesselation, const float &normalDirection, const float &yPos) :
     drawableCompound(pShader), _theta(thetaTesselation) {
       _name = randomName("circle");
       glm::vec4 color = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+      std::string key =
+        bsgGeometryCache::makeKey("circle",
+                                  glm::vec4(_theta, normalDirection, yPos, 0),
+                                  color);
+      if (bsgGeometryCache::find(key, _objects)) {
+        _circle = _objects.front();
+        return;
+      }
+
       _circle = new drawableObj();
       getCircle(_circle, _theta, normalDirection, yPos, color);
       addObject(_circle);
+
+      bsgGeometryCache::add(key, _objects);
     }
 
   // Useful function for creating the caps for the cylinder and the bottom of the cone.
@@ -270,8 +344,6 @@ namespace bsg {
 
       std::vector<glm::vec4> verts(0);
       std::vector<glm::vec2> uvs(0);
-      std::vector<glm::vec4> normals(0);
-      std::vector<glm::vec4> colors(0);
 
       float pi = 3.14159265358979323;
       float r = 0.5f;
@@ -284,35 +356,23 @@ namespace bsg {
       // Top vertex position
       verts.push_back(glm::vec4(0.0f, yPos, 0.0f, 1.0f));
 
-      // Top vertex normal
-      glm::vec4 normal = glm::vec4(0.0f, normalDirection, 0.0f, 0.0f);
-      normalize(normal);
-      normals.push_back(normal);
-
       // Top UV
       uvs.push_back(glm::vec2(0.5f, 0.5f));
 
-      colors.push_back(color);
-
       for (int j = 0; j < (thetaTesselation + 1); j++) {
 
           verts.push_back(glm::vec4(r * glm::cos(-normalDirection * thetaStep*j), yPos,
             r * glm::sin(-normalDirection * thetaStep*j), 1.0f));
 
-          normal = glm::vec4(0.0f, normalDirection, 0.0f, 0.0f);
-          normalize(normal);
-          normals.push_back(normal);
-
           uvs.push_back(glm::vec2(r * glm::cos(thetaStep*j) + 0.5f, r * glm::sin(thetaStep*j) + 0.5f));
-
-          // Color
-          colors.push_back(color);
       }
       circle->addData(bsg::GLDATA_VERTICES, "position", verts);
 
-      circle->addData(bsg::GLDATA_COLORS, "color", colors);
+      // The circle is flat and all one color, so those are constants.
+      circle->addConstantData(bsg::GLDATA_COLORS, "color", color);
 
-      circle->addData(bsg::GLDATA_NORMALS, "normal", normals);
+      circle->addConstantData(bsg::GLDATA_NORMALS, "normal",
+                              glm::vec4(0.0f, normalDirection, 0.0f, 0.0f));
 
       circle->addData(bsg::GLDATA_TEXCOORDS, "texture", uvs);
 
@@ -335,8 +395,7 @@ namespace bsg {
 
       std::vector<glm::vec4> verts(0);
       std::vector<glm::vec2> uvs(0);
-      std::vector<glm::vec4> normals(0);
-      std::vector<glm::vec4> colors(0);
+      std::vector<GLuint> indices(0);
 
       glm::vec3 horizontal = (topRight - topLeft) * (1.0f / tesselation);
       glm::vec3 vertical = (bottomLeft - topLeft) * (1.0f / tesselation);
@@ -345,37 +404,40 @@ namespace bsg {
       glm::vec4 normal = glm::vec4(n, 0.0f);
       glm::normalize(normal);
 
-      for (int i = 0; i < tesselation; ++i) {
+      // A grid of (tesselation + 1) x (tesselation + 1) vertices.  The
+      // interior ones are shared by the strips above and below them.
+      for (int i = 0; i <= tesselation; ++i) {
         for (int j = 0; j <= tesselation; ++j) {
-          // current vertex
           glm::vec3 currPos = topLeft + ((float) i * vertical) + ((float) j * horizontal);
-          // next vertex, directly below current. GL_TRIANGLE_STRIP will fill in the / in the |/|/.../| pattern.
-          glm::vec3 v = currPos + vertical;
           verts.push_back(glm::vec4(currPos, 1.0f));
-          verts.push_back(glm::vec4(v, 1.0f));
-
-          normals.push_back(normal);
-          normals.push_back(normal);
-
           uvs.push_back(glm::vec2(static_cast<float>(j)/tesselation, 1.0f - static_cast<float>(i)/tesselation));
-          uvs.push_back(glm::vec2(static_cast<float>(j)/tesselation, 1.0f - static_cast<float>(i + 1)/tesselation));
-
-          colors.push_back(color);
-          colors.push_back(color);
         }
       }
 
+      // Walk the grid the same way the old strip did: down one row and
+      // back, column by column, one row of cells after another.  The
+      // rows are joined without a restart, as they always have been.
+      int rowLength = tesselation + 1;
+      for (int i = 0; i < tesselation; ++i) {
+        for (int j = 0; j <= tesselation; ++j) {
+          indices.push_back(i * rowLength + j);
+          indices.push_back((i + 1) * rowLength + j);
+        }
+      }
 
       rect->addData(bsg::GLDATA_VERTICES, "position", verts);
 
-      rect->addData(bsg::GLDATA_COLORS, "color", colors);
+      // Likewise, the rectangle is flat and all one color.
+      rect->addConstantData(bsg::GLDATA_COLORS, "color", color);
 
-      rect->addData(bsg::GLDATA_NORMALS, "normal", normals);
+      rect->addConstantData(bsg::GLDATA_NORMALS, "normal", normal);
 
       rect->addData(bsg::GLDATA_TEXCOORDS, "texture", uvs);
 
+      rect->setIndices(indices);
+
       // The vertices above are arranged into a set of triangles.
-      rect->setDrawType(GL_TRIANGLE_STRIP, verts.size());
+      rect->setDrawType(GL_TRIANGLE_STRIP);
     }
 
 
@@ -384,6 +446,20 @@ namespace bsg {
     drawableCompound(pShader), _tess(tesselation) {
       _name = randomName("cube");
 
+      std::string key = bsgGeometryCache::makeKey("cube",
+                                                  glm::vec4(_tess, 0, 0, 0),
+                                                  color);
+      if (bsgGeometryCache::find(key, _objects)) {
+        DrawableObjList::iterator it = _objects.begin();
+        _front = *it++;
+        _back = *it++;
+        _left = *it++;
+        _right = *it++;
+        _top = *it++;
+        _bottom = *it++;
+        return;
+      }
+
       _front = new drawableObj;
       _back = new drawableObj;
       _left = new drawableObj;
@@ -404,6 +480,8 @@ namespace bsg {
       addObject(_right);
       addObject(_top);
       addObject(_bottom);
+
+      bsgGeometryCache::add(key, _objects);
     }
 
   drawableCone::drawableCone(bsgPtr<shaderMgr> pShader,
@@ -412,6 +490,16 @@ namespace bsg {
 
     _name = randomName("cone");
 
+    std::string key =
+      bsgGeometryCache::makeKey("cone",
+                                glm::vec4(heightTesselation, _theta, 0, 0),
+                                color);
+    if (bsgGeometryCache::find(key, _objects)) {
+      _cap = _objects.front();
+      _base = _objects.back();
+      return;
+    }
+
     _cap = new drawableObj();
     _base = new drawableObj();
 
@@ -426,59 +514,59 @@ namespace bsg {
     std::vector<glm::vec4> verts(0);
     std::vector<glm::vec2> uvs(0);
     std::vector<glm::vec4> normals(0);
-    std::vector<glm::vec4> colors(0);
 
 
 
-    for (int i = 0; i < heightTesselation; i++) {
+    // One ring of vertices for each of the (heightTesselation + 1)
+    // heights, shrinking linearly to a point at the top.
+    for (int i = 0; i <= heightTesselation; i++) {
         for (int j = 0; j < (thetaTesselation + 1); j++) {
             int linearScale = heightTesselation - i;
-            // Top vertex position
-            verts.push_back(glm::vec4(radius*heightStep*(linearScale - 1) * std::cos(-thetaStep*j), heightStep * (i + 1) - height/2,
-              radius*heightStep*(linearScale - 1) * std::sin(-thetaStep*j), 1.0f));
+            // Vertex position
+            verts.push_back(glm::vec4(radius*heightStep*linearScale * std::cos(-thetaStep*j), heightStep * i - height/2,
+              radius*heightStep*linearScale * std::sin(-thetaStep*j), 1.0f));
 
-            // Top vertex normal
+            // Vertex normal
             glm::vec4 normal = glm::vec4(2/(std::sqrt(5)) * std::cos(-thetaStep*j),
                                          1/(std::sqrt(5)),
                                          2/(std::sqrt(5)) * std::sin(-thetaStep*j), 0.0f);
             normal = normalize(normal);
             normals.push_back(normal);
 
-            // Top UV
-            uvs.push_back(glm::vec2(static_cast<float>(j)/thetaTesselation, static_cast<float>(i + 1)/heightTesselation));
-
-            // Bottom vertex position
-            verts.push_back(glm::vec4(radius*heightStep*linearScale * std::cos(-thetaStep*j), heightStep * i - height/2,
-              radius*heightStep*linearScale * std::sin(-thetaStep*j), 1.0f));
-
-            // Bottom vertex normal
-            normals.push_back(normal);
-
-            // Top UV
+            // UV
             uvs.push_back(glm::vec2(static_cast<float>(j)/thetaTesselation, static_cast<float>(i)/heightTesselation));
-
-            // Color
-            colors.push_back(color);
-            colors.push_back(color);
         }
+    }
 
+    // A triangle strip for each band, top ring first, then bottom.
+    std::vector<GLuint> indices(0);
+    int ringLength = thetaTesselation + 1;
+    for (int i = 0; i < heightTesselation; i++) {
+        for (int j = 0; j < ringLength; j++) {
+            indices.push_back((i + 1) * ringLength + j);
+            indices.push_back(i * ringLength + j);
+        }
     }
 
     _cap->addData(bsg::GLDATA_VERTICES, "position", verts);
 
-    _cap->addData(bsg::GLDATA_COLORS, "color", colors);
+    _cap->addConstantData(bsg::GLDATA_COLORS, "color", color);
 
     _cap->addData(bsg::GLDATA_NORMALS, "normal", normals);
 
     _cap->addData(bsg::GLDATA_TEXCOORDS, "texture", uvs);
 
+    _cap->setIndices(indices);
+
     // The vertices above are arranged into a set of triangles.
-    _cap->setDrawType(GL_TRIANGLE_STRIP, verts.size());
+    _cap->setDrawType(GL_TRIANGLE_STRIP);
 
     drawableCircle::getCircle(_base, _theta, -1, -radius/2.0f, color);
 
     addObject(_cap);
     addObject(_base);
+
+    bsgGeometryCache::add(key, _objects);
   }
 
 
@@ -489,6 +577,18 @@ namespace bsg {
   drawableCylinder::drawableCylinder(bsgPtr<shaderMgr> pShader, const int &heightTesselation, const int &thetaTesselation, const glm::vec4 &color) :
     drawableCompound(pShader), _height(heightTesselation), _theta(thetaTesselation) {
 
+    std::string key =
+      bsgGeometryCache::makeKey("cylinder",
+                                glm::vec4(heightTesselation, _theta, 0, 0),
+                                color);
+    if (bsgGeometryCache::find(key, _objects)) {
+      DrawableObjList::iterator it = _objects.begin();
+      _base = *it++;
+      _body = *it++;
+      _top = *it++;
+      return;
+    }
+
     float pi = 3.14159265358979323;
     float r = 0.5;
     float thetaStep = 2 * pi/thetaTesselation;
@@ -497,34 +597,32 @@ namespace bsg {
     std::vector<glm::vec4> verts(0);
     std::vector<glm::vec2> uvs(0);
     std::vector<glm::vec4> normals(0);
-    std::vector<glm::vec4> colors(0);
 
-    for (int i = 0; i < heightTesselation; i++) {
+    // One ring of vertices for each of the (heightTesselation + 1)
+    // heights.
+    for (int i = 0; i <= heightTesselation; i++) {
         for (int j = 0; j < (thetaTesselation + 1); j++) {
 
-            // Top vertex position
-            verts.push_back(glm::vec4(r * std::cos(-thetaStep * j), heightStep * (i + 1) - r, r * std::sin(-thetaStep * j), 1.0f));
+            // Vertex position
+            verts.push_back(glm::vec4(r * std::cos(-thetaStep * j), heightStep * i - r, r * std::sin(-thetaStep * j), 1.0f));
 
-            // Top vertex normal
+            // Vertex normal
             glm::vec4 normal = glm::vec4(r * std::cos(-thetaStep * j), 0, r * std::sin(-thetaStep * j), 0.0f);
             normal = normalize(normal);
             normals.push_back(normal);
 
-            // Top UV
-            uvs.push_back(glm::vec2(static_cast<float>(j)/thetaTesselation, static_cast<float>(i + 1)/heightTesselation));
-
-            // Bottom vertex position
-            verts.push_back(glm::vec4(r * std::cos(-thetaStep * j), heightStep * i - r, r * std::sin(-thetaStep * j), 1.0f));
-
-            // Bottom vertex normal
-            normals.push_back(normal);
-
-            // Bottom UV
+            // UV
             uvs.push_back(glm::vec2(static_cast<float>(j)/thetaTesselation, static_cast<float>(i)/heightTesselation));
+        }
+    }
 
-            // Colors
-            colors.push_back(color);
-            colors.push_back(color);
+    // A triangle strip for each band, top ring first, then bottom.
+    std::vector<GLuint> indices(0);
+    int ringLength = thetaTesselation + 1;
+    for (int i = 0; i < heightTesselation; i++) {
+        for (int j = 0; j < ringLength; j++) {
+            indices.push_back((i + 1) * ringLength + j);
+            indices.push_back(i * ringLength + j);
         }
     }
 
@@ -534,13 +632,15 @@ namespace bsg {
 
     _body->addData(bsg::GLDATA_VERTICES, "position", verts);
 
-    _body->addData(bsg::GLDATA_COLORS, "color", colors);
+    _body->addConstantData(bsg::GLDATA_COLORS, "color", color);
 
     _body->addData(bsg::GLDATA_NORMALS, "normal", normals);
 
     _body->addData(bsg::GLDATA_TEXCOORDS, "texture", uvs);
 
-    _body->setDrawType(GL_TRIANGLE_STRIP, verts.size());
+    _body->setIndices(indices);
+
+    _body->setDrawType(GL_TRIANGLE_STRIP);
 
     drawableCircle::getCircle(_top, _theta, 1, r, color);
     drawableCircle::getCircle(_base, _theta, -1, -r, color);
@@ -548,6 +648,8 @@ namespace bsg {
     addObject(_base);
     addObject(_body);
     addObject(_top);
+
+    bsgGeometryCache::add(key, _objects);
   }
 
   drawableAxes::drawableAxes(bsgPtr<shaderMgr> pShader, const float &length) :
@@ -598,15 +700,14 @@ drawableLine::drawableLine(bsgPtr<shaderMgr> pShader,
   _name = randomName("line");
   _line = new drawableObj();
 
-  std::vector<glm::vec4> lineVertices;
-  lineVertices.push_back(glm::vec4(start.x, start.y, start.z, 1.0f));
-  lineVertices.push_back(glm::vec4(end.x, end.y, end.z, 1.0f));
+  _lineVertices.push_back(glm::vec4(start.x, start.y, start.z, 1.0f));
+  _lineVertices.push_back(glm::vec4(end.x, end.y, end.z, 1.0f));
 
   std::vector<glm::vec4> lineColors;
   lineColors.push_back(glm::vec4(color.r, color.g, color.b, 1.0f));
   lineColors.push_back(glm::vec4(color.r, color.g, color.b, 1.0f));
 
-  _line->addData(bsg::GLDATA_VERTICES, "position", lineVertices);
+  _line->addData(bsg::GLDATA_VERTICES, "position", _lineVertices);
   _line->addData(bsg::GLDATA_COLORS, "color", lineColors);
 
   _line->setDrawType(GL_LINES);
@@ -614,17 +715,19 @@ drawableLine::drawableLine(bsgPtr<shaderMgr> pShader,
   _line->setSelectable(false);
   _line->setInterleaved(false);
 
+  // Lines like this often follow a tracker around, so stream the
+  // vertices.
+  _line->setDynamic(true);
+
   addObject(_line);
 }
 
 void drawableLine::setLineEnds(const glm::vec3 &start, const glm::vec3 &end) {
 
-  std::vector<glm::vec4> lineVertices;
-  lineVertices.push_back(glm::vec4(start.x, start.y, start.z, 1.0f));
-  lineVertices.push_back(glm::vec4(end.x, end.y, end.z, 1.0f));
-
-  _line->setData(bsg::GLDATA_VERTICES, lineVertices);
+  _lineVertices[0] = glm::vec4(start.x, start.y, start.z, 1.0f);
+  _lineVertices[1] = glm::vec4(end.x, end.y, end.z, 1.0f);
 
+  _line->updateData(bsg::GLDATA_VERTICES, 0, _lineVertices);
 }
 
 
@@ -640,9 +743,7 @@ drawableSaggyLine::drawableSaggyLine(bsgPtr<shaderMgr> pShader,
   _name = randomName("saggyLine");
   _line = new drawableObj();
 
-  std::vector<glm::vec4> lineVertices = _calculateCatenary(start, end,
-                                                           nSegments,
-                                                           sagFactor);
+  _calculateCatenary(start, end, nSegments, sagFactor, _lineVertices);
 
   std::vector<glm::vec4> lineColors;
   glm::vec4 spanColor = (endColor - startColor)/(float)nSegments;
@@ -654,32 +755,33 @@ drawableSaggyLine::drawableSaggyLine(bsgPtr<shaderMgr> pShader,
                                    1.0f));
   }
 
-  _line->addData(bsg::GLDATA_VERTICES, "position", lineVertices);
+  _line->addData(bsg::GLDATA_VERTICES, "position", _lineVertices);
   _line->addData(bsg::GLDATA_COLORS, "color", lineColors);
 
   _line->setDrawType(GL_LINE_STRIP);
 
   _line->setSelectable(false);
   _line->setInterleaved(false);
+  _line->setDynamic(true);
 
   addObject(_line);
 }
 
 void drawableSaggyLine::setLineEnds(const glm::vec3 &start, const glm::vec3 &end) {
 
-  std::vector<glm::vec4> lineVertices = _calculateCatenary(start, end,
-                                                           _nSegments,
-                                                           _sagFactor);
-  _line->setData(bsg::GLDATA_VERTICES, lineVertices);
+  _calculateCatenary(start, end, _nSegments, _sagFactor, _lineVertices);
+  _line->updateData(bsg::GLDATA_VERTICES, 0, _lineVertices);
 }
 
-std::vector<glm::vec4>
-drawableSaggyLine::_calculateCatenary(const glm::vec3 &start,
-                                      const glm::vec3 &end,
-                                      const int &nSegments,
-                                      const float &sagFactor) {
+void drawableSaggyLine::_calculateCatenary(const glm::vec3 &start,
+                                           const glm::vec3 &end,
+                                           const int &nSegments,
+                                           const float &sagFactor,
+                                           std::vector<glm::vec4> &out) {
 
-  std::vector<glm::vec4> out;
+  // Clearing keeps the capacity, so after the first time this
+  // doesn't allocate.
+  out.clear();
   glm::vec3 span = (end - start)/(float)nSegments;
 
   float len = glm::distance(start, end);
@@ -695,8 +797,6 @@ drawableSaggyLine::_calculateCatenary(const glm::vec3 &start,
                             start.z + i * span.z,
                             1.0f));
   }
-
-  return out;
 }
 
 drawablePoints::drawablePoints(bsgPtr<shaderMgr> pShader,
@@ -2,6 +2,60 @@
 
 namespace bsg {
 
+/// \brief A cache of shape geometry, shared by the menagerie shapes.
+///
+/// Two cubes (or spheres, or...) with the same tesselation and color
+/// differ only in their position, size, and orientation, which live
+/// in their model matrices.  So there is no reason for each one to
+/// have its own copy of the vertex data, or its own buffers on the
+/// GPU.  The shape constructors look here first, and share whatever
+/// drawableObj objects they find.  An entry stays in the cache as long
+/// as some shape is using it; see purge().
+class bsgGeometryCache {
+ private:
+
+  // This is a pointer so the cache is never destroyed at exit, when
+  // there may be no GL context left to take the buffers back.
+  static std::map<std::string, DrawableObjList> *_cache;
+  static bool _enabled;
+
+ public:
+
+  /// \brief Make a key for the cache.
+  ///
+  /// The params are whatever numbers determine the shape's geometry,
+  /// such as tesselation.  Unused ones should be zero.
+  static std::string makeKey(const std::string &shape,
+                             const glm::vec4 &params,
+                             const glm::vec4 &color);
+
+  /// \brief Look for some geometry.
+  ///
+  /// If the key is found, the cached objects are appended to the list
+  /// and the return is true.
+  static bool find(const std::string &key, DrawableObjList &objects);
+
+  /// \brief Put some geometry in the cache.
+  static void add(const std::string &key, const DrawableObjList &objects);
+
+  /// \brief Drop the entries nobody else is using.
+  ///
+  /// This releases their buffers, too.  It is called whenever
+  /// something is added, so the cache does not grow without limit,
+  /// but you can call it yourself after deleting a lot of shapes.
+  /// Returns the number of entries dropped.
+  static int purge();
+
+  /// \brief The number of entries in the cache.
+  static int size() { return _cache ? _cache->size() : 0; };
+
+  /// \brief Turn the cache on or off.
+  ///
+  /// It is on by default.  Turn it off if you want to change the
+  /// vertex data of one shape without changing all its twins.
+  static void setEnabled(const bool &enabled) { _enabled = enabled; };
+};
+
 class drawableRectangle : public drawableCompound {
  private:
 
@@ -126,6 +180,9 @@ class drawableLine : public drawableCompound {
  private:
   bsgPtr<drawableObj> _line;
 
+  // Kept around so moving the line doesn't allocate anything.
+  std::vector<glm::vec4> _lineVertices;
+
  public:
   drawableLine(bsgPtr<shaderMgr> pShader,
                const glm::vec3 &start, const glm::vec3 &end,
@@ -147,10 +204,14 @@ class drawableSaggyLine : public drawableCompound {
   float _sagFactor;
   int _nSegments;
 
-  std::vector<glm::vec4> _calculateCatenary(const glm::vec3 &start,
-                                            const glm::vec3 &end,
-                                            const int &nSegments,
-                                            const float &sagFactor);
+  // Kept around so moving the line doesn't allocate anything.
+  std::vector<glm::vec4> _lineVertices;
+
+  void _calculateCatenary(const glm::vec3 &start,
+                          const glm::vec3 &end,
+                          const int &nSegments,
+                          const float &sagFactor,
+                          std::vector<glm::vec4> &out);
 
  public:
   drawableSaggyLine(bsgPtr<shaderMgr> pShader,
@@ -1,7 +1,10 @@
 #include "bsgObjModel.h"
+#include <cmath>
 
 namespace bsg {
 
+bool drawableObjModel::_optimize = false;
+
 drawableObjModel::drawableObjModel(bsgPtr<shaderMgr> pShader,
                                    const std::string &fileName)
   : drawableCompound(pShader), _fileName(fileName), _includeBackFace(true) {
@@ -177,18 +180,30 @@ void drawableObjModel::_processObjFile() {
 
   // File parsing complete
 
-  // "Unpack" indices into Vertex Buffers to load them into graphics memory
+  // Build the vertex buffers.  Each distinct combination of vertex,
+  // texture coordinate, and normal indices becomes one vertex, and the
+  // triangles refer to them by index, so vertices shared between faces
+  // are only stored once.
 
   int nEntries = face_list[matIndex].size() / 3;
 
-  std::vector<glm::vec4> frontFaceVertices = std::vector<glm::vec4>(nEntries);
-  std::vector<glm::vec4> frontFaceColors = std::vector<glm::vec4>(nEntries);
-  std::vector<glm::vec4> frontFaceNormals = std::vector<glm::vec4>(nEntries);
-  std::vector<glm::vec2> frontFaceUVs = std::vector<glm::vec2>(nEntries);
-  std::vector<glm::vec4> backFaceVertices = std::vector<glm::vec4>(nEntries);
-  std::vector<glm::vec4> backFaceColors = std::vector<glm::vec4>(nEntries);
-  std::vector<glm::vec4> backFaceNormals = std::vector<glm::vec4>(nEntries);
-  std::vector<glm::vec2> backFaceUVs = std::vector<glm::vec2>(nEntries);
+  std::vector<glm::vec4> frontFaceVertices;
+  std::vector<glm::vec4> frontFaceColors;
+  std::vector<glm::vec4> frontFaceNormals;
+  std::vector<glm::vec2> frontFaceUVs;
+  std::vector<glm::vec4> backFaceNormals;
+  std::vector<GLuint> frontFaceIndices;
+  std::vector<GLuint> backFaceIndices;
+
+  // Maps an (v, (vt, vn)) triple from the file to its vertex index.
+  typedef std::pair<int, std::pair<int, int> > vertexKey;
+  std::map<vertexKey, GLuint> vertexIndices;
+
+  // Face normals that round to the same (x, y, z), and where they are
+  // in faceNormals.
+  typedef std::pair<int, std::pair<int, int> > normalKey;
+  std::map<normalKey, int> faceNormalIndices;
+  std::vector<glm::vec4> faceNormals;
 
   _frontFace = new drawableObj();
   if (_includeBackFace) _backFace = new drawableObj();
@@ -201,103 +216,133 @@ void drawableObjModel::_processObjFile() {
     int j = i * 9; // Start index of the triangle, since every triangle has 9
                    // indices (v1/vt1/vn1 v2/vt2/vn2 v3/vt3/vn3)
 
-    int writePos =
-        i * 3; // Writing position in vertex, color, normal and uv vectors
-
-    if (!(face_list[matIndex][j] < 0 || face_list[matIndex][j + 3] < 0 ||
-          face_list[matIndex][j + 6] < 0)) {
+    if (face_list[matIndex][j] < 0 || face_list[matIndex][j + 3] < 0 ||
+        face_list[matIndex][j + 6] < 0) {
       // Only process triangle if all of the vertex coordinate indices are valid
       // (>= 0)
+      continue;
+    }
 
-      // Add front-facing triangle
-      frontFaceVertices[writePos] = vert_list[face_list[matIndex][j]];
-      frontFaceVertices[writePos + 1] = vert_list[face_list[matIndex][j + 3]];
-      frontFaceVertices[writePos + 2] = vert_list[face_list[matIndex][j + 6]];
-
-      // Add back-facing triangle by flipping the order of the last two vertices
-      backFaceVertices[writePos] = vert_list[face_list[matIndex][j]];
-      backFaceVertices[writePos + 1] = vert_list[face_list[matIndex][j + 6]];
-      backFaceVertices[writePos + 2] = vert_list[face_list[matIndex][j + 3]];
-
-      if (!(face_list[matIndex][j + 1] < 0 || face_list[matIndex][j + 4] < 0 ||
-            face_list[matIndex][j + 7] < 0)) {
-        // All texture coordinate indices are valid (>= 0)
-        // Add front-facing triangle UVs
-        frontFaceUVs[writePos] = uv_list[face_list[matIndex][j + 1]];
-        frontFaceUVs[writePos + 1] = uv_list[face_list[matIndex][j + 4]];
-        frontFaceUVs[writePos + 2] = uv_list[face_list[matIndex][j + 7]];
-
-        // Add back-facing triangle UVs by flipping the order of the last two
-        // vertices
-        backFaceUVs[writePos] = uv_list[face_list[matIndex][j + 1]];
-        backFaceUVs[writePos + 1] = uv_list[face_list[matIndex][j + 7]];
-        backFaceUVs[writePos + 2] = uv_list[face_list[matIndex][j + 4]];
-      } else {
-        // At least one texture coordinate index was invalid, store generic
-        // texture coordinates
-        frontFaceUVs[writePos] = genericUV;
-        frontFaceUVs[writePos + 1] = genericUV;
-        frontFaceUVs[writePos + 2] = genericUV;
-        backFaceUVs[writePos] = genericUV;
-        backFaceUVs[writePos + 1] = genericUV;
-        backFaceUVs[writePos + 2] = genericUV;
+    // All texture coordinate indices are valid (>= 0)?  If not, we use
+    // generic texture coordinates for the whole triangle.
+    bool haveUVs = !(face_list[matIndex][j + 1] < 0 ||
+                     face_list[matIndex][j + 4] < 0 ||
+                     face_list[matIndex][j + 7] < 0);
+
+    // All normal indices are valid (>= 0)?  If not, calculate a face
+    // normal from the vertex data.
+    bool haveNormals = !(face_list[matIndex][j + 2] < 0 ||
+                         face_list[matIndex][j + 5] < 0 ||
+                         face_list[matIndex][j + 8] < 0);
+
+    // Triangles that lie in the same plane, or very nearly, share a
+    // face normal, so they can share the vertices along their common
+    // edges too.  Rounding to a thousandth moves a normal by well
+    // under a tenth of a degree.
+    int faceNormalIndex = -1;
+    if (!haveNormals) {
+      glm::vec3 a = glm::vec3(vert_list[face_list[matIndex][j]]) -
+                    glm::vec3(vert_list[face_list[matIndex][j + 3]]);
+      glm::vec3 b = glm::vec3(vert_list[face_list[matIndex][j]]) -
+                    glm::vec3(vert_list[face_list[matIndex][j + 6]]);
+      glm::vec3 n = glm::cross(a, b);
+
+      // A triangle with no area has no normal, and nothing to draw.
+      float length = glm::length(n);
+      if (!(length > 0.0f) || !std::isfinite(length)) continue;
+      n /= length;
+
+      glm::ivec3 r = glm::ivec3(glm::round(n * 1000.0f));
+      normalKey nKey(r.x, std::pair<int, int>(r.y, r.z));
+      std::map<normalKey, int>::iterator nit = faceNormalIndices.find(nKey);
+      if (nit == faceNormalIndices.end()) {
+        nit = faceNormalIndices.insert(std::make_pair(nKey, (int)faceNormals.size())).first;
+        faceNormals.push_back(glm::vec4(n, 1.0f));
       }
+      faceNormalIndex = nit->second;
+    }
+
+    GLuint corner[3];
+    for (int k = 0; k < 3; k++) {
+
+      int vIndex = face_list[matIndex][j + 3 * k];
+      int vtIndex = haveUVs ? face_list[matIndex][j + 3 * k + 1] : -1;
+
+      // Face normals are numbered below -1, so they can't be confused
+      // with normals from the file.
+      int vnIndex = haveNormals ? face_list[matIndex][j + 3 * k + 2] : -2 - faceNormalIndex;
+
+      vertexKey key(vIndex, std::pair<int, int>(vtIndex, vnIndex));
+      std::map<vertexKey, GLuint>::iterator it = vertexIndices.find(key);
 
-      if (!(face_list[matIndex][j + 2] < 0 || face_list[matIndex][j + 5] < 0 ||
-            face_list[matIndex][j + 8] < 0)) {
-        // All normal indices are valid (>= 0)
-        // Add front-facing triangle normals
-        frontFaceNormals[writePos] = normal_list[face_list[matIndex][j + 2]];
-        frontFaceNormals[writePos + 1] =
-            normal_list[face_list[matIndex][j + 5]];
-        frontFaceNormals[writePos + 2] =
-            normal_list[face_list[matIndex][j + 8]];
-
-        // Add back-facing triangle normals by negating front facing ones
-        backFaceNormals[writePos] = -normal_list[face_list[matIndex][j + 2]];
-        backFaceNormals[writePos + 1] =
-            -normal_list[face_list[matIndex][j + 5]];
-        backFaceNormals[writePos + 2] =
-            -normal_list[face_list[matIndex][j + 8]];
+      if (it != vertexIndices.end()) {
+        corner[k] = it->second;
       } else {
-        // At least one normal index was invalid, calculate face normal from
-        // vertex data
-        glm::vec3 a = glm::vec3(frontFaceVertices[writePos]) -
-                      glm::vec3(frontFaceVertices[writePos + 1]);
-        glm::vec3 b = glm::vec3(frontFaceVertices[writePos]) -
-                      glm::vec3(frontFaceVertices[writePos + 2]);
-        glm::vec3 n = glm::normalize(glm::cross(a, b));
-        glm::vec4 faceNormal = glm::vec4(n, 1.0f);
-
-        frontFaceNormals[writePos] = faceNormal;
-        frontFaceNormals[writePos + 1] = faceNormal;
-        frontFaceNormals[writePos + 2] = faceNormal;
-
-        // Add back-facing triangle normals by negating front facing ones
-        backFaceNormals[writePos] = -faceNormal;
-        backFaceNormals[writePos + 1] = -faceNormal;
-        backFaceNormals[writePos + 2] = -faceNormal;
+        corner[k] = frontFaceVertices.size();
+        vertexIndices[key] = corner[k];
+
+        glm::vec4 normal = haveNormals ? normal_list[vnIndex] :
+          faceNormals[faceNormalIndex];
+
+        frontFaceVertices.push_back(vert_list[vIndex]);
+        frontFaceColors.push_back(glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+        frontFaceNormals.push_back(normal);
+        frontFaceUVs.push_back(haveUVs ? uv_list[vtIndex] : genericUV);
+
+        // Back-facing normals are the negated front facing ones.
+        backFaceNormals.push_back(-normal);
       }
     }
+
+    // Add front-facing triangle
+    frontFaceIndices.push_back(corner[0]);
+    frontFaceIndices.push_back(corner[1]);
+    frontFaceIndices.push_back(corner[2]);
+  }
+
+  // The triangles come in file order, which makes poor use of the
+  // vertex cache.  Put them in a better order, and the vertices in
+  // the order the triangles use them.
+  if (_optimize) {
+    int nVertices = frontFaceVertices.size();
+
+    meshOptimizer::optimizeVertexCache(frontFaceIndices, nVertices);
+    std::vector<GLuint> remap =
+      meshOptimizer::optimizeVertexFetch(frontFaceIndices, nVertices);
+
+    frontFaceVertices = meshOptimizer::reorder(frontFaceVertices, remap);
+    frontFaceColors = meshOptimizer::reorder(frontFaceColors, remap);
+    frontFaceNormals = meshOptimizer::reorder(frontFaceNormals, remap);
+    frontFaceUVs = meshOptimizer::reorder(frontFaceUVs, remap);
+    backFaceNormals = meshOptimizer::reorder(backFaceNormals, remap);
+  }
+
+  // Add back-facing triangles by flipping the order of the last two
+  // vertices of each front-facing one.
+  for (size_t i = 0; i < frontFaceIndices.size(); i += 3) {
+    backFaceIndices.push_back(frontFaceIndices[i]);
+    backFaceIndices.push_back(frontFaceIndices[i + 2]);
+    backFaceIndices.push_back(frontFaceIndices[i + 1]);
   }
 
   _frontFace->addData(bsg::GLDATA_VERTICES, "position", frontFaceVertices);
   _frontFace->addData(bsg::GLDATA_COLORS, "color", frontFaceColors);
   _frontFace->addData(bsg::GLDATA_NORMALS, "normal", frontFaceNormals);
   _frontFace->addData(bsg::GLDATA_TEXCOORDS, "texture", frontFaceUVs);
-  _frontFace->setDrawType(GL_TRIANGLES, frontFaceVertices.size());
-
-  _backFace->addData(bsg::GLDATA_VERTICES, "position", backFaceVertices);
-  _backFace->addData(bsg::GLDATA_COLORS, "color", backFaceColors);
-  _backFace->addData(bsg::GLDATA_NORMALS, "normal", backFaceNormals);
-  _backFace->addData(bsg::GLDATA_TEXCOORDS, "texture", backFaceUVs);
-  _backFace->setDrawType(GL_TRIANGLES, backFaceVertices.size());
+  _frontFace->setIndices(frontFaceIndices);
+  _frontFace->setDrawType(GL_TRIANGLES);
 
-  
   _frontFace->setInterleaved(true);
   addObject(_frontFace);
 
   if (_includeBackFace) {
+    _backFace->addData(bsg::GLDATA_VERTICES, "position", frontFaceVertices);
+    _backFace->addData(bsg::GLDATA_COLORS, "color", frontFaceColors);
+    _backFace->addData(bsg::GLDATA_NORMALS, "normal", backFaceNormals);
+    _backFace->addData(bsg::GLDATA_TEXCOORDS, "texture", frontFaceUVs);
+    _backFace->setIndices(backFaceIndices);
+    _backFace->setDrawType(GL_TRIANGLES);
+
     _backFace->setInterleaved(true);
     addObject(_backFace);
   }
@@ -21,6 +21,8 @@ private:
 
   // So we can have two different constructors.
   void _processObjFile();
+
+  static bool _optimize;
   
 public:
   drawableObjModel(bsgPtr<shaderMgr> pShader, const std::string &fileName);
@@ -28,6 +30,15 @@ public:
                    const std::string &fileName,
                    const bool &back);
 
+  /// \brief Reorder the triangles of models as they are loaded.
+  ///
+  /// Off by default.  When it's on, the triangles and vertices are
+  /// rearranged by the meshOptimizer to make better use of the vertex
+  /// cache, at some cost in load time.  For models that are loaded
+  /// often, it is better to do this once, ahead of time, with the
+  /// objOptimize example, which also reports the cache miss ratio.
+  static void setOptimize(const bool &optimize) { _optimize = optimize; };
+
 };
 
 class material {